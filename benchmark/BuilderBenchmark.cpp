@@ -0,0 +1,968 @@
+// Benchmarks for NexusWriteCommandBuilder on synthetic instruments, scaled up
+// from the 8 monitor ZOOM example in main.cpp. Reports time, throughput,
+// heap allocations and peak heap usage for each measurement.
+//
+// Usage: nexus_json_cpp_benchmark [--quick]
+
+#include "BuildStats.h"
+#include "ChunkedPayload.h"
+#include "EscapeScan.h"
+#include "F142Encoder.h"
+#include "Iso8601.h"
+#include "MessageJournal.h"
+#include "NexusWriteCommandBuilder.h"
+#include "PublishPipeline.h"
+#include "StagingQueue.h"
+#include "StartMessageDelta.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Heap accounting, every allocation is prefixed with its size so that live and
+// peak usage can be tracked
+std::atomic<uint64_t> allocationCount{0};
+std::atomic<uint64_t> allocatedBytes{0};
+std::atomic<int64_t> liveBytes{0};
+std::atomic<int64_t> peakLiveBytes{0};
+
+const size_t allocationHeaderSize = alignof(std::max_align_t);
+
+void *countedAllocate(size_t size) {
+  auto *block =
+      static_cast<char *>(std::malloc(size + allocationHeaderSize));
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  *reinterpret_cast<size_t *>(block) = size;
+  allocationCount++;
+  allocatedBytes += size;
+  const auto live = liveBytes += static_cast<int64_t>(size);
+  auto peak = peakLiveBytes.load();
+  while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live)) {
+  }
+  return block + allocationHeaderSize;
+}
+
+void countedFree(void *pointer) {
+  if (pointer == nullptr) {
+    return;
+  }
+  auto *block = static_cast<char *>(pointer) - allocationHeaderSize;
+  liveBytes -= static_cast<int64_t>(*reinterpret_cast<size_t *>(block));
+  std::free(block);
+}
+}
+
+void *operator new(size_t size) { return countedAllocate(size); }
+void *operator new[](size_t size) { return countedAllocate(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return countedAllocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return countedAllocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void operator delete(void *pointer) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, size_t) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, size_t) noexcept {
+  countedFree(pointer);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Measurement {
+  std::string name;
+  size_t operations = 0;
+  double seconds = 0.0;
+  uint64_t allocations = 0;
+  uint64_t peakBytes = 0;
+  uint64_t outputBytes = 0;
+};
+
+class Benchmark {
+public:
+  // Time a block which performs the given number of operations, outputBytes
+  // is used to report throughput for serialisation
+  template <typename F>
+  void measure(const std::string &name, size_t operations, F &&function) {
+    const auto allocationsBefore = allocationCount.load();
+    const auto liveBefore = liveBytes.load();
+    peakLiveBytes = liveBefore;
+    const auto start = Clock::now();
+    const uint64_t outputBytes = function();
+    const auto end = Clock::now();
+
+    Measurement measurement;
+    measurement.name = name;
+    measurement.operations = operations;
+    measurement.seconds = std::chrono::duration<double>(end - start).count();
+    measurement.allocations = allocationCount.load() - allocationsBefore;
+    measurement.peakBytes =
+        static_cast<uint64_t>(peakLiveBytes.load() - liveBefore);
+    measurement.outputBytes = outputBytes;
+    print(measurement);
+  }
+
+  void heading(const std::string &title) const {
+    std::printf("\n%s\n%-44s %10s %12s %12s %12s %12s\n", title.c_str(),
+                "benchmark", "ops", "ns/op", "MB/s", "allocs/op", "peak KiB");
+  }
+
+private:
+  static void print(const Measurement &measurement) {
+    const auto operations =
+        static_cast<double>(std::max<size_t>(measurement.operations, 1));
+    const double megabytesPerSecond =
+        measurement.outputBytes > 0 && measurement.seconds > 0
+            ? static_cast<double>(measurement.outputBytes) / 1e6 /
+                  measurement.seconds
+            : 0.0;
+    std::printf("%-44s %10zu %12.1f %12.1f %12.2f %12.1f\n",
+                measurement.name.c_str(), measurement.operations,
+                measurement.seconds * 1e9 / operations, megabytesPerSecond,
+                static_cast<double>(measurement.allocations) / operations,
+                static_cast<double>(measurement.peakBytes) / 1024.0);
+  }
+};
+
+const std::string startTime = "2018-07-06T09:47:44";
+
+// The per-run datasets set in main.cpp
+void addRunDetails(NexusWriteCommandBuilder &builder) {
+  builder.addSample(6.0, 1.0, 6.0);
+  builder.addEndTime("2018-07-06T10:18:21");
+  builder.addTitle("MT Beam A2=6mm SANS");
+  builder.addTotalCounts(170700);
+  builder.addMonitorEventsNotSaved(0);
+  builder.addTotalUncountedCounts(7629);
+  builder.addMeasurement();
+  builder.addCollectionTime(1837.0);
+  builder.addDuration(1837.0);
+  builder.addProgramName("ISISICP.EXE", "SVN R1959");
+  builder.addProtonChargeRawInMicroAmpHours(20.061872482299805f);
+  builder.addProtonChargeInMicroAmpHours(20.061872482299805f);
+  builder.addUser("Alice", "The Unseen University");
+  builder.addUser("Bob", "The Unseen University");
+  builder.addPeriods(0, 21.20301055908203f, 20.061872482299805f, 18234, 1, 0,
+                     18234, 1, 1, "Period 1", 20.061872482299805f, 1, 18234);
+}
+
+std::vector<std::string> makePVs(size_t count) {
+  std::vector<std::string> pVs;
+  for (size_t i = 0; i < count; i++) {
+    pVs.push_back("IN:ZOOM:SE_" + std::to_string(i) + ":VALUE_" +
+                  std::to_string(i));
+  }
+  return pVs;
+}
+
+std::vector<float> makeSeries(size_t length, float scale) {
+  std::vector<float> values(length);
+  for (size_t i = 0; i < length; i++) {
+    values[i] =
+        scale * static_cast<float>(i) + 0.1f * static_cast<float>(i % 7);
+  }
+  return values;
+}
+
+// A synthetic instrument with scale times the monitors of the ZOOM example
+void populateInstrument(NexusWriteCommandBuilder &builder, uint32_t scale) {
+  addRunDetails(builder);
+  for (uint32_t detector = 1; detector <= scale; detector++) {
+    builder.addDetector(detector, 10.0f + static_cast<float>(detector));
+    builder.addEventDataSource(detector, "ICP");
+  }
+  builder.addSELogSources(makePVs(3 * scale));
+  for (uint32_t monitor = 1; monitor <= 8 * scale; monitor++) {
+    builder.addMonitor(monitor, monitor);
+  }
+  const auto times = makeSeries(4 * scale, 1.5f);
+  builder.addRunlogRecord<std::vector<float>>(
+      "count_rate", "float", makeSeries(4 * scale, 0.37f), times, startTime,
+      "counts");
+  builder.addFramelogRecord<std::vector<float>>(
+      "proton_charge", "float", makeSeries(4 * scale, 0.001f), times,
+      startTime, "uAh");
+}
+
+void benchmarkAddMethods(Benchmark &benchmark, uint32_t scale) {
+  benchmark.heading("add* methods, scale " + std::to_string(scale) + " (" +
+                    std::to_string(8 * scale) + " monitors)");
+  const uint32_t count = 8 * scale;
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+
+  benchmark.measure("addMonitor", count, [&] {
+    for (uint32_t i = 1; i <= count; i++) {
+      builder.addMonitor(i, i);
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("addDetector", count, [&] {
+    for (uint32_t i = 1; i <= count; i++) {
+      builder.addDetector(i, 1.0f);
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("addEventDataSource", count, [&] {
+    for (uint32_t i = 1; i <= count; i++) {
+      builder.addEventDataSource(i, "ICP");
+    }
+    return uint64_t(0);
+  });
+  const auto pVs = makePVs(count);
+  benchmark.measure("addSELogSources", count, [&] {
+    builder.addSELogSources(pVs);
+    return uint64_t(0);
+  });
+  {
+    // A second builder, since the PVs above are already registered
+    NexusWriteCommandBuilder refBuilder("ZOOM", 4112, "broker", "18_2",
+                                        startTime);
+    const std::vector<StringRef> pVRefs(pVs.begin(), pVs.end());
+    benchmark.measure("addSELogSources(StringRef)", count, [&] {
+      refBuilder.addSELogSources(pVRefs.data(), pVRefs.size());
+      return uint64_t(0);
+    });
+  }
+  benchmark.measure("addUser", count, [&] {
+    for (uint32_t i = 1; i <= count; i++) {
+      builder.addUser("User", "The Unseen University");
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("addVmsRecord<std::vector<int32_t>>", count, [&] {
+    const std::vector<int32_t> record{0, 1, 1, 0, 0, 1, 0};
+    for (uint32_t i = 1; i <= count; i++) {
+      builder.addVmsRecord<std::vector<int32_t>>("CRAT", "int32", record);
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("addPeriods", count, [&] {
+    for (uint32_t i = 1; i <= count; i++) {
+      builder.addPeriods(0, 21.2f, 20.06f, 18234, 1, 0, 18234, 1, 1,
+                         "Period 1", 20.06f, 1, 18234);
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("addPeriods(PeriodColumns)", count, [&] {
+    PeriodColumns periods;
+    periods.output.assign(count, 0);
+    periods.totalCountsInMegaElectronVolts.assign(count, 21.2f);
+    periods.protonChargeInMicroAmpHours.assign(count, 20.06f);
+    periods.goodFramesDaq.assign(count, 18234);
+    periods.sequences.assign(count, 1);
+    periods.framesRequested.assign(count, 0);
+    periods.goodFrames.assign(count, 18234);
+    periods.number.assign(count, 1);
+    periods.highestUsed.assign(count, 1);
+    periods.labels.assign(count, "Period 1");
+    periods.protonChargeRawInMicroAmpHours.assign(count, 20.06f);
+    periods.type.assign(count, 1);
+    periods.rawFrames.assign(count, 18234);
+    builder.addPeriods(std::move(periods));
+    return uint64_t(0);
+  });
+  benchmark.measure("scalar datasets (addTitle etc.)", 8 * count, [&] {
+    for (uint32_t i = 1; i <= count; i++) {
+      builder.addTitle("MT Beam A2=6mm SANS");
+      builder.addEndTime("2018-07-06T10:18:21");
+      builder.addTotalCounts(170700);
+      builder.addCollectionTime(1837.0);
+      builder.addNotes(" ");
+      builder.addProtonChargeInMicroAmpHours(20.06f);
+      builder.addProgramName("ISISICP.EXE", "SVN R1959");
+      builder.addMeasurement();
+    }
+    return uint64_t(0);
+  });
+}
+
+void benchmarkLogs(Benchmark &benchmark, const std::vector<size_t> &lengths) {
+  benchmark.heading("Runlog and framelog records of growing length");
+  for (const auto length : lengths) {
+    const auto times = makeSeries(length, 0.1f);
+    const auto values = makeSeries(length, 0.37f);
+    const auto intValues = std::vector<int32_t>(length, 11);
+    const size_t records = std::max<size_t>(1, 100000 / length);
+    NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2",
+                                     startTime);
+    benchmark.measure("addRunlogRecord<float> x" + std::to_string(length),
+                      records, [&] {
+                        for (size_t i = 0; i < records; i++) {
+                          builder.addRunlogRecord<std::vector<float>>(
+                              "count_rate", "float", values, times, startTime,
+                              "counts");
+                        }
+                        return uint64_t(0);
+                      });
+    benchmark.measure("addFramelogRecord<int32> x" + std::to_string(length),
+                      records, [&] {
+                        for (size_t i = 0; i < records; i++) {
+                          builder.addFramelogRecord<std::vector<int32_t>>(
+                              "events_log", "int32", intValues, times,
+                              startTime, "counts");
+                        }
+                        return uint64_t(0);
+                      });
+    // Copies are made before timing so only the move into the builder counts
+    std::vector<std::vector<float>> movedValues(records, values);
+    std::vector<std::vector<float>> movedTimes(records, times);
+    benchmark.measure("addFramelogRecord<float> moved x" +
+                          std::to_string(length),
+                      records, [&] {
+                        for (size_t i = 0; i < records; i++) {
+                          builder.addFramelogRecord<std::vector<float>>(
+                              "proton_charge", "float",
+                              std::move(movedValues[i]),
+                              std::move(movedTimes[i]), startTime, "uAh");
+                        }
+                        return uint64_t(0);
+                      });
+    std::string buffer;
+    benchmark.measure("  serialise compact", 1, [&] {
+      builder.writeStartMessage(buffer, JsonWriter::COMPACT);
+      return uint64_t(buffer.size());
+    });
+  }
+}
+
+// Runlog records arriving from several producer threads, through one builder
+// behind a mutex and through a staging queue per thread
+void benchmarkStaging(Benchmark &benchmark, const size_t records) {
+  const size_t producers =
+      std::max<size_t>(2, std::thread::hardware_concurrency());
+  benchmark.heading("Runlog records from " + std::to_string(producers) +
+                    " threads");
+  const auto times = makeSeries(100, 0.1f);
+  const auto values = makeSeries(100, 0.37f);
+  const auto runProducers = [&](std::function<void(size_t)> produce) {
+    std::vector<std::thread> threads;
+    for (size_t producer = 0; producer < producers; producer++) {
+      threads.emplace_back(produce, producer);
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  };
+
+  NexusWriteCommandBuilder lockedBuilder("ZOOM", 4112, "broker", "18_2",
+                                         startTime);
+  std::mutex builderMutex;
+  benchmark.measure("addRunlogRecord behind a mutex", records, [&] {
+    runProducers([&](size_t) {
+      for (size_t i = 0; i < records / producers; i++) {
+        std::lock_guard<std::mutex> lock(builderMutex);
+        lockedBuilder.addRunlogRecord<std::vector<float>>(
+            "count_rate", "float", values, times, startTime, "counts");
+      }
+    });
+    return uint64_t(0);
+  });
+
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  std::vector<std::shared_ptr<StagingQueue>> queues;
+  for (size_t producer = 0; producer < producers; producer++) {
+    queues.push_back(builder.createStagingQueue());
+  }
+  benchmark.measure("StagingQueue::addRunlogRecord", records, [&] {
+    runProducers([&](size_t producer) {
+      for (size_t i = 0; i < records / producers; i++) {
+        queues[producer]->addRunlogRecord<std::vector<float>>(
+            "count_rate", "float", values, times, startTime, "counts");
+      }
+    });
+    return uint64_t(0);
+  });
+  std::string buffer;
+  benchmark.measure("  serialise compact", 1, [&] {
+    builder.writeStartMessage(buffer, JsonWriter::COMPACT);
+    return uint64_t(buffer.size());
+  });
+}
+
+// Frame logs sharing one time axis, added as separate records and as columns
+void benchmarkLogColumns(Benchmark &benchmark,
+                         const std::vector<size_t> &lengths) {
+  const size_t logs = 8;
+  benchmark.heading(std::to_string(logs) +
+                    " framelogs sharing a time axis, records and columns");
+  for (const auto length : lengths) {
+    const auto times = makeSeries(length, 0.1f);
+    const auto values = makeSeries(length, 0.001f);
+    const auto label = " x" + std::to_string(length);
+    std::string buffer;
+
+    NexusWriteCommandBuilder records("ZOOM", 4112, "broker", "18_2",
+                                     startTime);
+    benchmark.measure("addFramelogRecord<float>" + label, logs, [&] {
+      for (size_t i = 0; i < logs; i++) {
+        records.addFramelogRecord<std::vector<float>>(
+            "log_" + std::to_string(i), "float", values, times, startTime,
+            "uAh");
+      }
+      return uint64_t(0);
+    });
+    benchmark.measure("  serialise compact", 1, [&] {
+      records.writeStartMessage(buffer, JsonWriter::COMPACT);
+      return uint64_t(buffer.size());
+    });
+
+    NexusWriteCommandBuilder columns("ZOOM", 4112, "broker", "18_2",
+                                     startTime);
+    benchmark.measure("addFramelogColumns<float>" + label, logs, [&] {
+      LogColumns batch(times, startTime);
+      for (size_t i = 0; i < logs; i++) {
+        batch.addColumn("log_" + std::to_string(i), "float", values.data(),
+                        values.size(), "uAh");
+      }
+      columns.addFramelogColumns(std::move(batch));
+      return uint64_t(0);
+    });
+    benchmark.measure("  serialise compact", 1, [&] {
+      columns.writeStartMessage(buffer, JsonWriter::COMPACT);
+      return uint64_t(buffer.size());
+    });
+    benchmark.measure("  serialise compact, shortest float32", 1, [&] {
+      columns.writeStartMessage(buffer, JsonWriter::COMPACT,
+                                FloatFormat::SHORTEST_FLOAT32);
+      return uint64_t(buffer.size());
+    });
+  }
+}
+
+void benchmarkTimestamps(Benchmark &benchmark, const size_t count) {
+  benchmark.heading("Absolute log timestamps");
+  std::vector<std::string> timestamps;
+  timestamps.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    const auto second = std::to_string(10 + i % 50);
+    const auto microseconds = std::to_string(100000 + i % 900000);
+    timestamps.push_back("2018-07-06T09:48:" + second + "." + microseconds +
+                         "+01:00");
+  }
+  uint64_t bytes = 0;
+  for (const auto &timestamp : timestamps) {
+    bytes += timestamp.size();
+  }
+  benchmark.measure("relativeLogTimes", count, [&] {
+    return relativeLogTimes(startTime, timestamps).size() == count ? bytes : 0;
+  });
+}
+
+void benchmarkSerialisation(Benchmark &benchmark,
+                            const std::vector<uint32_t> &scales) {
+  benchmark.heading("Start message serialisation");
+  for (const auto scale : scales) {
+    NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2",
+                                     startTime);
+    const auto label = " scale " + std::to_string(scale);
+    benchmark.measure("build instrument" + label, 1, [&] {
+      populateInstrument(builder, scale);
+      return uint64_t(0);
+    });
+    const size_t repeats = std::max<uint32_t>(1, 256 / scale);
+    std::string buffer;
+    benchmark.measure("startMessageAsString(4)" + label, repeats, [&] {
+      uint64_t bytes = 0;
+      for (size_t i = 0; i < repeats; i++) {
+        bytes += builder.startMessageAsString(4).size();
+      }
+      return bytes;
+    });
+    benchmark.measure("writeStartMessage reused buffer" + label, repeats,
+                      [&] {
+                        uint64_t bytes = 0;
+                        for (size_t i = 0; i < repeats; i++) {
+                          builder.writeStartMessage(buffer,
+                                                    JsonWriter::COMPACT);
+                          bytes += buffer.size();
+                        }
+                        return bytes;
+                      });
+    benchmark.measure("startMessageAsJson().dump(4)" + label, repeats, [&] {
+      uint64_t bytes = 0;
+      for (size_t i = 0; i < repeats; i++) {
+        bytes += builder.startMessageAsJson().dump(4).size();
+      }
+      return bytes;
+    });
+
+    // The next run on the instrument, as a delta against this one
+    NexusWriteCommandBuilder nextRun("ZOOM", 4113, "broker", "18_2",
+                                     startTime);
+    populateInstrument(nextRun, scale);
+    const auto baseline = builder.startMessageAsJson();
+    nlohmann::json delta;
+    benchmark.measure("startMessageDelta" + label, 1, [&] {
+      delta = nextRun.startMessageDelta(baseline);
+      return static_cast<uint64_t>(delta.dump().size());
+    });
+  }
+}
+}
+
+// Counts what it is given, so that only the pipeline itself is measured
+class CountingProducer : public MessageProducer {
+public:
+  void produce(const std::vector<PublishedMessage> &batch) override {
+    for (const auto &message : batch) {
+      bytes += message.payload.size();
+    }
+  }
+  uint64_t bytes = 0;
+};
+
+void benchmarkPublishing(Benchmark &benchmark, const uint32_t scale) {
+  benchmark.heading("Publish pipeline, scale " + std::to_string(scale));
+  auto builder = std::make_shared<NexusWriteCommandBuilder>(
+      "ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(*builder, scale);
+  const size_t runs = 256;
+  CountingProducer producer;
+  PublishPipeline pipeline(producer, "ZOOM_runInfo",
+                           std::thread::hardware_concurrency(), runs);
+  // The pipeline has room for every run, so this is the cost to the caller
+  benchmark.measure("tryPublish", runs, [&] {
+    for (size_t i = 0; i < runs; i++) {
+      pipeline.tryPublish(builder);
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("flush", runs, [&] {
+    pipeline.flush();
+    return producer.bytes;
+  });
+}
+
+// A runlog published as f142 messages during the run, against writing it into
+// the start message
+void benchmarkLogStreams(Benchmark &benchmark, const size_t length) {
+  benchmark.heading("Runlog of " + std::to_string(length) +
+                    " values as f142 messages");
+  const auto times = makeSeries(length, 0.1f);
+  const auto values = makeSeries(length, 0.37f);
+  CountingProducer producer;
+  benchmark.measure("F142LogPublisher::add", length, [&] {
+    F142LogPublisher publisher(producer, "ZOOM_runLog");
+    publisher.add("count_rate", values, times, startTime);
+    publisher.flush();
+    return producer.bytes;
+  });
+
+  std::string buffer;
+  NexusWriteCommandBuilder inlined("ZOOM", 4112, "broker", "18_2", startTime);
+  inlined.addRunlogRecord("count_rate", "float", values, times, startTime);
+  benchmark.measure("  start message with addRunlogRecord", 1, [&] {
+    inlined.writeStartMessage(buffer, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(buffer.size());
+  });
+  NexusWriteCommandBuilder streamed("ZOOM", 4112, "broker", "18_2",
+                                    startTime);
+  streamed.addRunlogStream("count_rate");
+  benchmark.measure("  start message with addRunlogStream", 1, [&] {
+    streamed.writeStartMessage(buffer, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(buffer.size());
+  });
+}
+
+// Changing the title of an existing start message with a long runlog, against
+// parsing it into a DOM and dumping it again
+void benchmarkAmendment(Benchmark &benchmark, const size_t length) {
+  benchmark.heading("Amending a start message with a runlog of " +
+                    std::to_string(length));
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 1);
+  builder.addRunlogRecord<std::vector<float>>(
+      "count_rate", "float", makeSeries(length, 0.37f),
+      makeSeries(length, 0.1f), startTime, "counts");
+  std::string message;
+  builder.writeStartMessage(message, JsonWriter::COMPACT);
+  const std::string newTitle = "Amended title";
+
+  std::string amended;
+  benchmark.measure("fromStartMessage + addTitle + write", 1, [&] {
+    auto loaded = NexusWriteCommandBuilder::fromStartMessage(message);
+    loaded.addTitle(newTitle);
+    loaded.writeStartMessage(amended, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(message.size());
+  });
+  benchmark.measure("parse + edit title + dump", 1, [&] {
+    auto parsed = nlohmann::json::parse(message);
+    for (auto &child : parsed["nexus_structure"]["children"][0]["children"]) {
+      if (child["name"] == "title") {
+        child["values"] = newTitle;
+      }
+    }
+    return static_cast<uint64_t>(parsed.dump().size());
+  });
+}
+
+// A start message with long logs split into 1 MiB chunks, with and without
+// compression. The peak heap usage shows that no second copy of the whole
+// message is made on the way.
+void benchmarkChunking(Benchmark &benchmark, const size_t length) {
+  benchmark.heading("Chunked start message with a runlog of " +
+                    std::to_string(length));
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 16);
+  builder.addRunlogRecord<std::vector<float>>(
+      "count_rate", "float", makeSeries(length, 0.37f),
+      makeSeries(length, 0.1f), startTime, "counts");
+  const size_t maxChunkSize = 1024 * 1024;
+
+  std::string message;
+  benchmark.measure("writeStartMessage compact", 1, [&] {
+    builder.writeStartMessage(message, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(message.size());
+  });
+  for (const bool compress : {false, true}) {
+    std::vector<std::string> chunks;
+    uint64_t chunkBytes = 0;
+    benchmark.measure(compress ? "writeStartMessageChunks LZ4"
+                               : "writeStartMessageChunks",
+                      1, [&] {
+                        writeStartMessageChunks(
+                            builder, 1, maxChunkSize,
+                            [&](const char *, size_t size) {
+                              chunkBytes += size;
+                            },
+                            compress);
+                        return static_cast<uint64_t>(message.size());
+                      });
+    writeStartMessageChunks(builder, 1, maxChunkSize,
+                            [&](const char *data, size_t size) {
+                              chunks.emplace_back(data, size);
+                            },
+                            compress);
+    std::string reassembled;
+    benchmark.measure("  ChunkReassembler::add", chunks.size(), [&] {
+      ChunkReassembler reassembler;
+      uint64_t messageID = 0;
+      for (const auto &chunk : chunks) {
+        reassembler.add(chunk.data(), chunk.size(), messageID, reassembled);
+      }
+      return static_cast<uint64_t>(reassembled.size());
+    });
+    std::printf("  %zu chunks, %.1f%% of the message\n", chunks.size(),
+                100.0 * static_cast<double>(chunkBytes) /
+                    static_cast<double>(message.size()));
+  }
+}
+
+// Monitors and a detector bank's pixels added in bulk as ranges, against
+// adding the monitors one at a time and the DOM reference for the pixels
+void benchmarkDeviceRanges(Benchmark &benchmark, const uint32_t monitors,
+                           const uint32_t pixels) {
+  benchmark.heading(std::to_string(monitors) + " monitors and " +
+                    std::to_string(pixels) + " detector pixels");
+  NexusWriteCommandBuilder oneByOne("ZOOM", 4112, "broker", "18_2",
+                                    startTime);
+  benchmark.measure("addMonitor", monitors, [&] {
+    for (uint32_t monitor = 1; monitor <= monitors; monitor++) {
+      oneByOne.addMonitor(monitor, 2 * monitor + 7);
+    }
+    return uint64_t(0);
+  });
+  NexusWriteCommandBuilder ranged("ZOOM", 4112, "broker", "18_2", startTime);
+  benchmark.measure("addMonitors", monitors, [&] {
+    ranged.addMonitors(1, monitors, 9, 2);
+    return uint64_t(0);
+  });
+  std::string expected;
+  std::string message;
+  benchmark.measure("  serialise addMonitor", 1, [&] {
+    oneByOne.writeStartMessage(expected, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(expected.size());
+  });
+  benchmark.measure("  serialise addMonitors", 1, [&] {
+    ranged.writeStartMessage(message, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(message.size());
+  });
+
+  // Tubes of 512 pixels, each tube numbered from a multiple of 1000 and
+  // mapped to spectra in reverse
+  const uint32_t tubeLength = 512;
+  std::vector<int32_t> detectorNumbers;
+  std::vector<int32_t> spectrumIndices;
+  for (uint32_t pixel = 0; pixel < pixels; pixel++) {
+    const auto tube = pixel / tubeLength;
+    detectorNumbers.push_back(
+        static_cast<int32_t>(1000 * tube + pixel % tubeLength));
+    spectrumIndices.push_back(
+        static_cast<int32_t>(tubeLength * (tube + 1) - pixel % tubeLength));
+  }
+  SpectrumMap spectrumMap;
+  benchmark.measure("SpectrumMap::add arrays", pixels, [&] {
+    spectrumMap.add(detectorNumbers.data(), spectrumIndices.data(), pixels);
+    return uint64_t(0);
+  });
+  std::printf("  %zu runs\n", spectrumMap.runs().size());
+  NexusWriteCommandBuilder bank("ZOOM", 4112, "broker", "18_2", startTime);
+  bank.addDetector(1, 10.0f, std::move(spectrumMap));
+  benchmark.measure("  serialise detector bank", 1, [&] {
+    bank.writeStartMessage(message, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(message.size());
+  });
+  benchmark.measure("  startMessageAsJson().dump()", 1, [&] {
+    expected = bank.startMessageAsJson().dump();
+    return static_cast<uint64_t>(expected.size());
+  });
+}
+
+// Runlog and framelog streams and event data sources, whose topics, writer
+// modules and path prefixes are shared through the builder's StringPool
+void benchmarkStreams(Benchmark &benchmark, const uint32_t count) {
+  benchmark.heading(std::to_string(count) + " streams of each kind");
+  std::vector<std::string> names;
+  for (uint32_t i = 0; i < count; i++) {
+    names.push_back("SE_" + std::to_string(i) + "_temperature");
+  }
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  benchmark.measure("addRunlogStream", count, [&] {
+    for (const auto &name : names) {
+      builder.addRunlogStream(name);
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("addFramelogStream", count, [&] {
+    for (const auto &name : names) {
+      builder.addFramelogStream(name);
+    }
+    return uint64_t(0);
+  });
+  benchmark.measure("addEventDataSource", count, [&] {
+    for (uint32_t detector = 1; detector <= count; detector++) {
+      builder.addEventDataSource(detector, "ICP");
+    }
+    return uint64_t(0);
+  });
+  std::string message;
+  std::string expected;
+  benchmark.measure("  serialise", 1, [&] {
+    builder.writeStartMessage(message, JsonWriter::COMPACT);
+    return static_cast<uint64_t>(message.size());
+  });
+  benchmark.measure("  startMessageAsJson().dump()", 1, [&] {
+    expected = builder.startMessageAsJson().dump();
+    return static_cast<uint64_t>(expected.size());
+  });
+}
+
+// Free text such as the notes of a run: lines of prose with the occasional
+// quote and accented letter
+std::string makeFreeText(const size_t size) {
+  const std::string sentences[] = {
+      "Sample changed after the cryostat was warmed to room temperature. ",
+      "Beam off for 20 minutes, the \"shutter\" interlock tripped. ",
+      "Aligned the slits and repeated the transmission measurement. ",
+      "R\xc3\xa9glage of the chopper phase by the instrument scientist.\n"};
+  std::string text;
+  for (size_t i = 0; text.size() < size; i++) {
+    text += sentences[(i * 3 + i / 4) % 4];
+  }
+  text.resize(size);
+  return text;
+}
+
+// Escaping of long free text, which is copied in runs between the bytes
+// found by the SSE2 or AVX2 scanner, against nlohmann::json::dump. The
+// scanners are checked by the tests.
+void benchmarkEscaping(Benchmark &benchmark, const size_t size) {
+  benchmark.heading("Escaping " + std::to_string(size) +
+                    " bytes of free text, " +
+                    escapeScannerName(bestEscapeScanner()) + " scanner");
+  const auto text = makeFreeText(size);
+  const size_t repeats = 64;
+  for (const auto scanner : {EscapeScanner::SCALAR, EscapeScanner::SSE2,
+                             EscapeScanner::AVX2}) {
+    if (!escapeScannerSupported(scanner)) {
+      continue;
+    }
+    benchmark.measure(std::string("findSpecialByte ") +
+                          escapeScannerName(scanner),
+                      repeats, [&] {
+                        for (size_t i = 0; i < repeats; i++) {
+                          for (size_t index = 0; index < text.size();
+                               index++) {
+                            index = findSpecialByte(scanner, text.data(),
+                                                    index, text.size());
+                          }
+                        }
+                        return static_cast<uint64_t>(repeats * text.size());
+                      });
+  }
+  std::string output;
+  benchmark.measure("JsonWriter::value", repeats, [&] {
+    for (size_t i = 0; i < repeats; i++) {
+      output.clear();
+      JsonWriter writer(output, JsonWriter::COMPACT);
+      writer.value(text);
+    }
+    return static_cast<uint64_t>(repeats * output.size());
+  });
+  benchmark.measure("nlohmann::json::dump", repeats, [&] {
+    const nlohmann::json json(text);
+    for (size_t i = 0; i < repeats; i++) {
+      output = json.dump();
+    }
+    return static_cast<uint64_t>(repeats * output.size());
+  });
+}
+
+// Print the instrumentation's breakdown of a run, which is only recorded when
+// built with NEXUS_JSON_INSTRUMENTATION
+void printBuildStats(const uint32_t scale) {
+  std::printf("\nBuild statistics by section, scale %u\n", scale);
+  if (!buildStatsEnabled) {
+    std::printf("Not recorded, build with NEXUS_JSON_INSTRUMENTATION\n");
+    return;
+  }
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, scale);
+  std::string buffer;
+  const int serialisations = 16;
+  for (int i = 0; i < serialisations; i++) {
+    builder.writeStartMessage(buffer, JsonWriter::COMPACT);
+  }
+  const auto stats = builder.buildStats();
+  std::printf("%-16s %8s %8s %12s %10s %12s %12s %10s\n", "section", "nodes",
+              "calls", "add ns", "add allocs", "bytes/msg", "ns/msg",
+              "allocs/msg");
+  for (size_t i = 0; i < numberOfBuildSections; i++) {
+    const auto &section = stats.sections[i];
+    std::printf(
+        "%-16s %8llu %8llu %12llu %10llu %12llu %12llu %10.2f\n",
+        buildSectionName(static_cast<BuildSection>(i)),
+        static_cast<unsigned long long>(section.nodes),
+        static_cast<unsigned long long>(section.addCalls),
+        static_cast<unsigned long long>(section.addNanoseconds),
+        static_cast<unsigned long long>(section.addAllocations),
+        static_cast<unsigned long long>(section.serialisedBytes /
+                                        stats.serialisations),
+        static_cast<unsigned long long>(section.serialiseNanoseconds /
+                                        stats.serialisations),
+        static_cast<double>(section.serialiseAllocations) /
+            static_cast<double>(stats.serialisations));
+  }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+void benchmarkJournal(Benchmark &benchmark, const uint32_t scale) {
+  benchmark.heading("Message journal, scale " + std::to_string(scale));
+  char directory[] = "/tmp/nexus_journal_XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    std::printf("ERROR: could not create a journal directory\n");
+    std::exit(1);
+  }
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, scale);
+  std::string startMessage;
+  builder.writeStartMessage(startMessage, JsonWriter::COMPACT);
+  const size_t runs = 1024;
+  std::vector<std::string> jobIDs;
+  for (size_t i = 0; i < runs; i++) {
+    jobIDs.push_back("job-" + std::to_string(i));
+  }
+
+  size_t numberOfSegments = 0;
+  {
+    MessageJournalWriter journal(directory);
+    benchmark.measure("MessageJournalWriter::append", runs, [&] {
+      for (const auto &jobID : jobIDs) {
+        journal.append(jobID, JournalMessageKind::START, startMessage);
+      }
+      return static_cast<uint64_t>(runs * startMessage.size());
+    });
+  }
+  {
+    std::unique_ptr<MessageJournalReader> journal;
+    benchmark.measure("open and index", runs, [&] {
+      journal.reset(new MessageJournalReader(directory));
+      return uint64_t(0);
+    });
+    StringRef message("", 0);
+    benchmark.measure("MessageJournalReader::find", runs, [&] {
+      uint64_t bytes = 0;
+      for (const auto &jobID : jobIDs) {
+        journal->find(jobID, JournalMessageKind::START, message);
+        bytes += message.size();
+      }
+      return bytes;
+    });
+    numberOfSegments = journal->numberOfSegments();
+  }
+  for (size_t i = 0; i < numberOfSegments; i++) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "/journal-%06zu.seg", i);
+    unlink((std::string(directory) + name).c_str());
+  }
+  rmdir(directory);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  const bool quick = argc > 1 && std::string(argv[1]) == "--quick";
+  const std::vector<uint32_t> scales =
+      quick ? std::vector<uint32_t>{1, 16}
+            : std::vector<uint32_t>{1, 16, 128, 512};
+  const std::vector<size_t> logLengths =
+      quick ? std::vector<size_t>{10, 1000}
+            : std::vector<size_t>{10, 1000, 100000, 1000000};
+
+  setAllocationCounter([] { return allocationCount.load(); });
+
+  Benchmark benchmark;
+  for (const auto scale : scales) {
+    benchmarkAddMethods(benchmark, scale);
+  }
+  benchmarkLogs(benchmark, logLengths);
+  benchmarkStaging(benchmark, quick ? 4096 : 65536);
+  benchmarkLogColumns(benchmark, logLengths);
+  benchmarkTimestamps(benchmark, logLengths.back());
+  benchmarkSerialisation(benchmark, scales);
+  benchmarkPublishing(benchmark, scales.back());
+  benchmarkLogStreams(benchmark, logLengths.back());
+  benchmarkAmendment(benchmark, logLengths.back());
+  benchmarkChunking(benchmark, logLengths.back());
+  benchmarkEscaping(benchmark, quick ? 4096 : 1024 * 1024);
+  benchmarkDeviceRanges(benchmark, quick ? 512 : 8192,
+                        quick ? 16384 : 512 * 1024);
+  benchmarkStreams(benchmark, quick ? 1024 : 32768);
+#if defined(__unix__) || defined(__APPLE__)
+  benchmarkJournal(benchmark, scales.back());
+#endif
+  printBuildStats(scales.back());
+
+#if defined(__unix__) || defined(__APPLE__)
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  std::printf("\nMaximum resident set size: %ld KiB\n", usage.ru_maxrss);
+#endif
+  return 0;
+}
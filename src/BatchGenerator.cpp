@@ -0,0 +1,158 @@
+#include "BatchGenerator.h"
+#include "MessageJournal.h"
+#include "RunDescription.h"
+#include "StartMessageDelta.h"
+#include "ThreadPool.h"
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Number of runs read ahead, bounds the memory used for the messages which
+// are waiting to be written in order
+const size_t runsPerChunk = 4096;
+
+struct RunResult {
+  size_t lineNumber = 0;
+  std::string description;
+  std::string instrument;
+  std::string jobID;
+  std::string startMessage;
+  std::string stopMessage;
+  // Set when the start message is to be replaced by a delta against it
+  const nlohmann::json *baseline = nullptr;
+  std::exception_ptr error;
+};
+
+// Start messages by instrument, each the first one in the batch
+using Baselines = std::unordered_map<std::string, nlohmann::json>;
+
+// Replace the start messages of the runs after each instrument's first with
+// deltas against it. The baselines are picked in input order, the deltas are
+// created in parallel.
+void createDeltas(std::vector<RunResult> &chunk, const size_t runsInChunk,
+                  Baselines &baselines, ThreadPool &threadPool) {
+  for (size_t i = 0; i < runsInChunk; i++) {
+    auto &result = chunk[i];
+    result.baseline = nullptr;
+    if (result.error) {
+      continue;
+    }
+    const auto baseline = baselines.find(result.instrument);
+    if (baseline == baselines.end()) {
+      baselines.emplace(result.instrument,
+                        nlohmann::json::parse(result.startMessage));
+    } else {
+      result.baseline = &baseline->second;
+    }
+  }
+  for (size_t i = 0; i < runsInChunk; i++) {
+    auto &result = chunk[i];
+    if (result.baseline == nullptr) {
+      continue;
+    }
+    threadPool.submit([&result] {
+      try {
+        result.startMessage =
+            createStartMessageDelta(*result.baseline,
+                                    nlohmann::json::parse(result.startMessage))
+                .dump();
+      } catch (...) {
+        result.error = std::current_exception();
+      }
+    });
+  }
+  threadPool.waitForAll();
+}
+
+// Build the runs in chunks and pass each run's result to writeRun in input
+// order
+template <typename F>
+size_t generateRuns(std::istream &runDescriptions,
+                    const size_t numberOfThreads, const bool startMessageDeltas,
+                    F writeRun) {
+  ThreadPool threadPool(numberOfThreads);
+  InstrumentSkeletonCache skeletons;
+  Baselines baselines;
+  std::vector<RunResult> chunk(runsPerChunk);
+  size_t lineNumber = 0;
+  size_t numberOfRuns = 0;
+
+  while (runDescriptions) {
+    size_t runsInChunk = 0;
+    while (runsInChunk < runsPerChunk &&
+           std::getline(runDescriptions, chunk[runsInChunk].description)) {
+      lineNumber++;
+      if (chunk[runsInChunk].description.find_first_not_of(" \t\r") ==
+          std::string::npos) {
+        continue;
+      }
+      chunk[runsInChunk].lineNumber = lineNumber;
+      runsInChunk++;
+    }
+
+    for (size_t i = 0; i < runsInChunk; i++) {
+      auto &result = chunk[i];
+      threadPool.submit([&result, &skeletons] {
+        try {
+          const auto run = nlohmann::json::parse(result.description);
+          const auto builder = createBuilderFromRunDescription(run, skeletons);
+          result.instrument = run.at("instrument").get<std::string>();
+          result.jobID = builder.jobID();
+          builder.writeStartMessage(result.startMessage, JsonWriter::COMPACT);
+          builder.writeStopMessage(result.stopMessage, JsonWriter::COMPACT);
+          result.error = nullptr;
+        } catch (...) {
+          result.error = std::current_exception();
+        }
+      });
+    }
+    threadPool.waitForAll();
+    if (startMessageDeltas) {
+      createDeltas(chunk, runsInChunk, baselines, threadPool);
+    }
+
+    for (size_t i = 0; i < runsInChunk; i++) {
+      const auto &result = chunk[i];
+      if (result.error) {
+        try {
+          std::rethrow_exception(result.error);
+        } catch (const std::exception &error) {
+          throw std::runtime_error("Run description on line " +
+                                   std::to_string(result.lineNumber) + ": " +
+                                   error.what());
+        }
+      }
+      writeRun(result);
+    }
+    numberOfRuns += runsInChunk;
+  }
+  return numberOfRuns;
+}
+}
+
+size_t generateBatch(std::istream &runDescriptions,
+                     std::ostream &startMessages, std::ostream &stopMessages,
+                     const size_t numberOfThreads,
+                     const bool startMessageDeltas) {
+  return generateRuns(runDescriptions, numberOfThreads, startMessageDeltas,
+                      [&](const RunResult &result) {
+                        startMessages << result.startMessage << '\n';
+                        stopMessages << result.stopMessage << '\n';
+                      });
+}
+
+size_t generateBatch(std::istream &runDescriptions,
+                     MessageJournalWriter &journal,
+                     const size_t numberOfThreads) {
+  return generateRuns(runDescriptions, numberOfThreads, false,
+                      [&journal](const RunResult &result) {
+                        journal.append(result.jobID, JournalMessageKind::START,
+                                       result.startMessage);
+                        journal.append(result.jobID, JournalMessageKind::STOP,
+                                       result.stopMessage);
+                      });
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+
+class MessageJournalWriter;
+
+// Generate the start and stop messages for a stream of runs, described one per
+// line in the JSON format accepted by createBuilderFromRunDescription. The
+// runs are built in parallel and the compact messages are written one per
+// line, in the same order as the input. Returns the number of runs.
+// With startMessageDeltas the first run of each instrument has its full start
+// message written and the instrument's later runs have a delta against it,
+// see StartMessageDelta.h.
+size_t generateBatch(std::istream &runDescriptions,
+                     std::ostream &startMessages, std::ostream &stopMessages,
+                     size_t numberOfThreads, bool startMessageDeltas = false);
+
+// As above, with the full start and stop messages of each run appended to a
+// journal under the run's job ID, see MessageJournal.h
+size_t generateBatch(std::istream &runDescriptions,
+                     MessageJournalWriter &journal, size_t numberOfThreads);
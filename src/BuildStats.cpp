@@ -0,0 +1,197 @@
+#include "BuildStats.h"
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+const char *const sectionNames[numberOfBuildSections] = {
+    "entry",           "instrument", "monitors", "detectors", "selog",
+    "periods",         "isis_vms_compat", "runlog", "framelog"};
+
+std::atomic<AllocationCounter> allocationCounter{nullptr};
+
+#ifdef NEXUS_JSON_INSTRUMENTATION
+thread_local BuildStatsRecorder::AddScope *currentAddScope = nullptr;
+thread_local BuildStatsRecorder::SerialiseScope *currentSerialisation =
+    nullptr;
+
+uint64_t allocationCount() {
+  const auto counter = allocationCounter.load(std::memory_order_relaxed);
+  return counter == nullptr ? 0 : counter();
+}
+
+uint64_t nanosecondsSince(const std::chrono::steady_clock::time_point start,
+                          const std::chrono::steady_clock::time_point end) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count());
+}
+
+bool startsWith(const StringRef name, const char *prefix) {
+  const auto length = std::strlen(prefix);
+  return name.size() >= length && std::memcmp(name.data(), prefix, length) == 0;
+}
+
+bool sectionOfNode(const StringRef name, BuildSection &section) {
+  if (startsWith(name, "monitor_")) {
+    section = BuildSection::MONITORS;
+    return true;
+  }
+  if (startsWith(name, "detector_")) {
+    section = BuildSection::DETECTORS;
+    return true;
+  }
+  for (const auto candidate :
+       {BuildSection::INSTRUMENT, BuildSection::SELOG, BuildSection::PERIODS,
+        BuildSection::ISIS_VMS_COMPAT, BuildSection::RUNLOG,
+        BuildSection::FRAMELOG}) {
+    if (name == sectionNames[static_cast<size_t>(candidate)]) {
+      section = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+}
+
+const char *buildSectionName(const BuildSection section) {
+  return sectionNames[static_cast<size_t>(section)];
+}
+
+nlohmann::json BuildStats::toJson() const {
+  auto sectionsJson = nlohmann::json::object();
+  for (size_t i = 0; i < numberOfBuildSections; i++) {
+    const auto &section = sections[i];
+    sectionsJson[sectionNames[i]] = {
+        {"nodes", section.nodes},
+        {"add_calls", section.addCalls},
+        {"add_ns", section.addNanoseconds},
+        {"add_allocations", section.addAllocations},
+        {"serialised_bytes", section.serialisedBytes},
+        {"serialise_ns", section.serialiseNanoseconds},
+        {"serialise_allocations", section.serialiseAllocations}};
+  }
+  return {{"enabled", buildStatsEnabled},
+          {"serialisations", serialisations},
+          {"sections", std::move(sectionsJson)}};
+}
+
+void setAllocationCounter(const AllocationCounter counter) {
+  allocationCounter.store(counter);
+}
+
+#ifdef NEXUS_JSON_INSTRUMENTATION
+
+BuildStatsRecorder::BuildStatsRecorder() : m_state(new State) {}
+
+BuildStats BuildStatsRecorder::stats() const {
+  std::lock_guard<std::mutex> lock(m_state->mutex);
+  return m_state->stats;
+}
+
+BuildStatsRecorder::AddScope::AddScope(BuildStatsRecorder &recorder,
+                                       const BuildSection section)
+    : m_section(section) {
+  if (currentAddScope != nullptr) {
+    return;
+  }
+  m_recorder = &recorder;
+  currentAddScope = this;
+  m_allocations = allocationCount();
+  m_start = std::chrono::steady_clock::now();
+}
+
+BuildStatsRecorder::AddScope::~AddScope() {
+  if (m_recorder == nullptr) {
+    return;
+  }
+  const auto end = std::chrono::steady_clock::now();
+  const auto allocations = allocationCount() - m_allocations;
+  currentAddScope = nullptr;
+  std::lock_guard<std::mutex> lock(m_recorder->m_state->mutex);
+  auto &section = m_recorder->m_state->stats[m_section];
+  section.nodes += m_nodes;
+  section.addCalls++;
+  section.addNanoseconds += nanosecondsSince(m_start, end);
+  section.addAllocations += allocations;
+}
+
+void BuildStatsRecorder::addNodes(const uint64_t nodes) {
+  if (currentAddScope != nullptr) {
+    currentAddScope->m_nodes += nodes;
+  }
+}
+
+BuildStatsRecorder::SerialiseScope::SerialiseScope(
+    const BuildStatsRecorder &recorder, const JsonWriter &writer)
+    : m_recorder(recorder), m_writer(writer),
+      m_since(std::chrono::steady_clock::now()),
+      m_bytesSince(writer.bytesWritten()),
+      m_allocationsSince(allocationCount()), m_previous(currentSerialisation) {
+  currentSerialisation = this;
+}
+
+BuildStatsRecorder::SerialiseScope::~SerialiseScope() {
+  charge();
+  currentSerialisation = m_previous;
+  std::lock_guard<std::mutex> lock(m_recorder.m_state->mutex);
+  auto &stats = m_recorder.m_state->stats;
+  stats.serialisations++;
+  for (size_t i = 0; i < numberOfBuildSections; i++) {
+    stats.sections[i].serialisedBytes += m_stats.sections[i].serialisedBytes;
+    stats.sections[i].serialiseNanoseconds +=
+        m_stats.sections[i].serialiseNanoseconds;
+    stats.sections[i].serialiseAllocations +=
+        m_stats.sections[i].serialiseAllocations;
+  }
+}
+
+void BuildStatsRecorder::SerialiseScope::charge() {
+  const auto now = std::chrono::steady_clock::now();
+  const auto bytes = m_writer.bytesWritten();
+  const auto allocations = allocationCount();
+  auto &section = m_stats[m_section];
+  section.serialiseNanoseconds += nanosecondsSince(m_since, now);
+  section.serialisedBytes += bytes - m_bytesSince;
+  section.serialiseAllocations += allocations - m_allocationsSince;
+  m_since = now;
+  m_bytesSince = bytes;
+  m_allocationsSince = allocations;
+}
+
+bool BuildStatsRecorder::serialising() {
+  return currentSerialisation != nullptr;
+}
+
+void BuildStatsRecorder::SectionScope::enter(const BuildSection section) {
+  auto *serialisation = currentSerialisation;
+  if (serialisation == nullptr || m_entered ||
+      serialisation->m_section == section) {
+    return;
+  }
+  serialisation->charge();
+  m_previous = serialisation->m_section;
+  serialisation->m_section = section;
+  m_entered = true;
+}
+
+void BuildStatsRecorder::SectionScope::enterNode(const StringRef name) {
+  auto *serialisation = currentSerialisation;
+  auto section = BuildSection::ENTRY;
+  if (serialisation != nullptr &&
+      (serialisation->m_section == BuildSection::ENTRY ||
+       serialisation->m_section == BuildSection::INSTRUMENT) &&
+      sectionOfNode(name, section)) {
+    enter(section);
+  }
+}
+
+BuildStatsRecorder::SectionScope::~SectionScope() {
+  if (m_entered) {
+    currentSerialisation->charge();
+    currentSerialisation->m_section = m_previous;
+  }
+}
+
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "JsonWriter.h"
+#include "StringRef.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+
+// Cost of building and serialising a start message, broken down by the
+// top-level sections of the file structure. Only recorded when the library is
+// compiled with NEXUS_JSON_INSTRUMENTATION defined, which is the CMake option
+// of the same name; otherwise every count is zero and the recording compiles
+// away.
+
+#ifdef NEXUS_JSON_INSTRUMENTATION
+const bool buildStatsEnabled = true;
+#else
+const bool buildStatsEnabled = false;
+#endif
+
+enum class BuildSection {
+  ENTRY,
+  INSTRUMENT,
+  MONITORS,
+  DETECTORS,
+  SELOG,
+  PERIODS,
+  ISIS_VMS_COMPAT,
+  RUNLOG,
+  FRAMELOG
+};
+
+const size_t numberOfBuildSections = 9;
+
+const char *buildSectionName(BuildSection section);
+
+struct SectionStats {
+  // Groups, datasets and streams added by add* calls
+  uint64_t nodes = 0;
+  uint64_t addCalls = 0;
+  uint64_t addNanoseconds = 0;
+  uint64_t addAllocations = 0;
+  // Summed over every start message serialised
+  uint64_t serialisedBytes = 0;
+  uint64_t serialiseNanoseconds = 0;
+  uint64_t serialiseAllocations = 0;
+};
+
+struct BuildStats {
+  // Start messages serialised, including the envelope around the entry,
+  // which is counted as part of the entry section
+  uint64_t serialisations = 0;
+  std::array<SectionStats, numberOfBuildSections> sections;
+
+  const SectionStats &operator[](BuildSection section) const {
+    return sections[static_cast<size_t>(section)];
+  }
+  SectionStats &operator[](BuildSection section) {
+    return sections[static_cast<size_t>(section)];
+  }
+
+  // An object with a member per section, named as by buildSectionName
+  nlohmann::json toJson() const;
+};
+
+// Allocations are only counted once the application provides a count of heap
+// allocations, for example from a replacement operator new. The count is
+// sampled before and after each measurement, so allocations made by other
+// threads at the same time are included.
+using AllocationCounter = uint64_t (*)();
+void setAllocationCounter(AllocationCounter counter);
+
+#ifdef NEXUS_JSON_INSTRUMENTATION
+
+// Held by each NexusWriteCommandBuilder. add* calls are recorded from the
+// builder's own thread, serialisations from any thread.
+class BuildStatsRecorder {
+public:
+  BuildStatsRecorder();
+
+  BuildStats stats() const;
+
+  // Records an add* call in the section. Scopes opened inside another, as when
+  // one add* method calls another, are part of the outer call.
+  class AddScope {
+  public:
+    AddScope(BuildStatsRecorder &recorder, BuildSection section);
+    ~AddScope();
+
+    AddScope(const AddScope &) = delete;
+    AddScope &operator=(const AddScope &) = delete;
+
+  private:
+    BuildStatsRecorder *m_recorder = nullptr;
+    BuildSection m_section;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_allocations = 0;
+    uint64_t m_nodes = 0;
+
+    friend class BuildStatsRecorder;
+  };
+
+  // Count nodes added within the innermost AddScope on this thread
+  static void addNodes(uint64_t nodes);
+
+  // Records the start message written by writer while in scope. Its cost is
+  // charged to the entry section unless a SectionScope says otherwise.
+  class SerialiseScope {
+  public:
+    SerialiseScope(const BuildStatsRecorder &recorder,
+                   const JsonWriter &writer);
+    ~SerialiseScope();
+
+    SerialiseScope(const SerialiseScope &) = delete;
+    SerialiseScope &operator=(const SerialiseScope &) = delete;
+
+  private:
+    // Charge everything since the last call to the current section
+    void charge();
+
+    const BuildStatsRecorder &m_recorder;
+    const JsonWriter &m_writer;
+    BuildSection m_section = BuildSection::ENTRY;
+    std::chrono::steady_clock::time_point m_since;
+    uint64_t m_bytesSince;
+    uint64_t m_allocationsSince;
+    BuildStats m_stats;
+    SerialiseScope *m_previous;
+
+    friend class BuildStatsRecorder;
+  };
+
+  // True while a SerialiseScope is open on this thread
+  static bool serialising();
+
+  // Charges serialisation on this thread to a section until the scope ends
+  class SectionScope {
+  public:
+    SectionScope() = default;
+    ~SectionScope();
+
+    SectionScope(const SectionScope &) = delete;
+    SectionScope &operator=(const SectionScope &) = delete;
+
+    // Do nothing outside a SerialiseScope. enterNode enters the section of a
+    // child of the entry or instrument group by its name, for example
+    // monitor_1 is part of the monitors, and otherwise does nothing.
+    void enter(BuildSection section);
+    void enterNode(StringRef name);
+
+  private:
+    BuildSection m_previous = BuildSection::ENTRY;
+    bool m_entered = false;
+  };
+
+private:
+  struct State {
+    mutable std::mutex mutex;
+    BuildStats stats;
+  };
+  // On the heap so that the builder stays movable
+  std::unique_ptr<State> m_state;
+};
+
+#else
+
+class BuildStatsRecorder {
+public:
+  BuildStats stats() const { return {}; }
+
+  class AddScope {
+  public:
+    AddScope(BuildStatsRecorder &, BuildSection) {}
+  };
+  static void addNodes(uint64_t) {}
+
+  class SerialiseScope {
+  public:
+    SerialiseScope(const BuildStatsRecorder &, const JsonWriter &) {}
+  };
+  static bool serialising() { return false; }
+
+  class SectionScope {
+  public:
+    void enter(BuildSection) {}
+    void enterNode(StringRef) {}
+  };
+};
+
+#endif
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "MonotonicArena.h"
+#include <map>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+// Allocates from the arena of the innermost ArenaScope on the calling thread,
+// deallocation is a no-op. nlohmann::basic_json default constructs its
+// allocators, so the arena cannot be carried by the allocator itself.
+//
+// Nothing is freed until the arena is reset, so every buffer an array grows
+// out of stays allocated. Arrays of a known size are reserved up front with
+// reserveArray. The rest, such as the children of the entry, grow
+// geometrically and leave at most as much again as their final size behind,
+// which is reclaimed with the arena and costs less than tracking frees.
+template <typename T> class ArenaAllocator {
+public:
+  using value_type = T;
+
+  ArenaAllocator() = default;
+  template <typename U> ArenaAllocator(const ArenaAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(
+        MonotonicArena::current().allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+  return false;
+}
+
+using ArenaString =
+    std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+// Converts std::string, which is not directly convertible to ArenaString
+template <typename T, typename SFINAE = void>
+struct BuilderJsonSerializer : nlohmann::adl_serializer<T, SFINAE> {};
+
+template <> struct BuilderJsonSerializer<std::string, void> {
+  template <typename BasicJsonType>
+  static void to_json(BasicJsonType &j, const std::string &value) {
+    j = typename BasicJsonType::string_t(value.data(), value.size());
+  }
+
+  template <typename BasicJsonType>
+  static void from_json(const BasicJsonType &j, std::string &value) {
+    const auto &str =
+        j.template get_ref<const typename BasicJsonType::string_t &>();
+    value.assign(str.data(), str.size());
+  }
+};
+
+// The builder's document. Every node, key and value is allocated from the
+// builder's arena, so it must only be modified inside an ArenaScope for that
+// arena and must not outlive it.
+using BuilderJson =
+    nlohmann::basic_json<std::map, std::vector, ArenaString, bool, int64_t,
+                         uint64_t, double, ArenaAllocator,
+                         BuilderJsonSerializer>;
+
+// Sizes a JSON array's storage for a known number of elements, so that it is
+// allocated once rather than regrown
+template <typename Json> void reserveArray(Json &array, size_t size) {
+  array.template get_ptr<typename Json::array_t *>()->reserve(size);
+}
+
+// Deep copy between JSON types with different storage, for example from the
+// builder's document to nlohmann::json
+template <typename To, typename From> To convertJson(const From &from) {
+  using value_t = nlohmann::json::value_t;
+  switch (from.type()) {
+  case value_t::object: {
+    auto object = To::object();
+    for (auto it = from.cbegin(); it != from.cend(); ++it) {
+      const auto &key = it.key();
+      object[typename To::string_t(key.data(), key.size())] =
+          convertJson<To>(it.value());
+    }
+    return object;
+  }
+  case value_t::array: {
+    auto array = To::array();
+    reserveArray(array, from.size());
+    for (const auto &element : from) {
+      array.push_back(convertJson<To>(element));
+    }
+    return array;
+  }
+  case value_t::string: {
+    const auto &str =
+        from.template get_ref<const typename From::string_t &>();
+    return To(typename To::string_t(str.data(), str.size()));
+  }
+  case value_t::boolean:
+    return To(from.template get<bool>());
+  case value_t::number_integer:
+    return To(from.template get<int64_t>());
+  case value_t::number_unsigned:
+    return To(from.template get<uint64_t>());
+  case value_t::number_float:
+    return To(from.template get<double>());
+  default:
+    return To();
+  }
+}
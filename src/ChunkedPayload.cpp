@@ -0,0 +1,176 @@
+#include "ChunkedPayload.h"
+#include "NexusWriteCommandBuilder.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char chunkMagic[] = {'N', 'X', 'C', 'K'};
+const uint8_t lastChunkFlag = 1;
+const uint8_t compressedChunkFlag = 2;
+
+uint64_t readLittleEndian(const char *data, const size_t size) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; i++) {
+    value |= uint64_t(static_cast<unsigned char>(data[i])) << (8 * i);
+  }
+  return value;
+}
+
+void writeLittleEndian(char *data, const uint64_t value, const size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    data[i] = char((value >> (8 * i)) & 0xFFu);
+  }
+}
+}
+
+ChunkHeader readChunkHeader(const char *chunk, const size_t size) {
+  if (size < chunkHeaderSize ||
+      std::memcmp(chunk, chunkMagic, sizeof(chunkMagic)) != 0) {
+    throw std::runtime_error("Not a message chunk");
+  }
+  const auto flags = static_cast<uint8_t>(chunk[4]);
+  if ((flags & ~(lastChunkFlag | compressedChunkFlag)) != 0) {
+    throw std::runtime_error("Message chunk has unknown flags");
+  }
+  ChunkHeader header;
+  header.last = (flags & lastChunkFlag) != 0;
+  header.compressed = (flags & compressedChunkFlag) != 0;
+  header.sequence = static_cast<uint32_t>(readLittleEndian(chunk + 8, 4));
+  header.messageID = readLittleEndian(chunk + 12, 8);
+  return header;
+}
+
+ChunkSink::ChunkSink(const uint64_t messageID, const size_t maxChunkSize,
+                     const bool compressed, CallbackSink::Callback callback)
+    : m_messageID(messageID), m_maxChunkSize(maxChunkSize),
+      m_compressed(compressed), m_callback(std::move(callback)) {
+  if (maxChunkSize <= chunkHeaderSize) {
+    throw std::runtime_error("Maximum chunk size must be larger than " +
+                             std::to_string(chunkHeaderSize) + " bytes");
+  }
+  m_chunk.reserve(maxChunkSize);
+  m_chunk.assign(chunkHeaderSize, '\0');
+}
+
+void ChunkSink::write(const char *data, size_t size) {
+  if (m_finished) {
+    throw std::runtime_error("Chunks written to after they were finished");
+  }
+  while (size > 0) {
+    // A full chunk is only passed on once there is more to follow it, so
+    // that the last one can be marked
+    if (m_chunk.size() == m_maxChunkSize) {
+      passOn(false);
+    }
+    const auto take = std::min(size, m_maxChunkSize - m_chunk.size());
+    m_chunk.append(data, take);
+    data += take;
+    size -= take;
+  }
+}
+
+void ChunkSink::finish() {
+  if (!m_finished) {
+    passOn(true);
+    m_finished = true;
+  }
+}
+
+void ChunkSink::passOn(const bool last) {
+  std::memcpy(&m_chunk[0], chunkMagic, sizeof(chunkMagic));
+  m_chunk[4] = char((last ? lastChunkFlag : 0) |
+                    (m_compressed ? compressedChunkFlag : 0));
+  writeLittleEndian(&m_chunk[8], m_sequence, 4);
+  writeLittleEndian(&m_chunk[12], m_messageID, 8);
+  m_callback(m_chunk.data(), m_chunk.size());
+  m_sequence++;
+  m_chunk.resize(chunkHeaderSize);
+}
+
+uint32_t writeStartMessageChunks(const NexusWriteCommandBuilder &builder,
+                                 const uint64_t messageID,
+                                 const size_t maxChunkSize,
+                                 CallbackSink::Callback callback,
+                                 const bool compress, const int indent) {
+  ChunkSink chunks(messageID, maxChunkSize, compress, std::move(callback));
+  if (compress) {
+    Lz4FrameSink frame(chunks);
+    builder.writeStartMessage(frame, indent);
+    frame.finish();
+  } else {
+    builder.writeStartMessage(chunks, indent);
+  }
+  chunks.finish();
+  return chunks.numberOfChunks();
+}
+
+bool ChunkReassembler::add(const char *chunk, const size_t size,
+                           uint64_t &messageID, std::string &message) {
+  const auto header = readChunkHeader(chunk, size);
+  const auto inserted = m_pending.emplace(header.messageID, PendingMessage());
+  auto &pending = inserted.first->second;
+  try {
+    if (inserted.second) {
+      pending.compressed = header.compressed;
+    } else if (pending.compressed != header.compressed) {
+      throw std::runtime_error("Chunks of message " +
+                               std::to_string(header.messageID) +
+                               " disagree about compression");
+    }
+    if (header.sequence < pending.nextSequence ||
+        pending.early.count(header.sequence) != 0) {
+      throw std::runtime_error("Repeated chunk " +
+                               std::to_string(header.sequence) +
+                               " of message " +
+                               std::to_string(header.messageID));
+    }
+    const char *payload = chunk + chunkHeaderSize;
+    const auto payloadSize = size - chunkHeaderSize;
+    if (header.sequence > pending.nextSequence) {
+      pending.early.emplace(
+          header.sequence,
+          EarlyChunk{header.last, std::string(payload, payloadSize)});
+      return false;
+    }
+    consume(pending, header.last, payload, payloadSize);
+    auto next = pending.early.begin();
+    while (!pending.complete && next != pending.early.end() &&
+           next->first == pending.nextSequence) {
+      consume(pending, next->second.last, next->second.payload.data(),
+              next->second.payload.size());
+      next = pending.early.erase(next);
+    }
+    if (pending.complete && !pending.early.empty()) {
+      throw std::runtime_error("Message " + std::to_string(header.messageID) +
+                               " has chunks after its last");
+    }
+  } catch (...) {
+    m_pending.erase(inserted.first);
+    throw;
+  }
+  if (!pending.complete) {
+    return false;
+  }
+  messageID = header.messageID;
+  message = std::move(pending.message);
+  m_pending.erase(inserted.first);
+  return true;
+}
+
+void ChunkReassembler::consume(PendingMessage &pending, const bool last,
+                               const char *payload, const size_t size) {
+  if (pending.compressed) {
+    pending.decoder.decode(payload, size, pending.message);
+  } else {
+    pending.message.append(payload, size);
+  }
+  pending.nextSequence++;
+  if (last) {
+    if (pending.compressed && !pending.decoder.finished()) {
+      throw std::runtime_error("Compressed message ends part way through");
+    }
+    pending.complete = true;
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "JsonWriter.h"
+#include "Lz4Frame.h"
+#include "OutputSink.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+class NexusWriteCommandBuilder;
+
+// Command messages split into numbered chunks, for start messages which are
+// larger than the broker's maximum message size. Each chunk is a small
+// envelope followed by the next part of the payload:
+//
+//   bytes 0-3    "NXCK"
+//   byte 4       flags, 1 for the last chunk of a message and 2 if the
+//                payload is an LZ4 frame (see Lz4Frame.h)
+//   bytes 5-7    zero
+//   bytes 8-11   sequence number of the chunk within its message, from 0
+//   bytes 12-19  ID of the message, chosen by the sender
+//
+// Numbers are little endian.
+
+const size_t chunkHeaderSize = 20;
+
+struct ChunkHeader {
+  uint64_t messageID = 0;
+  uint32_t sequence = 0;
+  bool last = false;
+  bool compressed = false;
+};
+
+// Throws std::runtime_error if the chunk does not start with a valid header
+ChunkHeader readChunkHeader(const char *chunk, size_t size);
+
+// Splits everything written to it into chunks of at most maxChunkSize bytes,
+// including the header, which are handed to the callback as they fill up.
+// finish() must be called once the payload is complete to pass on the last
+// chunk.
+class ChunkSink : public OutputSink {
+public:
+  ChunkSink(uint64_t messageID, size_t maxChunkSize, bool compressed,
+            CallbackSink::Callback callback);
+
+  void write(const char *data, size_t size) override;
+  void finish();
+
+  uint32_t numberOfChunks() const { return m_sequence; }
+
+private:
+  void passOn(bool last);
+
+  const uint64_t m_messageID;
+  const size_t m_maxChunkSize;
+  const bool m_compressed;
+  CallbackSink::Callback m_callback;
+  std::string m_chunk;
+  uint32_t m_sequence = 0;
+  bool m_finished = false;
+};
+
+// Serialise the start message straight into chunks, compressed on the way
+// unless compress is false, so only a block of the message and one chunk are
+// held at a time. Returns the number of chunks.
+uint32_t writeStartMessageChunks(const NexusWriteCommandBuilder &builder,
+                                 uint64_t messageID, size_t maxChunkSize,
+                                 CallbackSink::Callback callback,
+                                 bool compress = true,
+                                 int indent = JsonWriter::COMPACT);
+
+// Puts messages back together from their chunks, which may arrive in any
+// order and interleaved with the chunks of other messages. Chunks which
+// arrive in order are decompressed straight away, others are held until the
+// chunks before them arrive.
+class ChunkReassembler {
+public:
+  // Returns true if the chunk completes its message, which is then moved
+  // into messageID and message. Throws std::runtime_error for a malformed or
+  // repeated chunk, the message it belongs to is then dropped.
+  bool add(const char *chunk, size_t size, uint64_t &messageID,
+           std::string &message);
+
+  // Messages which are still missing chunks
+  size_t numberOfPendingMessages() const { return m_pending.size(); }
+  void discard(uint64_t messageID) { m_pending.erase(messageID); }
+
+private:
+  struct EarlyChunk {
+    bool last;
+    std::string payload;
+  };
+
+  struct PendingMessage {
+    bool compressed = false;
+    uint32_t nextSequence = 0;
+    bool complete = false;
+    // Chunks after nextSequence, by sequence number
+    std::map<uint32_t, EarlyChunk> early;
+    Lz4FrameDecoder decoder;
+    std::string message;
+  };
+
+  void consume(PendingMessage &pending, bool last, const char *payload,
+               size_t size);
+
+  std::unordered_map<uint64_t, PendingMessage> m_pending;
+};
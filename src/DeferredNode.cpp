@@ -0,0 +1,67 @@
+#include "DeferredNode.h"
+
+namespace {
+
+// The keys of every stream node, escaped once for the whole process
+struct StreamKeys {
+  StringPool pool;
+  const InternedString nexusPath = pool.intern("nexus_path");
+  const InternedString source = pool.intern("source");
+  const InternedString stream = pool.intern("stream");
+  const InternedString topic = pool.intern("topic");
+  const InternedString type = pool.intern("type");
+  const InternedString writerModule = pool.intern("writer_module");
+};
+
+const StreamKeys &streamKeys() {
+  static const StreamKeys keys;
+  return keys;
+}
+}
+
+PreSerialisedNode::PreSerialisedNode(nlohmann::json node)
+    : m_node(std::move(node)) {
+  JsonWriter writer(m_compactJson, JsonWriter::COMPACT);
+  writer.value(m_node);
+}
+
+void PreSerialisedNode::write(JsonWriter &writer) const {
+  writer.rawValue(m_compactJson.data(), m_compactJson.size());
+}
+
+nlohmann::json PreSerialisedNode::toJson() const { return m_node; }
+
+StreamNode::StreamNode(const InternedString module,
+                       const InternedString nexusPath,
+                       const InternedString source, const InternedString topic)
+    : m_module(module), m_nexusPath(nexusPath), m_source(source),
+      m_topic(topic) {}
+
+void StreamNode::write(JsonWriter &writer) const {
+  // Keys in sorted order, as nlohmann::json stores them
+  const auto &keys = streamKeys();
+  writer.startObject();
+  writer.key(keys.stream);
+  writer.startObject();
+  writer.key(keys.nexusPath);
+  writer.value(m_nexusPath);
+  writer.key(keys.source);
+  writer.value(m_source);
+  writer.key(keys.topic);
+  writer.value(m_topic);
+  writer.key(keys.writerModule);
+  writer.value(m_module);
+  writer.endObject();
+  writer.key(keys.type);
+  writer.value(keys.stream);
+  writer.endObject();
+}
+
+nlohmann::json StreamNode::toJson() const {
+  nlohmann::json stream = {{"type", "stream"}};
+  stream["stream"] = {{"writer_module", m_module.str().str()},
+                      {"nexus_path", m_nexusPath.str().str()},
+                      {"source", m_source.str().str()},
+                      {"topic", m_topic.str().str()}};
+  return stream;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "JsonWriter.h"
+#include <nlohmann/json.hpp>
+#include <string>
+
+// A child node which the builder holds in some form other than
+// nlohmann::json, it is only expanded when a message is serialised
+class DeferredNode {
+public:
+  virtual ~DeferredNode() = default;
+
+  // Stream the node, must produce the same bytes as writing toJson()
+  virtual void write(JsonWriter &writer) const = 0;
+  virtual nlohmann::json toJson() const = 0;
+  // A node with nothing in it is left out of the message
+  virtual bool empty() const { return false; }
+  // A node which stands for several consecutive siblings, such as a range of
+  // monitor groups, writes each of them and returns them as an array
+  virtual bool isSiblingRange() const { return false; }
+};
+
+// A node which is serialised once, in compact form, and then copied into
+// every message it is part of
+class PreSerialisedNode : public DeferredNode {
+public:
+  explicit PreSerialisedNode(nlohmann::json node);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+
+  const nlohmann::json &node() const { return m_node; }
+
+private:
+  const nlohmann::json m_node;
+  std::string m_compactJson;
+};
+
+// A stream for the file writer, such as an ev42 event data source or an f142
+// log, whose strings are held by the builder's StringPool. Only valid for the
+// lifetime of the pool.
+class StreamNode : public DeferredNode {
+public:
+  StreamNode(InternedString module, InternedString nexusPath,
+             InternedString source, InternedString topic);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+
+private:
+  const InternedString m_module;
+  const InternedString m_nexusPath;
+  const InternedString m_source;
+  const InternedString m_topic;
+};
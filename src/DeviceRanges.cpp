@@ -0,0 +1,231 @@
+#include "DeviceRanges.h"
+#include "NexusTypes.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+
+// Values are expanded into a block of this many at a time
+const size_t expansionBlockSize = 4096;
+
+bool fitsInt32(const int64_t value) {
+  return value >= std::numeric_limits<int32_t>::min() &&
+         value <= std::numeric_limits<int32_t>::max();
+}
+
+// Keys in sorted order, matching createDataset() in the builder
+void startInt32Dataset(JsonWriter &writer, const char *name) {
+  writer.startObject();
+  writer.key("dataset");
+  writer.startObject();
+  writer.key("size");
+  writer.startArray();
+  writer.value("unlimited");
+  writer.endArray();
+  writer.key("type");
+  writer.value(nexusTypeName<int32_t>());
+  writer.endObject();
+  writer.key("name");
+  writer.value(name);
+  writer.key("type");
+  writer.value("dataset");
+  writer.key("values");
+}
+
+void writeInt32Dataset(JsonWriter &writer, const char *name,
+                       const int32_t value) {
+  startInt32Dataset(writer, name);
+  writer.value(value);
+  writer.endObject();
+}
+
+nlohmann::json int32DatasetToJson(const char *name, nlohmann::json values) {
+  return {{"name", name},
+          {"type", "dataset"},
+          {"values", std::move(values)},
+          {"dataset",
+           {{"type", nexusTypeName<int32_t>()}, {"size", {"unlimited"}}}}};
+}
+
+int32_t spectrumIndex(const MonitorRange &range, const uint32_t i) {
+  return static_cast<int32_t>(range.firstSpectrumIndex +
+                              static_cast<uint32_t>(range.spectrumIndexStep) *
+                                  i);
+}
+
+// The first value of the run and its step, for the column
+std::pair<int32_t, int32_t> runColumn(const SpectrumMap::Run &run,
+                                      const SpectrumMapNode::Column column) {
+  if (column == SpectrumMapNode::Column::DETECTOR_NUMBER) {
+    return {run.firstDetectorNumber, run.detectorNumberStep};
+  }
+  return {run.firstSpectrumIndex, run.spectrumIndexStep};
+}
+
+const char *columnName(const SpectrumMapNode::Column column) {
+  return column == SpectrumMapNode::Column::DETECTOR_NUMBER
+             ? "detector_number"
+             : "spectrum_index";
+}
+}
+
+MonitorRangeNode::MonitorRangeNode(const MonitorRange range)
+    : m_range(range) {}
+
+void MonitorRangeNode::write(JsonWriter &writer) const {
+  // Keys in sorted order, matching addMonitor() in the builder
+  std::string name = "monitor_";
+  const auto prefixLength = name.size();
+  for (uint32_t i = 0; i < m_range.count; i++) {
+    const auto monitorNumber = m_range.firstMonitorNumber + i;
+    name.resize(prefixLength);
+    name += std::to_string(monitorNumber);
+    writer.startObject();
+    writer.key("attributes");
+    writer.startArray();
+    writer.startObject();
+    writer.key("name");
+    writer.value("NX_class");
+    writer.key("values");
+    writer.value("NXmonitor");
+    writer.endObject();
+    writer.endArray();
+    writer.key("children");
+    writer.startArray();
+    writeInt32Dataset(writer, "monitor_number",
+                      static_cast<int32_t>(monitorNumber));
+    writeInt32Dataset(writer, "spectrum_index", spectrumIndex(m_range, i));
+    writer.startObject();
+    writer.key("children");
+    writer.startArray();
+    writer.endArray();
+    writer.key("name");
+    writer.value("period_index");
+    writer.key("type");
+    writer.value("group");
+    writer.endObject();
+    writer.endArray();
+    writer.key("name");
+    writer.value(name);
+    writer.key("type");
+    writer.value("group");
+    writer.endObject();
+  }
+}
+
+nlohmann::json MonitorRangeNode::toJson() const {
+  auto monitors = nlohmann::json::array();
+  for (uint32_t i = 0; i < m_range.count; i++) {
+    const auto monitorNumber = m_range.firstMonitorNumber + i;
+    nlohmann::json monitor = {
+        {"name", "monitor_" + std::to_string(monitorNumber)},
+        {"type", "group"}};
+    monitor["attributes"] = nlohmann::json::array(
+        {{{"name", "NX_class"}, {"values", "NXmonitor"}}});
+    monitor["children"] = {
+        int32DatasetToJson("monitor_number",
+                           static_cast<int32_t>(monitorNumber)),
+        int32DatasetToJson("spectrum_index", spectrumIndex(m_range, i)),
+        {{"name", "period_index"},
+         {"type", "group"},
+         {"children", nlohmann::json::array()}}};
+    monitors.push_back(std::move(monitor));
+  }
+  return monitors;
+}
+
+void SpectrumMap::addRange(const int32_t firstDetectorNumber,
+                           const int32_t firstSpectrumIndex,
+                           const size_t count,
+                           const int32_t detectorNumberStep,
+                           const int32_t spectrumIndexStep) {
+  if (count == 0) {
+    return;
+  }
+  const auto last = static_cast<int64_t>(count - 1);
+  if (!fitsInt32(firstDetectorNumber + detectorNumberStep * last) ||
+      !fitsInt32(firstSpectrumIndex + spectrumIndexStep * last)) {
+    throw std::runtime_error("Spectrum map range starting at detector " +
+                             std::to_string(firstDetectorNumber) +
+                             " goes beyond the range of int32");
+  }
+  m_runs.push_back({firstDetectorNumber, firstSpectrumIndex,
+                    detectorNumberStep, spectrumIndexStep, count});
+  m_size += count;
+}
+
+void SpectrumMap::add(const int32_t *detectorNumbers,
+                      const int32_t *spectrumIndices, const size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    add(detectorNumbers[i], spectrumIndices[i]);
+  }
+}
+
+void SpectrumMap::add(const int32_t detectorNumber,
+                      const int32_t spectrumIndex) {
+  m_size++;
+  if (!m_runs.empty()) {
+    auto &run = m_runs.back();
+    const auto count = static_cast<int64_t>(run.count);
+    const int64_t detectorNumberStep =
+        int64_t(detectorNumber) - run.firstDetectorNumber;
+    const int64_t spectrumIndexStep =
+        int64_t(spectrumIndex) - run.firstSpectrumIndex;
+    // Any two entries make a run, which fixes its steps
+    if (run.count == 1 && fitsInt32(detectorNumberStep) &&
+        fitsInt32(spectrumIndexStep)) {
+      run.detectorNumberStep = static_cast<int32_t>(detectorNumberStep);
+      run.spectrumIndexStep = static_cast<int32_t>(spectrumIndexStep);
+      run.count++;
+      return;
+    }
+    if (detectorNumberStep == run.detectorNumberStep * count &&
+        spectrumIndexStep == run.spectrumIndexStep * count) {
+      run.count++;
+      return;
+    }
+  }
+  m_runs.push_back({detectorNumber, spectrumIndex, 1, 1, 1});
+}
+
+SpectrumMapNode::SpectrumMapNode(std::shared_ptr<const SpectrumMap> map,
+                                 const Column column)
+    : m_map(std::move(map)), m_column(column) {}
+
+void SpectrumMapNode::write(JsonWriter &writer) const {
+  startInt32Dataset(writer, columnName(m_column));
+  writer.startArray();
+  int32_t block[expansionBlockSize];
+  for (const auto &run : m_map->runs()) {
+    const auto column = runColumn(run, m_column);
+    // Unsigned arithmetic, the range was checked to fit in an int32
+    auto value = static_cast<uint32_t>(column.first);
+    const auto step = static_cast<uint32_t>(column.second);
+    for (size_t start = 0; start < run.count; start += expansionBlockSize) {
+      const auto size = std::min(expansionBlockSize, run.count - start);
+      for (size_t i = 0; i < size; i++) {
+        block[i] = static_cast<int32_t>(value);
+        value += step;
+      }
+      writer.elements(block, size);
+    }
+  }
+  writer.endArray();
+  writer.endObject();
+}
+
+nlohmann::json SpectrumMapNode::toJson() const {
+  std::vector<int32_t> values;
+  values.reserve(m_map->size());
+  for (const auto &run : m_map->runs()) {
+    const auto column = runColumn(run, m_column);
+    for (size_t i = 0; i < run.count; i++) {
+      values.push_back(static_cast<int32_t>(
+          column.first + int64_t(column.second) * static_cast<int64_t>(i)));
+    }
+  }
+  return int32DatasetToJson(columnName(m_column), std::move(values));
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "DeferredNode.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Monitors and detector pixels added in bulk. They are held as ranges in
+// which the numbers go up by a constant step and only expanded into groups
+// and arrays when a message is serialised, so that memory and build time
+// depend on the number of ranges rather than the number of pixels.
+
+// Monitors firstMonitorNumber, firstMonitorNumber + 1, ... with spectrum
+// indices going up by spectrumIndexStep from firstSpectrumIndex
+struct MonitorRange {
+  uint32_t firstMonitorNumber;
+  uint32_t count;
+  uint32_t firstSpectrumIndex;
+  int32_t spectrumIndexStep;
+};
+
+// A monitor_<n> NXmonitor group per monitor in the range, the same groups as
+// NexusWriteCommandBuilder::addMonitor adds one at a time
+class MonitorRangeNode : public DeferredNode {
+public:
+  explicit MonitorRangeNode(MonitorRange range);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+  bool empty() const override { return m_range.count == 0; }
+  bool isSiblingRange() const override { return true; }
+
+  const MonitorRange &range() const { return m_range; }
+
+private:
+  const MonitorRange m_range;
+};
+
+// The detector numbers of a detector bank and the spectrum each is mapped to,
+// compressed into runs in which both go up by a constant step
+class SpectrumMap {
+public:
+  struct Run {
+    int32_t firstDetectorNumber;
+    int32_t firstSpectrumIndex;
+    int32_t detectorNumberStep;
+    int32_t spectrumIndexStep;
+    size_t count;
+  };
+
+  // Throws std::runtime_error if a number in the range does not fit in an
+  // int32
+  void addRange(int32_t firstDetectorNumber, int32_t firstSpectrumIndex,
+                size_t count, int32_t detectorNumberStep = 1,
+                int32_t spectrumIndexStep = 1);
+  // Arrays of count detector numbers and the spectra they are mapped to,
+  // which are joined onto the last run while they continue it
+  void add(const int32_t *detectorNumbers, const int32_t *spectrumIndices,
+           size_t count);
+  void add(int32_t detectorNumber, int32_t spectrumIndex);
+
+  const std::vector<Run> &runs() const { return m_runs; }
+  // Number of detectors
+  size_t size() const { return m_size; }
+
+private:
+  std::vector<Run> m_runs;
+  size_t m_size = 0;
+};
+
+// The detector_number or spectrum_index dataset of a detector bank
+class SpectrumMapNode : public DeferredNode {
+public:
+  enum class Column { DETECTOR_NUMBER, SPECTRUM_INDEX };
+
+  SpectrumMapNode(std::shared_ptr<const SpectrumMap> map, Column column);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+
+private:
+  const std::shared_ptr<const SpectrumMap> m_map;
+  const Column m_column;
+};
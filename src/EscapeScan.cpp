@@ -0,0 +1,186 @@
+#include "EscapeScan.h"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NEXUS_ESCAPE_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is compiled for a function at a time and only used after checking the
+// processor, so the library does not need to be built for AVX2
+#if defined(NEXUS_ESCAPE_SSE2) && defined(__GNUC__) &&                         \
+    (defined(__x86_64__) || defined(__i386__))
+#define NEXUS_ESCAPE_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using Scan = size_t (*)(const unsigned char *, size_t, size_t);
+
+bool isSpecial(const unsigned char byte) {
+  return byte < 0x20 || byte >= 0x80 || byte == '"' || byte == '\\';
+}
+
+size_t firstSetBit(uint32_t mask) {
+#if defined(__GNUC__)
+  return static_cast<size_t>(__builtin_ctz(mask));
+#else
+  size_t bit = 0;
+  for (; (mask & 1u) == 0; mask >>= 1u) {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+// Eight bytes at a time, finding whether any byte in a word is special with
+// the usual bit tricks for a byte below a value or equal to zero, then which
+// one byte by byte
+size_t scanScalar(const unsigned char *bytes, size_t index,
+                  const size_t length) {
+  const uint64_t ones = 0x0101010101010101;
+  const uint64_t highBits = ones << 7u;
+  for (uint64_t word; index + sizeof(word) <= length; index += sizeof(word)) {
+    std::memcpy(&word, bytes + index, sizeof(word));
+    const auto quotes = word ^ (ones * '"');
+    const auto backslashes = word ^ (ones * '\\');
+    const auto special =
+        (word | ((word - ones * 0x20) & ~word) | ((quotes - ones) & ~quotes) |
+         ((backslashes - ones) & ~backslashes)) &
+        highBits;
+    if (special != 0) {
+      break;
+    }
+  }
+  while (index < length && !isSpecial(bytes[index])) {
+    index++;
+  }
+  return index;
+}
+
+#ifdef NEXUS_ESCAPE_SSE2
+size_t scanSse2(const unsigned char *bytes, size_t index,
+                const size_t length) {
+  const auto space = _mm_set1_epi8(0x20);
+  const auto quote = _mm_set1_epi8('"');
+  const auto backslash = _mm_set1_epi8('\\');
+  for (; index + 16 <= length; index += 16) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + index));
+    // The comparison is signed, so bytes from 0x80 up are below 0x20 too
+    const auto special = _mm_or_si128(
+        _mm_cmplt_epi8(chunk, space),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                     _mm_cmpeq_epi8(chunk, backslash)));
+    const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special));
+    if (mask != 0) {
+      return index + firstSetBit(mask);
+    }
+  }
+  return scanScalar(bytes, index, length);
+}
+#endif
+
+#ifdef NEXUS_ESCAPE_AVX2
+__attribute__((target("avx2"))) size_t
+scanAvx2(const unsigned char *bytes, size_t index, const size_t length) {
+  const auto space = _mm256_set1_epi8(0x20);
+  const auto quote = _mm256_set1_epi8('"');
+  const auto backslash = _mm256_set1_epi8('\\');
+  for (; index + 32 <= length; index += 32) {
+    const auto chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + index));
+    const auto special = _mm256_or_si256(
+        _mm256_cmpgt_epi8(space, chunk),
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                        _mm256_cmpeq_epi8(chunk, backslash)));
+    const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special));
+    if (mask != 0) {
+      return index + firstSetBit(mask);
+    }
+  }
+  // The compiler leaves this out before a tail call, and SSE2 code run with
+  // the upper halves dirty is slowed down by the transition
+  _mm256_zeroupper();
+  return scanSse2(bytes, index, length);
+}
+#endif
+
+Scan scanFor(const EscapeScanner scanner) {
+  switch (scanner) {
+#ifdef NEXUS_ESCAPE_AVX2
+  case EscapeScanner::AVX2:
+    return scanAvx2;
+#endif
+#ifdef NEXUS_ESCAPE_SSE2
+  case EscapeScanner::SSE2:
+    return scanSse2;
+#endif
+  case EscapeScanner::SCALAR:
+    return scanScalar;
+  default:
+    return nullptr;
+  }
+}
+
+EscapeScanner detectBestScanner() {
+#ifdef NEXUS_ESCAPE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return EscapeScanner::AVX2;
+  }
+#endif
+#ifdef NEXUS_ESCAPE_SSE2
+  return EscapeScanner::SSE2;
+#else
+  return EscapeScanner::SCALAR;
+#endif
+}
+
+}
+
+// Detected on first use rather than during dynamic initialisation, so that
+// strings escaped by other static initialisers never see an unset scanner
+EscapeScanner bestEscapeScanner() {
+  static const EscapeScanner scanner = detectBestScanner();
+  return scanner;
+}
+
+bool escapeScannerSupported(const EscapeScanner scanner) {
+  return scanFor(scanner) != nullptr &&
+         (scanner != EscapeScanner::AVX2 ||
+          bestEscapeScanner() == EscapeScanner::AVX2);
+}
+
+const char *escapeScannerName(const EscapeScanner scanner) {
+  switch (scanner) {
+  case EscapeScanner::SCALAR:
+    return "scalar";
+  case EscapeScanner::SSE2:
+    return "SSE2";
+  case EscapeScanner::AVX2:
+    return "AVX2";
+  }
+  return "unknown";
+}
+
+size_t findSpecialByte(const char *str, const size_t index,
+                       const size_t length) {
+  static const Scan scan = scanFor(bestEscapeScanner());
+  return scan(reinterpret_cast<const unsigned char *>(str), index, length);
+}
+
+size_t findSpecialByte(const EscapeScanner scanner, const char *str,
+                       const size_t index, const size_t length) {
+  if (!escapeScannerSupported(scanner)) {
+    throw std::runtime_error(std::string("The ") +
+                             escapeScannerName(scanner) +
+                             " escape scanner is not supported here");
+  }
+  return scanFor(scanner)(reinterpret_cast<const unsigned char *>(str), index,
+                          length);
+}
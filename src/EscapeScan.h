@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// Finding the bytes of a string which JsonWriter cannot copy straight to its
+// output: control characters, quotes, backslashes and the lead bytes of
+// multi-byte UTF-8 sequences, which it validates. The bytes in between are
+// scanned 16 or 32 at a time with SSE2 or AVX2 on x86 processors which have
+// them, otherwise 8 at a time.
+
+enum class EscapeScanner { SCALAR, SSE2, AVX2 };
+
+// The fastest scanner this processor supports, used by findSpecialByte
+EscapeScanner bestEscapeScanner();
+bool escapeScannerSupported(EscapeScanner scanner);
+const char *escapeScannerName(EscapeScanner scanner);
+
+// Index of the first byte of str from index on which needs attention, or
+// length if there is none
+size_t findSpecialByte(const char *str, size_t index, size_t length);
+// With a particular scanner, which must be supported
+size_t findSpecialByte(EscapeScanner scanner, const char *str, size_t index,
+                       size_t length);
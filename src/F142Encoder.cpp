@@ -0,0 +1,337 @@
+#include "F142Encoder.h"
+#include "Iso8601.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char fileIdentifier[] = {'f', '1', '4', '2'};
+
+// Members of the Value union
+enum class ValueType : uint8_t {
+  BYTE = 1,
+  UBYTE = 2,
+  SHORT = 3,
+  USHORT = 4,
+  INT = 5,
+  UINT = 6,
+  LONG = 7,
+  ULONG = 8,
+  FLOAT = 9,
+  DOUBLE = 10
+};
+
+// The layout written by encodeF142, offsets from the start of the buffer:
+//
+//   0   offset of the LogData table
+//   4   file identifier
+//   8   vtable of LogData: source_name, value_type, value, timestamp
+//   20  vtable of the value table
+//   32  LogData table, timestamp 8 byte aligned
+//   56  value table, the value 8 byte aligned
+//   64  or 72, the source name
+const size_t logDataVtable = 8;
+const size_t valueVtable = 20;
+const size_t logDataTable = 32;
+const size_t valueTable = 56;
+const uint16_t logDataTableSize = 24;
+const uint16_t sourceNameField = 4;
+const uint16_t timestampField = 8;
+const uint16_t valueField = 16;
+const uint16_t valueTypeField = 20;
+
+void put16(std::string &buffer, const size_t position, const uint16_t value) {
+  buffer[position] = char(value & 0xFFu);
+  buffer[position + 1] = char(value >> 8u);
+}
+
+void put32(std::string &buffer, const size_t position, const uint32_t value) {
+  for (size_t i = 0; i < 4; i++) {
+    buffer[position + i] = char((value >> (8 * i)) & 0xFFu);
+  }
+}
+
+void put64(std::string &buffer, const size_t position, const uint64_t value) {
+  for (size_t i = 0; i < 8; i++) {
+    buffer[position + i] = char((value >> (8 * i)) & 0xFFu);
+  }
+}
+
+uint64_t bitsOf(const int32_t value) { return static_cast<uint32_t>(value); }
+uint64_t bitsOf(const int64_t value) { return static_cast<uint64_t>(value); }
+
+uint64_t bitsOf(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+uint64_t bitsOf(const double value) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+template <typename T>
+void encode(const StringRef sourceName, const ValueType type, const T value,
+            const uint64_t timestampNanoseconds, std::string &buffer) {
+  const uint16_t valueOffset = sizeof(T) == 8 ? 8 : 4;
+  const uint16_t valueTableSize = valueOffset + sizeof(T);
+  const size_t nameString = valueTable + valueTableSize;
+  const size_t end = nameString + 4 + sourceName.size() + 1;
+  buffer.assign((end + 3) & ~size_t(3), '\0');
+
+  put32(buffer, 0, logDataTable);
+  std::memcpy(&buffer[4], fileIdentifier, sizeof(fileIdentifier));
+
+  put16(buffer, logDataVtable, 12);
+  put16(buffer, logDataVtable + 2, logDataTableSize);
+  put16(buffer, logDataVtable + 4, sourceNameField);
+  put16(buffer, logDataVtable + 6, valueTypeField);
+  put16(buffer, logDataVtable + 8, valueField);
+  put16(buffer, logDataVtable + 10, timestampField);
+
+  put16(buffer, valueVtable, 6);
+  put16(buffer, valueVtable + 2, valueTableSize);
+  put16(buffer, valueVtable + 4, valueOffset);
+
+  put32(buffer, logDataTable, logDataTable - logDataVtable);
+  put32(buffer, logDataTable + sourceNameField,
+        static_cast<uint32_t>(nameString - logDataTable - sourceNameField));
+  put64(buffer, logDataTable + timestampField, timestampNanoseconds);
+  put32(buffer, logDataTable + valueField,
+        valueTable - logDataTable - valueField);
+  buffer[logDataTable + valueTypeField] = char(type);
+
+  put32(buffer, valueTable, valueTable - valueVtable);
+  if (sizeof(T) == 8) {
+    put64(buffer, valueTable + valueOffset, bitsOf(value));
+  } else {
+    put32(buffer, valueTable + valueOffset,
+          static_cast<uint32_t>(bitsOf(value)));
+  }
+
+  put32(buffer, nameString, static_cast<uint32_t>(sourceName.size()));
+  std::memcpy(&buffer[nameString + 4], sourceName.data(), sourceName.size());
+}
+
+// Bounds checked reads from a flatbuffer
+class FlatbufferReader {
+public:
+  FlatbufferReader(const char *data, const size_t size)
+      : m_data(reinterpret_cast<const unsigned char *>(data)), m_size(size) {}
+
+  void checkRange(const size_t position, const size_t bytes) const {
+    if (position > m_size || bytes > m_size - position) {
+      throw std::runtime_error("Malformed f142 message, offset " +
+                               std::to_string(position) + " is out of range");
+    }
+  }
+
+  // A little endian integer of at most 8 bytes
+  uint64_t read(const size_t position, const size_t bytes) const {
+    if (bytes > 8) {
+      throw std::runtime_error("Cannot read " + std::to_string(bytes) +
+                               " bytes of an f142 message as an integer");
+    }
+    checkRange(position, bytes);
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      value |= uint64_t(m_data[position + i]) << (8 * i);
+    }
+    return value;
+  }
+
+  // Position of the field in the table, or 0 if it is not present
+  size_t field(const size_t table, const size_t id) const {
+    const auto vtable = static_cast<size_t>(
+        static_cast<int64_t>(table) -
+        static_cast<int32_t>(static_cast<uint32_t>(read(table, 4))));
+    const auto vtableSize = read(vtable, 2);
+    const auto entry = 4 + 2 * id;
+    if (entry + 2 > vtableSize) {
+      return 0;
+    }
+    const auto offset = read(vtable + entry, 2);
+    return offset == 0 ? 0 : table + offset;
+  }
+
+  size_t followOffset(const size_t position) const {
+    return position + read(position, 4);
+  }
+
+  std::string string(const size_t position) const {
+    const auto length = read(position, 4);
+    checkRange(position + 4, length);
+    return {reinterpret_cast<const char *>(m_data) + position + 4,
+            static_cast<size_t>(length)};
+  }
+
+private:
+  const unsigned char *m_data;
+  const size_t m_size;
+};
+
+template <typename T> double asDouble(const uint64_t bits) {
+  T value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return static_cast<double>(value);
+}
+
+double scalarValue(const ValueType type, const uint64_t bits) {
+  switch (type) {
+  case ValueType::BYTE:
+    return asDouble<int8_t>(bits);
+  case ValueType::UBYTE:
+    return asDouble<uint8_t>(bits);
+  case ValueType::SHORT:
+    return asDouble<int16_t>(bits);
+  case ValueType::USHORT:
+    return asDouble<uint16_t>(bits);
+  case ValueType::INT:
+    return asDouble<int32_t>(bits);
+  case ValueType::UINT:
+    return asDouble<uint32_t>(bits);
+  case ValueType::LONG:
+    return asDouble<int64_t>(bits);
+  case ValueType::ULONG:
+    return asDouble<uint64_t>(bits);
+  case ValueType::FLOAT:
+    return asDouble<float>(bits);
+  case ValueType::DOUBLE:
+    return asDouble<double>(bits);
+  }
+  return 0;
+}
+
+size_t scalarSize(const ValueType type) {
+  switch (type) {
+  case ValueType::BYTE:
+  case ValueType::UBYTE:
+    return 1;
+  case ValueType::SHORT:
+  case ValueType::USHORT:
+    return 2;
+  case ValueType::INT:
+  case ValueType::UINT:
+  case ValueType::FLOAT:
+    return 4;
+  default:
+    return 8;
+  }
+}
+}
+
+void encodeF142(const StringRef sourceName, const int32_t value,
+                const uint64_t timestampNanoseconds, std::string &buffer) {
+  encode(sourceName, ValueType::INT, value, timestampNanoseconds, buffer);
+}
+
+void encodeF142(const StringRef sourceName, const int64_t value,
+                const uint64_t timestampNanoseconds, std::string &buffer) {
+  encode(sourceName, ValueType::LONG, value, timestampNanoseconds, buffer);
+}
+
+void encodeF142(const StringRef sourceName, const float value,
+                const uint64_t timestampNanoseconds, std::string &buffer) {
+  encode(sourceName, ValueType::FLOAT, value, timestampNanoseconds, buffer);
+}
+
+void encodeF142(const StringRef sourceName, const double value,
+                const uint64_t timestampNanoseconds, std::string &buffer) {
+  encode(sourceName, ValueType::DOUBLE, value, timestampNanoseconds, buffer);
+}
+
+F142Value decodeF142(const char *message, const size_t size) {
+  const FlatbufferReader reader(message, size);
+  if (size < 8 ||
+      std::memcmp(message + 4, fileIdentifier, sizeof(fileIdentifier)) != 0) {
+    throw std::runtime_error("Not an f142 message");
+  }
+  const auto table = reader.followOffset(0);
+  F142Value decoded;
+  const auto sourceName = reader.field(table, 0);
+  const auto valueType = reader.field(table, 1);
+  const auto value = reader.field(table, 2);
+  if (sourceName == 0 || valueType == 0 || value == 0) {
+    throw std::runtime_error("f142 message has no source name or value");
+  }
+  decoded.sourceName = reader.string(reader.followOffset(sourceName));
+  const auto type = static_cast<ValueType>(reader.read(valueType, 1));
+  if (type < ValueType::BYTE || type > ValueType::DOUBLE) {
+    throw std::runtime_error("f142 message value is not a scalar");
+  }
+  const auto valueField = reader.field(reader.followOffset(value), 0);
+  if (valueField != 0) {
+    decoded.value =
+        scalarValue(type, reader.read(valueField, scalarSize(type)));
+  }
+  const auto timestamp = reader.field(table, 3);
+  if (timestamp != 0) {
+    decoded.timestampNanoseconds = reader.read(timestamp, 8);
+  }
+  return decoded;
+}
+
+F142LogPublisher::F142LogPublisher(MessageProducer &producer,
+                                   std::string topic, const size_t batchSize)
+    : m_producer(producer), m_topic(std::move(topic)),
+      m_batchSize(batchSize) {
+  if (batchSize == 0) {
+    throw std::runtime_error("f142 batch size must be at least 1");
+  }
+  m_batch.reserve(batchSize);
+}
+
+F142LogPublisher::~F142LogPublisher() {
+  try {
+    flush();
+  } catch (const std::exception &) {
+  }
+}
+
+PublishedMessage &F142LogPublisher::nextMessage() {
+  if (m_used == m_batch.size()) {
+    m_batch.emplace_back();
+    m_batch.back().topic = m_topic;
+  }
+  return m_batch[m_used];
+}
+
+void F142LogPublisher::messageAdded() {
+  m_used++;
+  m_numberOfMessages++;
+  if (m_used == m_batchSize) {
+    flush();
+  }
+}
+
+void F142LogPublisher::flush() {
+  if (m_used == 0) {
+    return;
+  }
+  // Only shrinks for the last, partial batch
+  m_batch.resize(m_used);
+  m_used = 0;
+  m_producer.produce(m_batch);
+}
+
+void F142LogPublisher::checkLengths(const size_t values, const size_t times) {
+  if (values != times) {
+    throw std::runtime_error("Log has " + std::to_string(values) +
+                             " values but " + std::to_string(times) +
+                             " times");
+  }
+}
+
+int64_t
+F142LogPublisher::startNanoseconds(const std::string &startTimeIso8601) {
+  return iso8601ToUnixTimeMicroseconds(startTimeIso8601) * 1000;
+}
+
+uint64_t F142LogPublisher::timestampNanoseconds(const int64_t start,
+                                                const float seconds) {
+  return static_cast<uint64_t>(
+      start + std::llround(static_cast<double>(seconds) * 1e9));
+}
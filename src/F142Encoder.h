@@ -0,0 +1,93 @@
+#pragma once
+
+#include "MessageProducer.h"
+#include "StringRef.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Log values as f142 LogData flatbuffers, the messages which the file writer
+// records for a stream with writer_module f142. Long runlogs and framelogs
+// can be published this way during a run and registered with
+// addRunlogStream or addFramelogStream, instead of being written into the
+// start message. Only the fields the file writer reads are encoded: the
+// source name, a scalar value and a timestamp in nanoseconds since the epoch.
+// The flatbuffer is laid out here directly, without the flatbuffers library.
+
+// Encode one value into buffer, which is cleared first
+void encodeF142(StringRef sourceName, int32_t value,
+                uint64_t timestampNanoseconds, std::string &buffer);
+void encodeF142(StringRef sourceName, int64_t value,
+                uint64_t timestampNanoseconds, std::string &buffer);
+void encodeF142(StringRef sourceName, float value,
+                uint64_t timestampNanoseconds, std::string &buffer);
+void encodeF142(StringRef sourceName, double value,
+                uint64_t timestampNanoseconds, std::string &buffer);
+
+// An f142 message read back, the value converted to double
+struct F142Value {
+  std::string sourceName;
+  double value = 0;
+  uint64_t timestampNanoseconds = 0;
+};
+
+// Decode a message with a scalar value, such as one from encodeF142. Throws
+// std::runtime_error if it is not one.
+F142Value decodeF142(const char *message, size_t size);
+
+// Publishes log values as f142 messages on a topic, such as the builder's
+// runlogStreamTopic(). Messages are encoded as values are added and handed
+// to the producer in batches of batchSize, the rest when flush() is called or
+// the publisher is destroyed. Not thread safe.
+class F142LogPublisher {
+public:
+  F142LogPublisher(MessageProducer &producer, std::string topic,
+                   size_t batchSize = 256);
+  // Delivers what is left, errors are ignored here so call flush() first to
+  // see them
+  ~F142LogPublisher();
+
+  F142LogPublisher(const F142LogPublisher &) = delete;
+  F142LogPublisher &operator=(const F142LogPublisher &) = delete;
+
+  template <typename T>
+  void add(StringRef sourceName, T value, uint64_t timestampNanoseconds) {
+    auto &message = nextMessage();
+    encodeF142(sourceName, value, timestampNanoseconds, message.payload);
+    messageAdded();
+  }
+
+  // Values with times in seconds relative to startTimeIso8601, as taken by
+  // addRunlogRecord
+  template <typename T>
+  void add(StringRef sourceName, const std::vector<T> &values,
+           const std::vector<float> &times,
+           const std::string &startTimeIso8601) {
+    checkLengths(values.size(), times.size());
+    const auto start = startNanoseconds(startTimeIso8601);
+    for (size_t i = 0; i < values.size(); i++) {
+      add(sourceName, values[i], timestampNanoseconds(start, times[i]));
+    }
+  }
+
+  // Throws std::runtime_error if the producer could not deliver the batch
+  void flush();
+
+  uint64_t numberOfMessages() const { return m_numberOfMessages; }
+
+private:
+  PublishedMessage &nextMessage();
+  void messageAdded();
+  static void checkLengths(size_t values, size_t times);
+  static int64_t startNanoseconds(const std::string &startTimeIso8601);
+  static uint64_t timestampNanoseconds(int64_t start, float seconds);
+
+  MessageProducer &m_producer;
+  const std::string m_topic;
+  const size_t m_batchSize;
+  // Reused from one batch to the next to keep their buffers, the first
+  // m_used are waiting to be delivered
+  std::vector<PublishedMessage> m_batch;
+  size_t m_used = 0;
+  uint64_t m_numberOfMessages = 0;
+};
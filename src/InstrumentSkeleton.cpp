@@ -0,0 +1,122 @@
+#include "InstrumentSkeleton.h"
+#include "NexusWriteCommandBuilder.h"
+#include "StringHash.h"
+#include <cstdint>
+#include <string>
+
+namespace {
+
+// Prefixed with its length, so that the strings of a list cannot run into
+// each other
+void addString(Fnv1aHash &hash, const std::string &str) {
+  const uint64_t size = str.size();
+  hash.add(&size, sizeof(size));
+  hash.add(str.data(), str.size());
+}
+
+// Over the bytes of each field in turn
+uint64_t hashConfig(const InstrumentConfig &config) {
+  Fnv1aHash hash;
+  addString(hash, config.instrumentName);
+  for (const auto &monitor : config.monitors) {
+    hash.add(&monitor.monitorNumber, sizeof(monitor.monitorNumber));
+    hash.add(&monitor.spectrumIndex, sizeof(monitor.spectrumIndex));
+  }
+  const uint64_t numberOfMonitors = config.monitors.size();
+  hash.add(&numberOfMonitors, sizeof(numberOfMonitors));
+  for (const auto &detector : config.detectors) {
+    hash.add(&detector.detectorNumber, sizeof(detector.detectorNumber));
+    hash.add(&detector.sourceDetectorDistance,
+             sizeof(detector.sourceDetectorDistance));
+  }
+  const uint64_t numberOfDetectors = config.detectors.size();
+  hash.add(&numberOfDetectors, sizeof(numberOfDetectors));
+  for (const auto &pv : config.seLogPVs) {
+    addString(hash, pv);
+  }
+  return hash.value();
+}
+
+bool equalConfigs(const InstrumentConfig &a, const InstrumentConfig &b) {
+  if (a.instrumentName != b.instrumentName ||
+      a.monitors.size() != b.monitors.size() ||
+      a.detectors.size() != b.detectors.size() || a.seLogPVs != b.seLogPVs) {
+    return false;
+  }
+  for (size_t i = 0; i < a.monitors.size(); i++) {
+    if (a.monitors[i].monitorNumber != b.monitors[i].monitorNumber ||
+        a.monitors[i].spectrumIndex != b.monitors[i].spectrumIndex) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < a.detectors.size(); i++) {
+    if (a.detectors[i].detectorNumber != b.detectors[i].detectorNumber ||
+        a.detectors[i].sourceDetectorDistance !=
+            b.detectors[i].sourceDetectorDistance) {
+      return false;
+    }
+  }
+  return true;
+}
+}
+
+InstrumentSkeleton::InstrumentSkeleton(
+    std::string instrumentName,
+    std::vector<std::shared_ptr<const DeferredNode>> entryChildren,
+    std::vector<std::shared_ptr<const DeferredNode>> trailingEntryChildren,
+    nlohmann::json isisVmsCompatJson, nlohmann::json runlogJson,
+    nlohmann::json framelogJson)
+    : m_instrumentName(std::move(instrumentName)),
+      m_entryChildren(std::move(entryChildren)),
+      m_trailingEntryChildren(std::move(trailingEntryChildren)),
+      m_isisVmsCompatJson(std::move(isisVmsCompatJson)),
+      m_runlogJson(std::move(runlogJson)),
+      m_framelogJson(std::move(framelogJson)) {}
+
+std::shared_ptr<const InstrumentSkeleton>
+InstrumentSkeletonCache::get(
+    const std::string &instrumentName, const std::string &configID,
+    const std::function<InstrumentConfig()> &makeConfig) {
+  auto key = std::make_pair(instrumentName, configID);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto skeleton = m_skeletonsByID.find(key);
+    if (skeleton != m_skeletonsByID.end()) {
+      return skeleton->second;
+    }
+  }
+  // Compile outside of the lock, if two threads race the first one to finish
+  // is kept
+  auto skeleton =
+      NexusWriteCommandBuilder::createInstrumentSkeleton(makeConfig());
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_skeletonsByID.emplace(std::move(key), std::move(skeleton))
+      .first->second;
+}
+
+std::shared_ptr<const InstrumentSkeleton>
+InstrumentSkeletonCache::get(const InstrumentConfig &config) {
+  const auto hash = hashConfig(config);
+  const auto find = [&]() -> std::shared_ptr<const InstrumentSkeleton> {
+    const auto range = m_skeletonsByConfig.equal_range(hash);
+    for (auto entry = range.first; entry != range.second; ++entry) {
+      if (equalConfigs(entry->second.config, config)) {
+        return entry->second.skeleton;
+      }
+    }
+    return nullptr;
+  };
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (const auto skeleton = find()) {
+      return skeleton;
+    }
+  }
+  auto skeleton = NexusWriteCommandBuilder::createInstrumentSkeleton(config);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (const auto existing = find()) {
+    return existing;
+  }
+  m_skeletonsByConfig.emplace(hash, ConfigEntry{config, skeleton});
+  return skeleton;
+}
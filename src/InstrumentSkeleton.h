@@ -0,0 +1,100 @@
+#pragma once
+
+#include "DeferredNode.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// The parts of the file structure which are the same for every run on an
+// instrument
+struct InstrumentConfig {
+  struct Monitor {
+    uint32_t monitorNumber;
+    uint32_t spectrumIndex;
+  };
+  struct Detector {
+    uint32_t detectorNumber;
+    float sourceDetectorDistance;
+  };
+
+  std::string instrumentName;
+  std::vector<Monitor> monitors;
+  std::vector<Detector> detectors;
+  std::vector<std::string> seLogPVs;
+};
+
+// Compiled form of an InstrumentConfig, the static groups are serialised once
+// and shared by every NexusWriteCommandBuilder constructed from it. Created by
+// NexusWriteCommandBuilder::createInstrumentSkeleton or InstrumentSkeletonCache.
+class InstrumentSkeleton {
+public:
+  InstrumentSkeleton(
+      std::string instrumentName,
+      std::vector<std::shared_ptr<const DeferredNode>> entryChildren,
+      std::vector<std::shared_ptr<const DeferredNode>> trailingEntryChildren,
+      nlohmann::json isisVmsCompatJson, nlohmann::json runlogJson,
+      nlohmann::json framelogJson);
+
+  const std::string &instrumentName() const { return m_instrumentName; }
+
+  // Added to the entry group in place of the instrument group
+  const std::vector<std::shared_ptr<const DeferredNode>> &
+  entryChildren() const {
+    return m_entryChildren;
+  }
+  // Added after the run's own children, before isis_vms_compat
+  const std::vector<std::shared_ptr<const DeferredNode>> &
+  trailingEntryChildren() const {
+    return m_trailingEntryChildren;
+  }
+
+  // Empty groups which each run adds its records to
+  const nlohmann::json &isisVmsCompatJson() const {
+    return m_isisVmsCompatJson;
+  }
+  const nlohmann::json &runlogJson() const { return m_runlogJson; }
+  const nlohmann::json &framelogJson() const { return m_framelogJson; }
+
+private:
+  const std::string m_instrumentName;
+  const std::vector<std::shared_ptr<const DeferredNode>> m_entryChildren;
+  const std::vector<std::shared_ptr<const DeferredNode>>
+      m_trailingEntryChildren;
+  const nlohmann::json m_isisVmsCompatJson;
+  const nlohmann::json m_runlogJson;
+  const nlohmann::json m_framelogJson;
+};
+
+// Compiles each distinct InstrumentConfig once, safe to use from several
+// threads
+class InstrumentSkeletonCache {
+public:
+  // The skeleton of the configuration which the caller identifies by
+  // configID, for example a version of the instrument's setup. makeConfig is
+  // only called the first time the instrument and ID are seen, so later runs
+  // cost a lookup; every configuration given the same ID must be equal.
+  std::shared_ptr<const InstrumentSkeleton>
+  get(const std::string &instrumentName, const std::string &configID,
+      const std::function<InstrumentConfig()> &makeConfig);
+  // Without an ID, found by a hash of the configuration and compared with it
+  std::shared_ptr<const InstrumentSkeleton>
+  get(const InstrumentConfig &config);
+
+private:
+  struct ConfigEntry {
+    InstrumentConfig config;
+    std::shared_ptr<const InstrumentSkeleton> skeleton;
+  };
+
+  std::mutex m_mutex;
+  std::map<std::pair<std::string, std::string>,
+           std::shared_ptr<const InstrumentSkeleton>>
+      m_skeletonsByID;
+  std::unordered_multimap<uint64_t, ConfigEntry> m_skeletonsByConfig;
+};
@@ -0,0 +1,171 @@
+#include "Iso8601.h"
+#include <stdexcept>
+
+namespace {
+
+const int64_t microsecondsPerSecond = 1000000;
+
+class Iso8601Parser {
+public:
+  Iso8601Parser(const char *time, const size_t length)
+      : m_position(time), m_end(time + length) {}
+
+  bool atEnd() const { return m_position == m_end; }
+
+  bool consume(const char expected) {
+    if (m_position != m_end && *m_position == expected) {
+      ++m_position;
+      return true;
+    }
+    return false;
+  }
+
+  bool digits(const int count, int &number) {
+    if (m_end - m_position < count) {
+      return false;
+    }
+    number = 0;
+    for (int i = 0; i < count; i++) {
+      const char character = m_position[i];
+      if (character < '0' || character > '9') {
+        return false;
+      }
+      number = number * 10 + (character - '0');
+    }
+    m_position += count;
+    return true;
+  }
+
+  bool number(const int count, const int minimum, const int maximum,
+              int &number) {
+    return digits(count, number) && number >= minimum && number <= maximum;
+  }
+
+  // Microseconds from a fraction of a second of one to nine digits
+  bool fraction(int64_t &microseconds) {
+    microseconds = 0;
+    int count = 0;
+    for (; m_position != m_end && *m_position >= '0' && *m_position <= '9';
+         ++m_position, ++count) {
+      if (count < 6) {
+        microseconds = microseconds * 10 + (*m_position - '0');
+      }
+    }
+    for (int i = count; i < 6; i++) {
+      microseconds *= 10;
+    }
+    return count >= 1 && count <= 9;
+  }
+
+private:
+  const char *m_position;
+  const char *const m_end;
+};
+
+bool isLeapYear(const int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+int daysInMonth(const int year, const int month) {
+  static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  return month == 2 && isLeapYear(year) ? 29 : days[month - 1];
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar, see
+// http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+int64_t daysFromCivil(int year, const int month, const int day) {
+  year -= month <= 2;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t yearOfEra = year - era * 400;
+  const int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 +
+                            day - 1;
+  const int64_t dayOfEra =
+      yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
+
+int64_t parseOffsetSeconds(Iso8601Parser &parser, bool &valid) {
+  if (parser.consume('Z') || parser.atEnd()) {
+    return 0;
+  }
+  int sign = 1;
+  if (parser.consume('-')) {
+    sign = -1;
+  } else if (!parser.consume('+')) {
+    valid = false;
+    return 0;
+  }
+  int hours = 0;
+  int minutes = 0;
+  valid = parser.number(2, 0, 23, hours);
+  if (valid && !parser.atEnd()) {
+    parser.consume(':');
+    valid = parser.number(2, 0, 59, minutes);
+  }
+  return sign * (hours * 3600 + minutes * 60);
+}
+
+[[noreturn]] void throwInvalidTime(const char *timeIso8601,
+                                   const size_t length) {
+  throw std::runtime_error("Invalid ISO8601 time \"" +
+                           std::string(timeIso8601, length) + "\"");
+}
+}
+
+int64_t iso8601ToUnixTimeMicroseconds(const char *timeIso8601,
+                                      const size_t length) {
+  Iso8601Parser parser(timeIso8601, length);
+  int year = 0;
+  int month = 0;
+  int day = 0;
+  int hour = 0;
+  int minute = 0;
+  int second = 0;
+  int64_t microseconds = 0;
+  bool valid = parser.digits(4, year) && parser.consume('-') &&
+               parser.number(2, 1, 12, month) && parser.consume('-') &&
+               parser.number(2, 1, 31, day) && parser.consume('T') &&
+               parser.number(2, 0, 23, hour) && parser.consume(':') &&
+               parser.number(2, 0, 59, minute) && parser.consume(':') &&
+               // 60 allows for a leap second
+               parser.number(2, 0, 60, second) &&
+               day <= daysInMonth(year, month);
+  if (valid && (parser.consume('.') || parser.consume(','))) {
+    valid = parser.fraction(microseconds);
+  }
+  int64_t offsetSeconds = 0;
+  if (valid) {
+    offsetSeconds = parseOffsetSeconds(parser, valid);
+  }
+  if (!valid || !parser.atEnd()) {
+    throwInvalidTime(timeIso8601, length);
+  }
+  const int64_t seconds = daysFromCivil(year, month, day) * 86400 +
+                          hour * 3600 + minute * 60 + second - offsetSeconds;
+  return seconds * microsecondsPerSecond + microseconds;
+}
+
+int64_t iso8601ToUnixTimeMicroseconds(const std::string &timeIso8601) {
+  return iso8601ToUnixTimeMicroseconds(timeIso8601.data(), timeIso8601.size());
+}
+
+int64_t iso8601ToUnixTimeMilliseconds(const std::string &timeIso8601) {
+  const auto microseconds = iso8601ToUnixTimeMicroseconds(timeIso8601);
+  // Round towards negative infinity so that times before 1970 truncate the
+  // same way as those after it
+  return (microseconds >= 0 ? microseconds : microseconds - 999) / 1000;
+}
+
+std::vector<float>
+relativeLogTimes(const std::string &startTimeIso8601,
+                 const std::vector<std::string> &timestampsIso8601) {
+  const auto start = iso8601ToUnixTimeMicroseconds(startTimeIso8601);
+  std::vector<float> times;
+  times.reserve(timestampsIso8601.size());
+  for (const auto &timestamp : timestampsIso8601) {
+    const auto sinceStart = iso8601ToUnixTimeMicroseconds(timestamp) - start;
+    times.push_back(static_cast<float>(static_cast<double>(sinceStart) /
+                                       microsecondsPerSecond));
+  }
+  return times;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Parse an ISO8601 date and time such as 2018-07-06T09:47:44.123+01:00 without
+// allocating. The fraction of a second may have up to 9 digits and is
+// truncated to microseconds. The offset may be Z, +HH:MM, +HHMM or +HH, a time
+// without one is taken to be UTC. Throws std::runtime_error if the string is
+// not a valid time.
+int64_t iso8601ToUnixTimeMicroseconds(const char *timeIso8601, size_t length);
+int64_t iso8601ToUnixTimeMicroseconds(const std::string &timeIso8601);
+
+// As above, truncated to milliseconds
+int64_t iso8601ToUnixTimeMilliseconds(const std::string &timeIso8601);
+
+// Convert absolute log timestamps into times in seconds relative to
+// startTimeIso8601, as taken by addRunlogRecord and LogColumns
+std::vector<float>
+relativeLogTimes(const std::string &startTimeIso8601,
+                 const std::vector<std::string> &timestampsIso8601);
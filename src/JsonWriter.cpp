@@ -0,0 +1,488 @@
+#include "JsonWriter.h"
+#include "EscapeScan.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char hexDigits[] = "0123456789abcdef";
+
+// Size at which buffered output is passed on to the sink
+const size_t sinkChunkSize = 64 * 1024;
+
+// Number of elements formatted between checks of the sink buffer by array()
+const size_t arrayBlockSize = 4096;
+
+// Length of the UTF-8 sequence starting at str[index], or 0 if the sequence is
+// not valid UTF-8 (overlong encodings and surrogates are rejected)
+size_t validUtf8SequenceLength(const unsigned char *str, size_t index,
+                               size_t length) {
+  const unsigned char lead = str[index];
+  size_t sequenceLength;
+  uint32_t codepoint;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    sequenceLength = 2;
+    codepoint = lead & 0x1Fu;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    sequenceLength = 3;
+    codepoint = lead & 0x0Fu;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    sequenceLength = 4;
+    codepoint = lead & 0x07u;
+  } else {
+    return 0;
+  }
+  if (index + sequenceLength > length) {
+    return 0;
+  }
+  for (size_t i = 1; i < sequenceLength; i++) {
+    const unsigned char continuation = str[index + i];
+    if ((continuation & 0xC0u) != 0x80u) {
+      return 0;
+    }
+    codepoint = (codepoint << 6u) | (continuation & 0x3Fu);
+  }
+  if ((sequenceLength == 3 && codepoint < 0x800) ||
+      (sequenceLength == 4 && codepoint < 0x10000) || codepoint > 0x10FFFF ||
+      (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+    return 0;
+  }
+  return sequenceLength;
+}
+}
+
+constexpr int JsonWriter::COMPACT;
+
+JsonWriter::JsonWriter(std::string &output, const int indent,
+                       const FloatFormat floatFormat)
+    : m_output(output), m_indent(indent), m_floatFormat(floatFormat) {
+  m_elementCounts.reserve(16);
+}
+
+JsonWriter::JsonWriter(OutputSink &sink, const int indent,
+                       const FloatFormat floatFormat)
+    : m_sink(&sink), m_output(m_sinkBuffer), m_indent(indent),
+      m_floatFormat(floatFormat) {
+  m_sinkBuffer.reserve(sinkChunkSize + sinkChunkSize / 4);
+  m_elementCounts.reserve(16);
+}
+
+void JsonWriter::flush() {
+  if (m_sink != nullptr && !m_sinkBuffer.empty()) {
+    m_sink->write(m_sinkBuffer.data(), m_sinkBuffer.size());
+    m_flushedBytes += m_sinkBuffer.size();
+    m_sinkBuffer.clear();
+  }
+}
+
+void JsonWriter::flushIfFull() {
+  if (m_sink != nullptr && m_sinkBuffer.size() >= sinkChunkSize) {
+    flush();
+  }
+}
+
+void JsonWriter::newline() { newline(m_elementCounts.size()); }
+
+void JsonWriter::newline(const size_t depth) {
+  if (m_indent >= 0) {
+    m_output.push_back('\n');
+    m_output.append(depth * static_cast<size_t>(m_indent), ' ');
+  }
+}
+
+void JsonWriter::beginValue() {
+  flushIfFull();
+  if (m_afterKey) {
+    m_afterKey = false;
+    return;
+  }
+  if (m_elementCounts.empty()) {
+    return;
+  }
+  if (m_elementCounts.back()++ > 0) {
+    m_output.push_back(',');
+  }
+  newline();
+}
+
+void JsonWriter::startObject() {
+  beginValue();
+  m_output.push_back('{');
+  m_elementCounts.push_back(0);
+}
+
+void JsonWriter::endObject() {
+  const auto elementCount = m_elementCounts.back();
+  m_elementCounts.pop_back();
+  if (elementCount > 0) {
+    newline();
+  }
+  m_output.push_back('}');
+}
+
+void JsonWriter::startArray() {
+  beginValue();
+  m_output.push_back('[');
+  m_elementCounts.push_back(0);
+}
+
+void JsonWriter::endArray() {
+  const auto elementCount = m_elementCounts.back();
+  m_elementCounts.pop_back();
+  if (elementCount > 0) {
+    newline();
+  }
+  m_output.push_back(']');
+}
+
+void JsonWriter::key(const std::string &name) {
+  key(name.data(), name.size());
+}
+
+void JsonWriter::key(const ArenaString &name) {
+  key(name.data(), name.size());
+}
+
+void JsonWriter::key(const char *name) {
+  key(name, std::char_traits<char>::length(name));
+}
+
+void JsonWriter::key(const char *name, const size_t length) {
+  beginValue();
+  writeEscaped(name, length);
+  endKey();
+}
+
+void JsonWriter::key(const InternedString name) {
+  beginValue();
+  m_output.append(name.json().data(), name.json().size());
+  endKey();
+}
+
+void JsonWriter::endKey() {
+  if (m_indent >= 0) {
+    m_output.append(": ", 2);
+  } else {
+    m_output.push_back(':');
+  }
+  m_afterKey = true;
+}
+
+template <typename T> void JsonWriter::writeNumber(const T number) {
+  beginValue();
+  char buffer[maxFormattedNumberLength];
+  const char *end = formatNumber(buffer, number);
+  m_output.append(buffer, static_cast<size_t>(end - buffer));
+}
+
+void JsonWriter::value(const std::string &str) {
+  beginValue();
+  writeEscaped(str.data(), str.size());
+}
+
+void JsonWriter::value(const char *str) {
+  value(str, std::char_traits<char>::length(str));
+}
+
+void JsonWriter::value(const char *str, const size_t length) {
+  beginValue();
+  writeEscaped(str, length);
+}
+
+void JsonWriter::value(const InternedString str) {
+  beginValue();
+  m_output.append(str.json().data(), str.json().size());
+}
+
+void JsonWriter::value(const bool boolean) {
+  beginValue();
+  if (boolean) {
+    m_output.append("true", 4);
+  } else {
+    m_output.append("false", 5);
+  }
+}
+
+void JsonWriter::value(const int32_t number) {
+  value(static_cast<int64_t>(number));
+}
+
+void JsonWriter::value(const uint32_t number) {
+  value(static_cast<uint64_t>(number));
+}
+
+void JsonWriter::value(const int64_t number) { writeNumber(number); }
+
+void JsonWriter::value(const uint64_t number) { writeNumber(number); }
+
+void JsonWriter::value(const float number) { writeNumber(number); }
+
+void JsonWriter::value(const double number) { writeNumber(number); }
+
+void JsonWriter::null() {
+  beginValue();
+  m_output.append("null", 4);
+}
+
+void JsonWriter::array(const float *values, const size_t size) {
+  writeArray(values, size);
+}
+
+void JsonWriter::array(const double *values, const size_t size) {
+  writeArray(values, size);
+}
+
+void JsonWriter::array(const int32_t *values, const size_t size) {
+  writeArray(values, size);
+}
+
+void JsonWriter::array(const int64_t *values, const size_t size) {
+  writeArray(values, size);
+}
+
+void JsonWriter::array(const uint32_t *values, const size_t size) {
+  writeArray(values, size);
+}
+
+void JsonWriter::array(const uint64_t *values, const size_t size) {
+  writeArray(values, size);
+}
+
+void JsonWriter::elements(const int32_t *values, const size_t size) {
+  writeElements(values, size);
+}
+
+template <typename T>
+void JsonWriter::writeArray(const T *values, const size_t size) {
+  startArray();
+  writeElements(values, size);
+  endArray();
+}
+
+template <typename T>
+void JsonWriter::writeElements(const T *values, const size_t size) {
+  const auto previousCount = m_elementCounts.back();
+  const auto depth = m_elementCounts.size();
+  const size_t indentLength =
+      m_indent >= 0 ? depth * static_cast<size_t>(m_indent) : 0;
+  const size_t maxElementLength = 2 + indentLength + maxFormattedNumberLength;
+  for (size_t blockStart = 0; blockStart < size; blockStart += arrayBlockSize) {
+    const auto blockEnd = std::min(size, blockStart + arrayBlockSize);
+    // Format into space reserved at the end of the output, then trim it
+    const auto offset = m_output.size();
+    m_output.resize(offset + (blockEnd - blockStart) * maxElementLength);
+    char *position = &m_output[offset];
+    for (auto i = blockStart; i < blockEnd; i++) {
+      if (i > 0 || previousCount > 0) {
+        *position++ = ',';
+      }
+      if (m_indent >= 0) {
+        *position++ = '\n';
+        std::memset(position, ' ', indentLength);
+        position += indentLength;
+      }
+      position = formatNumber(position, values[i]);
+    }
+    m_output.resize(static_cast<size_t>(position - &m_output[0]));
+    flushIfFull();
+  }
+  m_elementCounts.back() = previousCount + size;
+}
+
+char *JsonWriter::formatNumber(char *first, const float number) const {
+  if (m_floatFormat == FloatFormat::SHORTEST_FLOAT32) {
+    return formatFloat(first, number);
+  }
+  // nlohmann::json stores every floating point value as a double
+  return formatDouble(first, static_cast<double>(number));
+}
+
+char *JsonWriter::formatNumber(char *first, const double number) const {
+  return formatDouble(first, number);
+}
+
+char *JsonWriter::formatNumber(char *first, const int32_t number) const {
+  return formatInteger(first, number);
+}
+
+char *JsonWriter::formatNumber(char *first, const int64_t number) const {
+  return formatInteger(first, number);
+}
+
+char *JsonWriter::formatNumber(char *first, const uint32_t number) const {
+  return formatUnsigned(first, number);
+}
+
+char *JsonWriter::formatNumber(char *first, const uint64_t number) const {
+  return formatUnsigned(first, number);
+}
+
+void JsonWriter::value(const nlohmann::json &node) { writeJson(node); }
+
+void JsonWriter::value(const BuilderJson &node) { writeJson(node); }
+
+template <typename BasicJsonType>
+void JsonWriter::writeJson(const BasicJsonType &node) {
+  using value_t = nlohmann::json::value_t;
+  switch (node.type()) {
+  case value_t::object:
+    startObject();
+    for (auto it = node.cbegin(); it != node.cend(); ++it) {
+      const auto &name = it.key();
+      key(name.data(), name.size());
+      writeJson(it.value());
+    }
+    endObject();
+    break;
+  case value_t::array:
+    startArray();
+    for (const auto &element : node) {
+      writeJson(element);
+    }
+    endArray();
+    break;
+  case value_t::string: {
+    const auto &str =
+        node.template get_ref<const typename BasicJsonType::string_t &>();
+    beginValue();
+    writeEscaped(str.data(), str.size());
+    break;
+  }
+  case value_t::boolean:
+    value(node.template get<bool>());
+    break;
+  case value_t::number_integer:
+    value(node.template get<int64_t>());
+    break;
+  case value_t::number_unsigned:
+    value(node.template get<uint64_t>());
+    break;
+  case value_t::number_float:
+    value(node.template get<double>());
+    break;
+  case value_t::null:
+    null();
+    break;
+  default:
+    throw std::runtime_error("Unhandled JSON value type in JsonWriter");
+  }
+}
+
+void JsonWriter::rawValue(const char *compactJson, const size_t size) {
+  beginValue();
+  if (m_indent < 0) {
+    m_output.append(compactJson, size);
+    return;
+  }
+  // Insert the whitespace that dump(indent) would, everything between the
+  // structural characters is copied as it is
+  auto depth = m_elementCounts.size();
+  size_t runStart = 0;
+  bool inString = false;
+  for (size_t i = 0; i < size; i++) {
+    const char character = compactJson[i];
+    if (inString) {
+      if (character == '\\') {
+        i++;
+      } else if (character == '"') {
+        inString = false;
+      }
+      continue;
+    }
+    switch (character) {
+    case '"':
+      inString = true;
+      break;
+    case '{':
+    case '[':
+      if (i + 1 < size &&
+          compactJson[i + 1] == (character == '{' ? '}' : ']')) {
+        // Empty containers stay on one line
+        i++;
+        break;
+      }
+      m_output.append(compactJson + runStart, i + 1 - runStart);
+      newline(++depth);
+      runStart = i + 1;
+      break;
+    case '}':
+    case ']':
+      m_output.append(compactJson + runStart, i - runStart);
+      newline(--depth);
+      runStart = i;
+      break;
+    case ',':
+      m_output.append(compactJson + runStart, i + 1 - runStart);
+      newline(depth);
+      runStart = i + 1;
+      break;
+    case ':':
+      m_output.append(compactJson + runStart, i + 1 - runStart);
+      m_output.push_back(' ');
+      runStart = i + 1;
+      break;
+    default:
+      break;
+    }
+  }
+  m_output.append(compactJson + runStart, size - runStart);
+}
+
+void JsonWriter::writeEscaped(const char *str, const size_t length) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(str);
+  m_output.push_back('"');
+  size_t runStart = 0;
+  size_t index = 0;
+  while (index < length) {
+    index = findSpecialByte(str, index, length);
+    if (index == length) {
+      break;
+    }
+    const unsigned char byte = bytes[index];
+    if (byte >= 0x80) {
+      const auto sequenceLength =
+          validUtf8SequenceLength(bytes, index, length);
+      if (sequenceLength == 0) {
+        throw std::runtime_error("Invalid UTF-8 byte at index " +
+                                 std::to_string(index) +
+                                 " in string passed to JsonWriter");
+      }
+      index += sequenceLength;
+      continue;
+    }
+    m_output.append(str + runStart, index - runStart);
+    switch (byte) {
+    case '"':
+      m_output.append("\\\"", 2);
+      break;
+    case '\\':
+      m_output.append("\\\\", 2);
+      break;
+    case '\b':
+      m_output.append("\\b", 2);
+      break;
+    case '\f':
+      m_output.append("\\f", 2);
+      break;
+    case '\n':
+      m_output.append("\\n", 2);
+      break;
+    case '\r':
+      m_output.append("\\r", 2);
+      break;
+    case '\t':
+      m_output.append("\\t", 2);
+      break;
+    default: {
+      const char escaped[] = {'\\', 'u', '0', '0', hexDigits[byte >> 4u],
+                              hexDigits[byte & 0x0Fu]};
+      m_output.append(escaped, sizeof(escaped));
+    }
+    }
+    index++;
+    runStart = index;
+  }
+  m_output.append(str + runStart, length - runStart);
+  m_output.push_back('"');
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "BuilderJson.h"
+#include "NumberFormat.h"
+#include "OutputSink.h"
+#include "StringPool.h"
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+// Event based JSON writer which appends directly to an output buffer.
+// The output is byte-identical to nlohmann::json::dump(indent) provided object
+// keys are written in sorted order, which is how nlohmann::json stores them.
+// An indent of -1 (COMPACT) gives the compact form, as for dump().
+// FloatFormat::SHORTEST_FLOAT32 shortens values held as float, the output then
+// differs from dump() but still reads back as the same values.
+class JsonWriter {
+public:
+  static constexpr int COMPACT = -1;
+
+  // Append directly to the output string
+  explicit JsonWriter(std::string &output, int indent = COMPACT,
+                      FloatFormat floatFormat = FloatFormat::AS_DOUBLE);
+  // Buffer output internally and pass it to the sink in chunks, flush() must
+  // be called once the document is complete
+  explicit JsonWriter(OutputSink &sink, int indent = COMPACT,
+                      FloatFormat floatFormat = FloatFormat::AS_DOUBLE);
+
+  void flush();
+
+  FloatFormat floatFormat() const { return m_floatFormat; }
+
+  // Bytes passed to the sink or appended to the output string so far, the
+  // latter including anything the string held beforehand
+  size_t bytesWritten() const { return m_flushedBytes + m_output.size(); }
+
+  void startObject();
+  void endObject();
+  void startArray();
+  void endArray();
+
+  void key(const std::string &name);
+  void key(const ArenaString &name);
+  void key(const char *name);
+  void key(const char *name, size_t length);
+  // Interned strings are copied as they were escaped by their pool
+  void key(InternedString name);
+
+  void value(const std::string &str);
+  void value(const char *str);
+  void value(const char *str, size_t length);
+  void value(InternedString str);
+  void value(bool boolean);
+  void value(int32_t number);
+  void value(uint32_t number);
+  void value(int64_t number);
+  void value(uint64_t number);
+  void value(float number);
+  void value(double number);
+  void null();
+
+  // Write an array of numbers, equivalent to writing each element with value()
+  // but formatted straight into the output
+  void array(const float *values, size_t size);
+  void array(const double *values, size_t size);
+  void array(const int32_t *values, size_t size);
+  void array(const int64_t *values, size_t size);
+  void array(const uint32_t *values, size_t size);
+  void array(const uint64_t *values, size_t size);
+  // Append numbers to the array which is open, as if each was written with
+  // value(), so that a long array can be written a block at a time
+  void elements(const int32_t *values, size_t size);
+
+  // Stream an existing DOM value without copying it
+  void value(const nlohmann::json &node);
+  void value(const BuilderJson &node);
+
+  // Write a value which has already been serialised in compact form, it is
+  // re-indented if this writer is not compact
+  void rawValue(const char *compactJson, size_t size);
+
+private:
+  template <typename BasicJsonType> void writeJson(const BasicJsonType &node);
+  template <typename T> void writeNumber(T number);
+  template <typename T> void writeArray(const T *values, size_t size);
+  template <typename T> void writeElements(const T *values, size_t size);
+  char *formatNumber(char *first, float number) const;
+  char *formatNumber(char *first, double number) const;
+  char *formatNumber(char *first, int32_t number) const;
+  char *formatNumber(char *first, int64_t number) const;
+  char *formatNumber(char *first, uint32_t number) const;
+  char *formatNumber(char *first, uint64_t number) const;
+  void beginValue();
+  void endKey();
+  void flushIfFull();
+  void newline();
+  void newline(size_t depth);
+  void writeEscaped(const char *str, size_t length);
+
+  OutputSink *m_sink = nullptr;
+  std::string m_sinkBuffer;
+  size_t m_flushedBytes = 0;
+  std::string &m_output;
+  const int m_indent;
+  const FloatFormat m_floatFormat;
+  // Number of elements written so far at each level of nesting
+  std::vector<size_t> m_elementCounts;
+  bool m_afterKey = false;
+};
@@ -0,0 +1,136 @@
+#include "LogColumns.h"
+
+namespace {
+
+void writeAttribute(JsonWriter &writer, const char *name,
+                    const std::string &value) {
+  writer.startObject();
+  writer.key("name");
+  writer.value(name);
+  writer.key("values");
+  writer.value(value);
+  writer.endObject();
+}
+
+void writeDatasetType(JsonWriter &writer, const std::string &typeStr) {
+  writer.key("dataset");
+  writer.startObject();
+  writer.key("size");
+  writer.startArray();
+  writer.value("unlimited");
+  writer.endArray();
+  writer.key("type");
+  writer.value(typeStr);
+  writer.endObject();
+}
+
+nlohmann::json attributeToJson(const char *name, const std::string &value) {
+  return {{"name", name}, {"values", value}};
+}
+
+nlohmann::json datasetToJson(const char *name, const std::string &typeStr,
+                             nlohmann::json values) {
+  return {{"name", name},
+          {"type", "dataset"},
+          {"values", std::move(values)},
+          {"dataset", {{"type", typeStr}, {"size", {"unlimited"}}}}};
+}
+}
+
+LogColumns::LogColumns(std::vector<float> times, std::string startTime)
+    : m_times(std::move(times)), m_startTime(std::move(startTime)) {
+  JsonWriter writer(m_compactTimes, JsonWriter::COMPACT);
+  writer.array(m_times.data(), m_times.size());
+  JsonWriter float32Writer(m_compactTimesFloat32, JsonWriter::COMPACT,
+                           FloatFormat::SHORTEST_FLOAT32);
+  float32Writer.array(m_times.data(), m_times.size());
+}
+
+LogColumns::LogColumns(const float *times, const size_t size,
+                       std::string startTime)
+    : LogColumns(std::vector<float>(times, times + size),
+                 std::move(startTime)) {}
+
+void LogColumns::writeColumn(JsonWriter &writer, const size_t column) const {
+  // Keys in sorted order, matching createLogGroup() in the builder
+  const auto &logColumn = *m_columns.at(column);
+  writer.startObject();
+  writer.key("attributes");
+  writer.startArray();
+  writeAttribute(writer, "NX_class", "NXlog");
+  writer.endArray();
+  writer.key("children");
+  writer.startArray();
+
+  writer.startObject();
+  writer.key("attributes");
+  writer.startArray();
+  writeAttribute(writer, "start", m_startTime);
+  writeAttribute(writer, "units", "second");
+  writer.endArray();
+  writeDatasetType(writer, nexusTypeName<float>());
+  writer.key("name");
+  writer.value("time");
+  writer.key("type");
+  writer.value("dataset");
+  writer.key("values");
+  const auto &compactTimes = writer.floatFormat() == FloatFormat::AS_DOUBLE
+                                 ? m_compactTimes
+                                 : m_compactTimesFloat32;
+  writer.rawValue(compactTimes.data(), compactTimes.size());
+  writer.endObject();
+
+  writer.startObject();
+  if (!logColumn.units.empty()) {
+    writer.key("attributes");
+    writer.startArray();
+    writeAttribute(writer, "units", logColumn.units);
+    writer.endArray();
+  }
+  writeDatasetType(writer, logColumn.typeStr);
+  writer.key("name");
+  writer.value("value");
+  writer.key("type");
+  writer.value("dataset");
+  writer.key("values");
+  logColumn.writeValues(writer);
+  writer.endObject();
+
+  writer.endArray();
+  writer.key("name");
+  writer.value(logColumn.name);
+  writer.key("type");
+  writer.value("group");
+  writer.endObject();
+}
+
+nlohmann::json LogColumns::columnToJson(const size_t column) const {
+  const auto &logColumn = *m_columns.at(column);
+  auto time = datasetToJson("time", nexusTypeName<float>(), m_times);
+  time["attributes"] =
+      nlohmann::json::array({attributeToJson("start", m_startTime),
+                             attributeToJson("units", "second")});
+  auto value =
+      datasetToJson("value", logColumn.typeStr, logColumn.valuesToJson());
+  if (!logColumn.units.empty()) {
+    value["attributes"] =
+        nlohmann::json::array({attributeToJson("units", logColumn.units)});
+  }
+  nlohmann::json group = {{"name", logColumn.name}, {"type", "group"}};
+  group["attributes"] =
+      nlohmann::json::array({attributeToJson("NX_class", "NXlog")});
+  group["children"] = nlohmann::json::array({time, value});
+  return group;
+}
+
+LogColumnNode::LogColumnNode(std::shared_ptr<const LogColumns> columns,
+                             const size_t column)
+    : m_columns(std::move(columns)), m_column(column) {}
+
+void LogColumnNode::write(JsonWriter &writer) const {
+  m_columns->writeColumn(writer, m_column);
+}
+
+nlohmann::json LogColumnNode::toJson() const {
+  return m_columns->columnToJson(m_column);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "DeferredNode.h"
+#include "JsonWriter.h"
+#include "NexusTypes.h"
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// A batch of numeric logs which share a time axis, held as one contiguous
+// array per log. Each column becomes an NXlog group, exactly as if it had been
+// passed to addRunlogRecord or addFramelogRecord with the shared times, but no
+// JSON nodes are created for the values; they are written straight from the
+// arrays when a message is serialised.
+class LogColumns {
+public:
+  LogColumns(std::vector<float> times, std::string startTime);
+  LogColumns(const float *times, size_t size, std::string startTime);
+
+  // Every column must have one value per time. typeStr is the NeXus type of
+  // the values, as for addRunlogRecord.
+  template <typename T>
+  void addColumn(std::string name, std::string typeStr, std::vector<T> values,
+                 std::string units = "") {
+    static_assert(std::is_arithmetic<T>::value,
+                  "Log columns must hold numeric values");
+    if (values.size() != m_times.size()) {
+      throw std::runtime_error("Log column " + name + " has " +
+                               std::to_string(values.size()) +
+                               " values but there are " +
+                               std::to_string(m_times.size()) + " times");
+    }
+    m_columns.emplace_back(new TypedColumn<T>(std::move(name),
+                                              std::move(typeStr),
+                                              std::move(units),
+                                              std::move(values)));
+  }
+
+  template <typename T>
+  void addColumn(std::string name, std::string typeStr, const T *values,
+                 size_t size, std::string units = "") {
+    addColumn(std::move(name), std::move(typeStr),
+              std::vector<T>(values, values + size), std::move(units));
+  }
+
+  // A column labelled with the NeXus type of its values, see NexusTypes.h
+  template <typename T>
+  void addColumn(std::string name, std::vector<T> values,
+                 std::string units = "") {
+    addColumn(std::move(name), nexusTypeName<T>(), std::move(values),
+              std::move(units));
+  }
+
+  template <typename T>
+  void addColumn(std::string name, const T *values, size_t size,
+                 std::string units = "") {
+    addColumn(std::move(name), nexusTypeName<T>(), values, size,
+              std::move(units));
+  }
+
+  size_t numberOfColumns() const { return m_columns.size(); }
+  size_t numberOfTimes() const { return m_times.size(); }
+
+  // The NXlog group for a column
+  void writeColumn(JsonWriter &writer, size_t column) const;
+  nlohmann::json columnToJson(size_t column) const;
+
+private:
+  class Column {
+  public:
+    Column(std::string name, std::string typeStr, std::string units)
+        : name(std::move(name)), typeStr(std::move(typeStr)),
+          units(std::move(units)) {}
+    virtual ~Column() = default;
+
+    virtual void writeValues(JsonWriter &writer) const = 0;
+    virtual nlohmann::json valuesToJson() const = 0;
+
+    const std::string name;
+    const std::string typeStr;
+    const std::string units;
+  };
+
+  template <typename T> class TypedColumn : public Column {
+  public:
+    TypedColumn(std::string name, std::string typeStr, std::string units,
+                std::vector<T> values)
+        : Column(std::move(name), std::move(typeStr), std::move(units)),
+          m_values(std::move(values)) {}
+
+    void writeValues(JsonWriter &writer) const override {
+      writer.array(m_values.data(), m_values.size());
+    }
+
+    nlohmann::json valuesToJson() const override { return m_values; }
+
+  private:
+    const std::vector<T> m_values;
+  };
+
+  std::vector<float> m_times;
+  std::string m_startTime;
+  // The times are formatted once, in each FloatFormat, and copied into every
+  // column's group
+  std::string m_compactTimes;
+  std::string m_compactTimesFloat32;
+  std::vector<std::unique_ptr<const Column>> m_columns;
+};
+
+// One column of a batch, as a child of the runlog or framelog group
+class LogColumnNode : public DeferredNode {
+public:
+  LogColumnNode(std::shared_ptr<const LogColumns> columns, size_t column);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+
+private:
+  const std::shared_ptr<const LogColumns> m_columns;
+  const size_t m_column;
+};
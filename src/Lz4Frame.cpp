@@ -0,0 +1,501 @@
+#include "Lz4Frame.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t frameMagic = 0x184D2204;
+const uint32_t uncompressedBlockFlag = 0x80000000u;
+
+// Linked 64 KiB blocks: matches may refer back up to 64 KiB into the previous
+// block, which is the most an LZ4 offset can reach
+const size_t blockSize = 64 * 1024;
+const size_t maxOffset = 65535;
+const uint8_t frameFlags = 0x44; // version 01, content checksum
+const uint8_t blockDescriptor = 0x40;
+
+const size_t minMatch = 4;
+// The last match starts at least 12 bytes before the end of a block and the
+// last 5 bytes are always literals
+const size_t matchStartMargin = 12;
+const size_t lastLiterals = 5;
+
+const unsigned hashLog = 12;
+
+const uint32_t prime1 = 2654435761u;
+const uint32_t prime2 = 2246822519u;
+const uint32_t prime3 = 3266489917u;
+const uint32_t prime4 = 668265263u;
+const uint32_t prime5 = 374761393u;
+
+uint32_t read32(const unsigned char *data) {
+  return uint32_t(data[0]) | uint32_t(data[1]) << 8u |
+         uint32_t(data[2]) << 16u | uint32_t(data[3]) << 24u;
+}
+
+uint32_t read32(const char *data) {
+  return read32(reinterpret_cast<const unsigned char *>(data));
+}
+
+void append32(std::string &output, const uint32_t value) {
+  const char bytes[] = {char(value & 0xFFu), char((value >> 8u) & 0xFFu),
+                        char((value >> 16u) & 0xFFu),
+                        char((value >> 24u) & 0xFFu)};
+  output.append(bytes, sizeof(bytes));
+}
+
+uint32_t rotateLeft(const uint32_t value, const unsigned bits) {
+  return (value << bits) | (value >> (32u - bits));
+}
+
+uint32_t xxhRound(uint32_t accumulator, const uint32_t input) {
+  accumulator += input * prime2;
+  return rotateLeft(accumulator, 13) * prime1;
+}
+
+uint32_t hashSequence(const char *data) {
+  uint32_t sequence;
+  std::memcpy(&sequence, data, sizeof(sequence));
+  return (sequence * prime1) >> (32u - hashLog);
+}
+
+bool sameSequence(const char *first, const char *second) {
+  return std::memcmp(first, second, minMatch) == 0;
+}
+
+// Length of the common prefix of first and second, up to limit bytes
+size_t commonLength(const char *first, const char *second,
+                    const size_t limit) {
+  size_t length = 0;
+  uint64_t firstWord, secondWord;
+  while (length + sizeof(firstWord) <= limit) {
+    std::memcpy(&firstWord, first + length, sizeof(firstWord));
+    std::memcpy(&secondWord, second + length, sizeof(secondWord));
+    if (firstWord != secondWord) {
+      break;
+    }
+    length += sizeof(firstWord);
+  }
+  while (length < limit && first[length] == second[length]) {
+    length++;
+  }
+  return length;
+}
+
+// Lengths of 15 or more continue in bytes of 255 and a final remainder
+void appendLengthBytes(std::string &output, size_t length) {
+  for (; length >= 255; length -= 255) {
+    output.push_back(char(255));
+  }
+  output.push_back(char(length));
+}
+
+void appendSequence(std::string &output, const char *literals,
+                    const size_t literalLength, const size_t offset,
+                    const size_t matchLength) {
+  const auto matchCode = matchLength - minMatch;
+  output.push_back(char((std::min<size_t>(literalLength, 15) << 4u) |
+                        std::min<size_t>(matchCode, 15)));
+  if (literalLength >= 15) {
+    appendLengthBytes(output, literalLength - 15);
+  }
+  output.append(literals, literalLength);
+  output.push_back(char(offset & 0xFFu));
+  output.push_back(char(offset >> 8u));
+  if (matchCode >= 15) {
+    appendLengthBytes(output, matchCode - 15);
+  }
+}
+
+void appendLastLiterals(std::string &output, const char *literals,
+                        const size_t literalLength) {
+  output.push_back(char(std::min<size_t>(literalLength, 15) << 4u));
+  if (literalLength >= 15) {
+    appendLengthBytes(output, literalLength - 15);
+  }
+  output.append(literals, literalLength);
+}
+
+// Greedy compression of window[start, end) into output. Matches may start
+// anywhere earlier in window.
+void compressSequences(const std::string &window, const size_t start,
+                       const size_t end, std::vector<uint32_t> &hashTable,
+                       std::string &output) {
+  const char *data = window.data();
+  size_t anchor = start;
+  if (end - start >= matchStartMargin + 1) {
+    const size_t matchStartLimit = end - matchStartMargin;
+    const size_t matchEndLimit = end - lastLiterals;
+    size_t position = start;
+    // Step further between attempts the longer there has been no match, as
+    // the reference compressor does
+    size_t misses = 0;
+    while (position <= matchStartLimit) {
+      auto &entry = hashTable[hashSequence(data + position)];
+      size_t candidate = entry;
+      entry = static_cast<uint32_t>(position);
+      if (candidate >= position || position - candidate > maxOffset ||
+          !sameSequence(data + candidate, data + position)) {
+        position += 1 + (misses++ >> 6u);
+        continue;
+      }
+      misses = 0;
+      while (position > anchor && candidate > 0 &&
+             data[position - 1] == data[candidate - 1]) {
+        position--;
+        candidate--;
+      }
+      const auto matchLength =
+          minMatch + commonLength(data + candidate + minMatch,
+                                  data + position + minMatch,
+                                  matchEndLimit - position - minMatch);
+      appendSequence(output, data + anchor, position - anchor,
+                     position - candidate, matchLength);
+      position += matchLength;
+      anchor = position;
+      if (position <= matchStartLimit) {
+        hashTable[hashSequence(data + position - 2)] =
+            static_cast<uint32_t>(position - 2);
+      }
+    }
+  }
+  appendLastLiterals(output, data + anchor, end - anchor);
+}
+
+[[noreturn]] void throwCorrupt(const char *problem) {
+  throw std::runtime_error(std::string("Corrupt LZ4 frame, ") + problem);
+}
+
+size_t blockMaxSizeOf(const uint8_t descriptor) {
+  const auto sizeCode = (descriptor >> 4u) & 0x7u;
+  if (sizeCode < 4 || (descriptor & 0x8Fu) != 0) {
+    throwCorrupt("unsupported block descriptor");
+  }
+  return size_t(1) << (8 + 2 * sizeCode);
+}
+
+// Reads a literal or match length continued in bytes of 255
+bool readLengthBytes(const unsigned char *&input, const unsigned char *end,
+                     size_t &length) {
+  unsigned char byte;
+  do {
+    if (input == end) {
+      return false;
+    }
+    byte = *input++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+void decompressBlock(const unsigned char *input, const size_t size,
+                     std::string &output, const size_t historyStart,
+                     const size_t maxSize) {
+  const auto *end = input + size;
+  const auto blockStart = output.size();
+  while (true) {
+    if (input == end) {
+      throwCorrupt("truncated block");
+    }
+    const auto token = *input++;
+    size_t literalLength = token >> 4u;
+    if (literalLength == 15 && !readLengthBytes(input, end, literalLength)) {
+      throwCorrupt("truncated literal length");
+    }
+    if (literalLength > size_t(end - input) ||
+        output.size() - blockStart + literalLength > maxSize) {
+      throwCorrupt("literals overrun the block");
+    }
+    output.append(reinterpret_cast<const char *>(input), literalLength);
+    input += literalLength;
+    if (input == end) {
+      return;
+    }
+    if (end - input < 2) {
+      throwCorrupt("truncated match offset");
+    }
+    const size_t offset = size_t(input[0]) | size_t(input[1]) << 8u;
+    input += 2;
+    size_t matchLength = token & 0xFu;
+    if (matchLength == 15 && !readLengthBytes(input, end, matchLength)) {
+      throwCorrupt("truncated match length");
+    }
+    matchLength += minMatch;
+    const auto position = output.size();
+    if (offset == 0 || offset > position - historyStart) {
+      throwCorrupt("match offset out of range");
+    }
+    if (position - blockStart + matchLength > maxSize) {
+      throwCorrupt("match overruns the block");
+    }
+    output.resize(position + matchLength);
+    char *target = &output[position];
+    const char *source = target - offset;
+    if (offset >= matchLength) {
+      std::memcpy(target, source, matchLength);
+    } else {
+      // A match which overlaps itself repeats its start, so it is copied
+      // forwards a byte at a time
+      for (size_t i = 0; i < matchLength; i++) {
+        target[i] = source[i];
+      }
+    }
+  }
+}
+}
+
+void Xxh32::update(const char *data, size_t size) {
+  const auto *input = reinterpret_cast<const unsigned char *>(data);
+  m_length += size;
+  if (m_buffered + size < sizeof(m_buffer)) {
+    std::memcpy(m_buffer + m_buffered, input, size);
+    m_buffered += size;
+    return;
+  }
+  if (m_buffered > 0) {
+    const auto fill = sizeof(m_buffer) - m_buffered;
+    std::memcpy(m_buffer + m_buffered, input, fill);
+    for (size_t lane = 0; lane < 4; lane++) {
+      m_accumulators[lane] =
+          xxhRound(m_accumulators[lane], read32(m_buffer + 4 * lane));
+    }
+    input += fill;
+    size -= fill;
+    m_buffered = 0;
+  }
+  for (; size >= sizeof(m_buffer); input += 16, size -= 16) {
+    for (size_t lane = 0; lane < 4; lane++) {
+      m_accumulators[lane] =
+          xxhRound(m_accumulators[lane], read32(input + 4 * lane));
+    }
+  }
+  std::memcpy(m_buffer, input, size);
+  m_buffered = size;
+}
+
+uint32_t Xxh32::digest() const {
+  uint32_t hash;
+  if (m_length >= sizeof(m_buffer)) {
+    hash = rotateLeft(m_accumulators[0], 1) + rotateLeft(m_accumulators[1], 7) +
+           rotateLeft(m_accumulators[2], 12) +
+           rotateLeft(m_accumulators[3], 18);
+  } else {
+    hash = m_accumulators[2] + prime5;
+  }
+  hash += static_cast<uint32_t>(m_length);
+  size_t position = 0;
+  for (; position + 4 <= m_buffered; position += 4) {
+    hash += read32(m_buffer + position) * prime3;
+    hash = rotateLeft(hash, 17) * prime4;
+  }
+  for (; position < m_buffered; position++) {
+    hash += m_buffer[position] * prime5;
+    hash = rotateLeft(hash, 11) * prime1;
+  }
+  hash ^= hash >> 15u;
+  hash *= prime2;
+  hash ^= hash >> 13u;
+  hash *= prime3;
+  hash ^= hash >> 16u;
+  return hash;
+}
+
+Lz4FrameSink::Lz4FrameSink(OutputSink &destination)
+    : m_destination(destination), m_hashTable(size_t(1) << hashLog, 0) {
+  m_window.reserve(2 * blockSize);
+  m_compressed.reserve(blockSize + blockSize / 255 + 16);
+}
+
+void Lz4FrameSink::writeHeader() {
+  std::string header;
+  append32(header, frameMagic);
+  const char descriptor[] = {char(frameFlags), char(blockDescriptor)};
+  header.append(descriptor, sizeof(descriptor));
+  Xxh32 headerChecksum;
+  headerChecksum.update(descriptor, sizeof(descriptor));
+  header.push_back(char((headerChecksum.digest() >> 8u) & 0xFFu));
+  m_destination.write(header.data(), header.size());
+  m_headerWritten = true;
+}
+
+void Lz4FrameSink::write(const char *data, size_t size) {
+  if (m_finished) {
+    throw std::runtime_error("LZ4 frame written to after it was finished");
+  }
+  if (!m_headerWritten) {
+    writeHeader();
+  }
+  m_checksum.update(data, size);
+  while (size > 0) {
+    const auto take =
+        std::min(size, blockSize - (m_window.size() - m_blockStart));
+    m_window.append(data, take);
+    data += take;
+    size -= take;
+    if (m_window.size() - m_blockStart == blockSize) {
+      compressBlock();
+    }
+  }
+}
+
+void Lz4FrameSink::compressBlock() {
+  const auto blockLength = m_window.size() - m_blockStart;
+  m_compressed.clear();
+  append32(m_compressed, 0);
+  compressSequences(m_window, m_blockStart, m_window.size(), m_hashTable,
+                    m_compressed);
+  auto compressedLength = m_compressed.size() - 4;
+  if (compressedLength >= blockLength) {
+    m_compressed.replace(4, std::string::npos, m_window, m_blockStart,
+                         blockLength);
+    compressedLength = blockLength | uncompressedBlockFlag;
+  }
+  for (size_t i = 0; i < 4; i++) {
+    m_compressed[i] = char((compressedLength >> (8 * i)) & 0xFFu);
+  }
+  m_destination.write(m_compressed.data(), m_compressed.size());
+
+  // Keep the last 64 KiB for the next block to refer back to
+  if (m_window.size() > maxOffset) {
+    const auto shift = m_window.size() - maxOffset;
+    m_window.erase(0, shift);
+    for (auto &position : m_hashTable) {
+      position = position >= shift ? static_cast<uint32_t>(position - shift)
+                                    : 0;
+    }
+  }
+  m_blockStart = m_window.size();
+}
+
+void Lz4FrameSink::finish() {
+  if (m_finished) {
+    return;
+  }
+  if (!m_headerWritten) {
+    writeHeader();
+  }
+  if (m_window.size() > m_blockStart) {
+    compressBlock();
+  }
+  std::string end;
+  append32(end, 0);
+  append32(end, m_checksum.digest());
+  m_destination.write(end.data(), end.size());
+  m_finished = true;
+}
+
+bool Lz4FrameDecoder::decodeHeader() {
+  const auto available = m_input.size() - m_inputPosition;
+  const char *header = m_input.data() + m_inputPosition;
+  if (available < 7) {
+    return false;
+  }
+  if (read32(header) != frameMagic) {
+    throwCorrupt("bad magic number");
+  }
+  const auto flags = static_cast<uint8_t>(header[4]);
+  if ((flags >> 6u) != 1 || (flags & 0x2u) != 0) {
+    throwCorrupt("unsupported version");
+  }
+  if ((flags & 0x1u) != 0) {
+    throw std::runtime_error("LZ4 frames with a dictionary are not supported");
+  }
+  const size_t headerSize = (flags & 0x8u) != 0 ? 15 : 7;
+  if (available < headerSize) {
+    return false;
+  }
+  Xxh32 headerChecksum;
+  headerChecksum.update(header + 4, headerSize - 5);
+  if (static_cast<uint8_t>(header[headerSize - 1]) !=
+      ((headerChecksum.digest() >> 8u) & 0xFFu)) {
+    throwCorrupt("header checksum mismatch");
+  }
+  m_blockChecksums = (flags & 0x10u) != 0;
+  m_contentChecksum = (flags & 0x4u) != 0;
+  m_blockMaxSize = blockMaxSizeOf(static_cast<uint8_t>(header[5]));
+  m_inputPosition += headerSize;
+  m_state = State::BLOCKS;
+  return true;
+}
+
+bool Lz4FrameDecoder::decodeBlock(std::string &output) {
+  const auto available = m_input.size() - m_inputPosition;
+  const char *block = m_input.data() + m_inputPosition;
+  if (available < 4) {
+    return false;
+  }
+  const auto blockHeader = read32(block);
+  if (blockHeader == 0) {
+    const size_t endSize = m_contentChecksum ? 8 : 4;
+    if (available < endSize) {
+      return false;
+    }
+    if (m_contentChecksum && read32(block + 4) != m_checksum.digest()) {
+      throwCorrupt("content checksum mismatch");
+    }
+    m_inputPosition += endSize;
+    m_state = State::FINISHED;
+    return true;
+  }
+  const size_t dataSize = blockHeader & ~uncompressedBlockFlag;
+  if (dataSize > m_blockMaxSize) {
+    throwCorrupt("block larger than its maximum size");
+  }
+  const size_t checksumSize = m_blockChecksums ? 4 : 0;
+  if (available < 4 + dataSize + checksumSize) {
+    return false;
+  }
+  const char *data = block + 4;
+  if (m_blockChecksums) {
+    Xxh32 blockChecksum;
+    blockChecksum.update(data, dataSize);
+    if (read32(data + dataSize) != blockChecksum.digest()) {
+      throwCorrupt("block checksum mismatch");
+    }
+  }
+  const auto blockStart = output.size();
+  if ((blockHeader & uncompressedBlockFlag) != 0) {
+    output.append(data, dataSize);
+  } else {
+    decompressBlock(reinterpret_cast<const unsigned char *>(data), dataSize,
+                    output, m_outputStart, m_blockMaxSize);
+  }
+  m_checksum.update(output.data() + blockStart, output.size() - blockStart);
+  m_inputPosition += 4 + dataSize + checksumSize;
+  return true;
+}
+
+void Lz4FrameDecoder::decode(const char *data, const size_t size,
+                             std::string &output) {
+  if (m_state == State::FINISHED) {
+    if (size > 0) {
+      throwCorrupt("data after the end of the frame");
+    }
+    return;
+  }
+  if (!m_outputStarted) {
+    m_outputStart = output.size();
+    m_outputStarted = true;
+  }
+  m_input.append(data, size);
+  bool progress = true;
+  while (progress && m_state != State::FINISHED) {
+    progress = m_state == State::HEADER ? decodeHeader() : decodeBlock(output);
+  }
+  if (m_state == State::FINISHED && m_inputPosition != m_input.size()) {
+    throwCorrupt("data after the end of the frame");
+  }
+  m_input.erase(0, m_inputPosition);
+  m_inputPosition = 0;
+}
+
+std::string lz4DecompressFrame(const char *data, const size_t size) {
+  Lz4FrameDecoder decoder;
+  std::string output;
+  decoder.decode(data, size, output);
+  if (!decoder.finished()) {
+    throwCorrupt("truncated");
+  }
+  return output;
+}
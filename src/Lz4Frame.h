@@ -0,0 +1,85 @@
+#pragma once
+
+#include "OutputSink.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The LZ4 frame format, so that oversized command messages can be compressed
+// as they are serialised. Frames are written with linked 64 KiB blocks and a
+// content checksum, and can be read back by the lz4 command line tool. The
+// decoder also reads frames written by the tool, apart from those which need
+// a dictionary.
+
+// 32 bit xxHash, the checksum of the frame format
+class Xxh32 {
+public:
+  void update(const char *data, size_t size);
+  uint32_t digest() const;
+
+private:
+  uint32_t m_accumulators[4] = {2654435761u + 2246822519u, 2246822519u, 0,
+                                0 - 2654435761u};
+  unsigned char m_buffer[16];
+  size_t m_buffered = 0;
+  uint64_t m_length = 0;
+};
+
+// Compresses everything written to it into one frame, which is passed on to
+// the destination a block at a time. finish() must be called once the
+// message is complete, nothing may be written after it.
+class Lz4FrameSink : public OutputSink {
+public:
+  explicit Lz4FrameSink(OutputSink &destination);
+
+  void write(const char *data, size_t size) override;
+  void finish();
+
+private:
+  void writeHeader();
+  void compressBlock();
+
+  OutputSink &m_destination;
+  // The end of the previous block, which matches may refer back into,
+  // followed by the block being filled from m_blockStart
+  std::string m_window;
+  size_t m_blockStart = 0;
+  // Position in m_window of the last four bytes seen with each hash
+  std::vector<uint32_t> m_hashTable;
+  std::string m_compressed;
+  Xxh32 m_checksum;
+  bool m_headerWritten = false;
+  bool m_finished = false;
+};
+
+// Decompresses a frame which arrives in parts of any size. Throws
+// std::runtime_error if the frame is malformed or its checksum is wrong.
+class Lz4FrameDecoder {
+public:
+  // Append what can be decompressed so far to output. Matches refer back
+  // into earlier output, so the same string must be passed every time.
+  void decode(const char *data, size_t size, std::string &output);
+  // The whole frame, including its checksum, has been decoded
+  bool finished() const { return m_state == State::FINISHED; }
+
+private:
+  enum class State { HEADER, BLOCKS, FINISHED };
+
+  bool decodeHeader();
+  bool decodeBlock(std::string &output);
+
+  State m_state = State::HEADER;
+  // Input not yet decoded, from m_inputPosition
+  std::string m_input;
+  size_t m_inputPosition = 0;
+  size_t m_blockMaxSize = 0;
+  bool m_blockChecksums = false;
+  bool m_contentChecksum = false;
+  // Where this frame's content starts in the output
+  size_t m_outputStart = 0;
+  bool m_outputStarted = false;
+  Xxh32 m_checksum;
+};
+
+// Decompress a whole frame
+std::string lz4DecompressFrame(const char *data, size_t size);
@@ -0,0 +1,225 @@
+#include "MessageJournal.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t recordMagic = 0x314a584e; // "NXJ1"
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t messageLength;
+  uint16_t jobIDLength;
+  uint8_t kind;
+  uint8_t unused;
+};
+
+size_t alignRecord(const size_t size) { return (size + 7) & ~size_t(7); }
+
+size_t recordSize(const size_t jobIDLength, const size_t messageLength) {
+  return alignRecord(sizeof(RecordHeader) + jobIDLength + messageLength);
+}
+
+std::string segmentPath(const std::string &directory, const size_t index) {
+  char name[40];
+  std::snprintf(name, sizeof(name), "journal-%06zu.seg", index);
+  return directory + "/" + name;
+}
+
+bool segmentExists(const std::string &directory, const size_t index) {
+  struct stat status;
+  return stat(segmentPath(directory, index).c_str(), &status) == 0;
+}
+
+[[noreturn]] void throwSystemError(const std::string &what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// Call function(header, jobID, message) for each complete record, returns the
+// offset of the end of the last one
+template <typename F>
+size_t forEachRecord(const char *data, const size_t size, F function) {
+  size_t offset = 0;
+  while (offset + sizeof(RecordHeader) <= size) {
+    RecordHeader header;
+    std::memcpy(&header, data + offset, sizeof(header));
+    if (header.magic != recordMagic) {
+      break;
+    }
+    const auto length = recordSize(header.jobIDLength, header.messageLength);
+    if (length > size - offset) {
+      break;
+    }
+    const char *jobID = data + offset + sizeof(RecordHeader);
+    function(header, StringRef(jobID, header.jobIDLength),
+             StringRef(jobID + header.jobIDLength, header.messageLength));
+    offset += length;
+  }
+  return offset;
+}
+}
+
+MessageJournalWriter::MessageJournalWriter(std::string directory,
+                                           const size_t segmentSize)
+    : m_directory(std::move(directory)), m_segmentSize(segmentSize) {
+  // Carry on from the end of the last segment
+  while (segmentExists(m_directory, m_segmentIndex + 1)) {
+    m_segmentIndex++;
+  }
+  openSegment(m_segmentIndex, 0);
+}
+
+MessageJournalWriter::~MessageJournalWriter() { closeSegment(); }
+
+void MessageJournalWriter::append(const StringRef jobID,
+                                  const JournalMessageKind kind,
+                                  const StringRef message) {
+  if (jobID.size() > UINT16_MAX || message.size() > UINT32_MAX) {
+    throw std::runtime_error("Message for job " + jobID.str() +
+                             " is too large for the journal");
+  }
+  const auto length = recordSize(jobID.size(), message.size());
+  if (length > m_mappedSize - m_used) {
+    closeSegment();
+    openSegment(m_segmentIndex + 1, length);
+  }
+  char *record = m_data + m_used;
+  RecordHeader header{0, static_cast<uint32_t>(message.size()),
+                      static_cast<uint16_t>(jobID.size()),
+                      static_cast<uint8_t>(kind), 0};
+  std::memcpy(record, &header, sizeof(header));
+  std::memcpy(record + sizeof(header), jobID.data(), jobID.size());
+  std::memcpy(record + sizeof(header) + jobID.size(), message.data(),
+              message.size());
+  // The record only becomes visible once it is complete
+  std::memcpy(record, &recordMagic, sizeof(recordMagic));
+  m_used += length;
+}
+
+void MessageJournalWriter::sync() {
+  if (m_data != nullptr && msync(m_data, m_used, MS_SYNC) != 0) {
+    throwSystemError("Could not sync " +
+                     segmentPath(m_directory, m_segmentIndex));
+  }
+}
+
+void MessageJournalWriter::openSegment(const size_t index,
+                                       const size_t minimumSize) {
+  const auto path = segmentPath(m_directory, index);
+  m_file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (m_file < 0) {
+    throwSystemError("Could not open " + path);
+  }
+  struct stat status;
+  if (fstat(m_file, &status) != 0) {
+    throwSystemError("Could not stat " + path);
+  }
+  const auto existingSize = static_cast<size_t>(status.st_size);
+  m_mappedSize = std::max(std::max(m_segmentSize, minimumSize), existingSize);
+  if (ftruncate(m_file, static_cast<off_t>(m_mappedSize)) != 0) {
+    throwSystemError("Could not extend " + path);
+  }
+  void *data = mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    m_file, 0);
+  if (data == MAP_FAILED) {
+    throwSystemError("Could not map " + path);
+  }
+  m_data = static_cast<char *>(data);
+  m_segmentIndex = index;
+  m_used = forEachRecord(m_data, existingSize,
+                         [](const RecordHeader &, StringRef, StringRef) {});
+}
+
+void MessageJournalWriter::closeSegment() {
+  if (m_data != nullptr) {
+    munmap(m_data, m_mappedSize);
+    m_data = nullptr;
+  }
+  if (m_file >= 0) {
+    // Drop the unused, zero filled tail
+    if (ftruncate(m_file, static_cast<off_t>(m_used)) != 0) {
+      // The tail reads as the end of the segment anyway
+    }
+    close(m_file);
+    m_file = -1;
+  }
+  m_mappedSize = 0;
+  m_used = 0;
+}
+
+MessageJournalReader::MessageJournalReader(const std::string &directory) {
+  for (size_t index = 0; segmentExists(directory, index); index++) {
+    const auto path = segmentPath(directory, index);
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+      throwSystemError("Could not open " + path);
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0) {
+      close(file);
+      throwSystemError("Could not stat " + path);
+    }
+    Segment segment{nullptr, static_cast<size_t>(status.st_size)};
+    if (segment.size > 0) {
+      void *data = mmap(nullptr, segment.size, PROT_READ, MAP_SHARED, file, 0);
+      if (data == MAP_FAILED) {
+        close(file);
+        throwSystemError("Could not map " + path);
+      }
+      segment.data = static_cast<const char *>(data);
+    }
+    close(file);
+    m_segments.push_back(segment);
+    indexSegment(segment);
+  }
+}
+
+MessageJournalReader::~MessageJournalReader() {
+  for (const auto &segment : m_segments) {
+    if (segment.data != nullptr) {
+      munmap(const_cast<char *>(segment.data), segment.size);
+    }
+  }
+}
+
+bool MessageJournalReader::find(const std::string &jobID,
+                                const JournalMessageKind kind,
+                                StringRef &message) const {
+  const auto messages = m_index.find(jobID);
+  if (messages == m_index.end()) {
+    return false;
+  }
+  if (kind == JournalMessageKind::START) {
+    message = messages->second.start;
+    return messages->second.hasStart;
+  }
+  message = messages->second.stop;
+  return messages->second.hasStop;
+}
+
+void MessageJournalReader::indexSegment(const Segment &segment) {
+  if (segment.data == nullptr) {
+    return;
+  }
+  forEachRecord(segment.data, segment.size,
+                [this](const RecordHeader &header, const StringRef jobID,
+                       const StringRef message) {
+                  auto &messages = m_index[jobID.str()];
+                  if (header.kind ==
+                      static_cast<uint8_t>(JournalMessageKind::START)) {
+                    messages.start = message;
+                    messages.hasStart = true;
+                  } else {
+                    messages.stop = message;
+                    messages.hasStop = true;
+                  }
+                  m_numberOfRecords++;
+                });
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "StringRef.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Append-only journal of command messages, kept in a directory as a sequence
+// of memory mapped segment files, journal-000000.seg, journal-000001.seg and
+// so on. Each record is
+//
+//   uint32_t magic, uint32_t message length, uint16_t job ID length,
+//   uint8_t kind, uint8_t unused, job ID, message, padding to 8 bytes
+//
+// in native byte order. The magic is stored last, so a record which was only
+// partly written when the process stopped reads as the end of the segment.
+// POSIX only.
+
+enum class JournalMessageKind : uint8_t { START = 0, STOP = 1 };
+
+class MessageJournalWriter {
+public:
+  // Appends to the journal in the directory, which must exist. A new segment
+  // is started when a record does not fit in the current one.
+  explicit MessageJournalWriter(std::string directory,
+                                size_t segmentSize = 64 * 1024 * 1024);
+  // Truncates the last segment to the records in it
+  ~MessageJournalWriter();
+
+  MessageJournalWriter(const MessageJournalWriter &) = delete;
+  MessageJournalWriter &operator=(const MessageJournalWriter &) = delete;
+
+  void append(StringRef jobID, JournalMessageKind kind, StringRef message);
+
+  // Flush the mapped pages of the current segment to the file
+  void sync();
+
+private:
+  void openSegment(size_t index, size_t minimumSize);
+  void closeSegment();
+
+  const std::string m_directory;
+  const size_t m_segmentSize;
+  size_t m_segmentIndex = 0;
+  int m_file = -1;
+  char *m_data = nullptr;
+  size_t m_mappedSize = 0;
+  size_t m_used = 0;
+};
+
+// Maps every segment of a journal read-only and indexes the records by job
+// ID. Messages are returned as views into the mappings, they are valid for
+// the lifetime of the reader. A job ID which was journalled more than once
+// refers to its latest message of each kind.
+class MessageJournalReader {
+public:
+  explicit MessageJournalReader(const std::string &directory);
+  ~MessageJournalReader();
+
+  MessageJournalReader(const MessageJournalReader &) = delete;
+  MessageJournalReader &operator=(const MessageJournalReader &) = delete;
+
+  // Returns false if the journal has no such message
+  bool find(const std::string &jobID, JournalMessageKind kind,
+            StringRef &message) const;
+
+  size_t numberOfRecords() const { return m_numberOfRecords; }
+  size_t numberOfSegments() const { return m_segments.size(); }
+
+private:
+  struct Segment {
+    const char *data;
+    size_t size;
+  };
+  struct Messages {
+    StringRef start{"", 0};
+    StringRef stop{"", 0};
+    bool hasStart = false;
+    bool hasStop = false;
+  };
+
+  void indexSegment(const Segment &segment);
+
+  std::vector<Segment> m_segments;
+  std::unordered_map<std::string, Messages> m_index;
+  size_t m_numberOfRecords = 0;
+};
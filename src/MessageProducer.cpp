@@ -0,0 +1,45 @@
+#include "MessageProducer.h"
+#include <stdexcept>
+
+DirectoryProducer::DirectoryProducer(std::string directory,
+                                     const Framing framing)
+    : m_directory(std::move(directory)), m_framing(framing) {}
+
+void DirectoryProducer::produce(const std::vector<PublishedMessage> &batch) {
+  for (const auto &message : batch) {
+    auto &file = topicFile(message.topic);
+    const auto size = message.payload.size();
+    if (m_framing == Framing::LENGTH_PREFIXED) {
+      const char length[] = {char(size & 0xFFu), char((size >> 8u) & 0xFFu),
+                             char((size >> 16u) & 0xFFu),
+                             char((size >> 24u) & 0xFFu)};
+      file.write(length, sizeof(length));
+    }
+    file.write(message.payload.data(), static_cast<std::streamsize>(size));
+    if (m_framing == Framing::LINES) {
+      file.put('\n');
+    }
+  }
+  // A batch is only delivered once it is all in the files
+  for (const auto &topicFile : m_topicFiles) {
+    topicFile.second->flush();
+    if (!*topicFile.second) {
+      throw std::runtime_error("Could not write to topic " + topicFile.first +
+                               " in " + m_directory);
+    }
+  }
+}
+
+std::ofstream &DirectoryProducer::topicFile(const std::string &topic) {
+  auto &file = m_topicFiles[topic];
+  if (!file) {
+    const auto path = m_directory + "/" + topic +
+                      (m_framing == Framing::LINES ? ".jsonl" : ".bin");
+    file.reset(new std::ofstream(path, std::ios::app | std::ios::binary));
+    if (!*file) {
+      m_topicFiles.erase(topic);
+      throw std::runtime_error("Could not open " + path);
+    }
+  }
+  return *file;
+}
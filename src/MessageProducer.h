@@ -0,0 +1,48 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct PublishedMessage {
+  std::string topic;
+  std::string payload;
+};
+
+// Delivers serialised command messages, for example to Kafka
+class MessageProducer {
+public:
+  virtual ~MessageProducer() = default;
+
+  // Deliver a batch of messages in order. Throws std::runtime_error if they
+  // could not all be delivered.
+  virtual void produce(const std::vector<PublishedMessage> &batch) = 0;
+};
+
+// Offline stand-in for a broker. Each topic is a file in the directory which
+// messages are appended to. The directory must already exist.
+class DirectoryProducer : public MessageProducer {
+public:
+  enum class Framing {
+    // <topic>.jsonl with a message per line, so the payloads must be compact
+    // JSON
+    LINES,
+    // <topic>.bin with each message after its length as a 4 byte little
+    // endian number, for binary payloads such as f142
+    LENGTH_PREFIXED
+  };
+
+  explicit DirectoryProducer(std::string directory,
+                             Framing framing = Framing::LINES);
+
+  void produce(const std::vector<PublishedMessage> &batch) override;
+
+private:
+  std::ofstream &topicFile(const std::string &topic);
+
+  const std::string m_directory;
+  const Framing m_framing;
+  std::unordered_map<std::string, std::unique_ptr<std::ofstream>> m_topicFiles;
+};
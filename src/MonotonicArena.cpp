@@ -0,0 +1,65 @@
+#include "MonotonicArena.h"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+thread_local MonotonicArena *currentArena = nullptr;
+
+// Blocks double in size up to this limit
+const size_t maximumBlockSize = 1024 * 1024;
+}
+
+MonotonicArena::MonotonicArena(const size_t initialBlockSize)
+    : m_nextBlockSize(initialBlockSize) {}
+
+MonotonicArena::MonotonicArena(MonotonicArena &&other) noexcept
+    : m_blocks(std::move(other.m_blocks)),
+      m_position(other.m_position),
+      m_remaining(other.m_remaining),
+      m_nextBlockSize(other.m_nextBlockSize),
+      m_bytesAllocated(other.m_bytesAllocated) {
+  other.m_position = nullptr;
+  other.m_remaining = 0;
+  other.m_bytesAllocated = 0;
+}
+
+void *MonotonicArena::allocate(const size_t size, const size_t alignment) {
+  auto padding =
+      (alignment - reinterpret_cast<uintptr_t>(m_position) % alignment) %
+      alignment;
+  if (m_position == nullptr || padding + size > m_remaining) {
+    addBlock(size + alignment);
+    padding =
+        (alignment - reinterpret_cast<uintptr_t>(m_position) % alignment) %
+        alignment;
+  }
+  auto *allocation = m_position + padding;
+  m_position += padding + size;
+  m_remaining -= padding + size;
+  m_bytesAllocated += size;
+  return allocation;
+}
+
+void MonotonicArena::addBlock(const size_t minimumSize) {
+  const auto blockSize = std::max(m_nextBlockSize, minimumSize);
+  m_blocks.emplace_back(new char[blockSize]);
+  m_position = m_blocks.back().get();
+  m_remaining = blockSize;
+  m_nextBlockSize = std::min(m_nextBlockSize * 2, maximumBlockSize);
+}
+
+MonotonicArena &MonotonicArena::current() {
+  if (currentArena == nullptr) {
+    throw std::runtime_error(
+        "Arena allocation made outside of an ArenaScope");
+  }
+  return *currentArena;
+}
+
+ArenaScope::ArenaScope(MonotonicArena &arena) : m_previousArena(currentArena) {
+  currentArena = &arena;
+}
+
+ArenaScope::~ArenaScope() { currentArena = m_previousArena; }
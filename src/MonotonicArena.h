@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Hands out memory from a list of large blocks. Individual allocations are
+// never freed, everything is released at once when the arena is destroyed.
+class MonotonicArena {
+public:
+  explicit MonotonicArena(size_t initialBlockSize = 16 * 1024);
+
+  MonotonicArena(const MonotonicArena &) = delete;
+  MonotonicArena &operator=(const MonotonicArena &) = delete;
+  MonotonicArena(MonotonicArena &&other) noexcept;
+
+  void *allocate(size_t size, size_t alignment);
+
+  size_t bytesAllocated() const { return m_bytesAllocated; }
+  size_t numberOfBlocks() const { return m_blocks.size(); }
+
+  // The arena of the innermost ArenaScope on the calling thread, throws if
+  // there is none
+  static MonotonicArena &current();
+
+private:
+  void addBlock(size_t minimumSize);
+
+  std::vector<std::unique_ptr<char[]>> m_blocks;
+  char *m_position = nullptr;
+  size_t m_remaining = 0;
+  size_t m_nextBlockSize;
+  size_t m_bytesAllocated = 0;
+};
+
+// Makes an arena the destination for ArenaAllocator allocations made on this
+// thread for the lifetime of the scope. Scopes can be nested.
+class ArenaScope {
+public:
+  explicit ArenaScope(MonotonicArena &arena);
+  ~ArenaScope();
+
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  MonotonicArena *m_previousArena;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The NeXus type of a dataset holding values of type T, which is written as
+// the type of its dataset member. Only the types the file writer supports
+// have one, so a dataset of any other type fails to compile rather than
+// being labelled with the wrong type.
+template <typename T> struct NexusType;
+
+template <> struct NexusType<int32_t> {
+  static constexpr const char *name() { return "int32"; }
+};
+
+template <> struct NexusType<uint32_t> {
+  static constexpr const char *name() { return "uint32"; }
+};
+
+template <> struct NexusType<int64_t> {
+  static constexpr const char *name() { return "int64"; }
+};
+
+template <> struct NexusType<uint64_t> {
+  static constexpr const char *name() { return "uint64"; }
+};
+
+template <> struct NexusType<float> {
+  static constexpr const char *name() { return "float"; }
+};
+
+template <> struct NexusType<double> {
+  static constexpr const char *name() { return "double"; }
+};
+
+template <> struct NexusType<std::string> {
+  static constexpr const char *name() { return "string"; }
+};
+
+// An array dataset has the type of its elements
+template <typename T> struct NexusType<std::vector<T>> : NexusType<T> {};
+
+template <typename T> constexpr const char *nexusTypeName() {
+  return NexusType<T>::name();
+}
@@ -1,33 +1,101 @@
 #include "NexusWriteCommandBuilder.h"
-#include <ctime>
-#include <iomanip>
+#include "Iso8601.h"
+#include "RawJson.h"
+#include "StagingQueue.h"
+#include "StartMessageDelta.h"
+#include <cstring>
 
-using json = nlohmann::json;
+using json = BuilderJson;
 
 namespace {
 
-std::vector<std::string> split(const std::string &s, char delimiter) {
-  std::vector<std::string> tokens;
-  std::string token;
-  std::istringstream tokenStream(s);
-  while (std::getline(tokenStream, token, delimiter)) {
-    tokens.push_back(token);
+// Groups, datasets and streams in the node, for BuildStats
+uint64_t countNodes(const json &node) {
+  uint64_t nodes = 1;
+  const auto children = node.find("children");
+  if (children != node.end()) {
+    for (const auto &child : *children) {
+      nodes += countNodes(child);
+    }
+  }
+  return nodes;
+}
+
+// Held while a message is serialised, so that adding to any of the staging
+// queues at the same time throws rather than racing with the serialisation
+std::vector<StagingQueue::UseScope> useStagingQueues(
+    const std::vector<std::shared_ptr<const StagingQueue>> &queues) {
+  std::vector<StagingQueue::UseScope> uses;
+  uses.reserve(queues.size());
+  for (const auto &queue : queues) {
+    uses.emplace_back(*queue);
+  }
+  return uses;
+}
+
+// The sources of a loaded selog group, or null unless the group is exactly
+// as SELogSources would write it, so that writing them out gives the same
+// bytes as were read
+std::shared_ptr<SELogSources> loadSELogSources(const StringRef node,
+                                               const RawNodeParts &parts,
+                                               std::string topic,
+                                               std::string selogPath) {
+  auto seLogSources =
+      std::make_shared<SELogSources>(std::move(topic), std::move(selogPath));
+  try {
+    std::vector<StringRef> pVs;
+    forEachRawElement(parts.children, [&](const StringRef child) {
+      StringRef stream("", 0);
+      StringRef source("", 0);
+      if (!findRawMember(child, "stream", stream) ||
+          !findRawMember(stream, "source", source)) {
+        throw std::runtime_error("Not an SE log stream");
+      }
+      pVs.push_back(rawString(source));
+    });
+    seLogSources->add(pVs.data(), pVs.size());
+  } catch (const std::runtime_error &) {
+    return nullptr;
+  }
+  std::string written;
+  JsonWriter writer(written, JsonWriter::COMPACT);
+  seLogSources->write(writer);
+  if (StringRef(written.data(), written.size()) != node) {
+    return nullptr;
   }
-  return tokens;
+  return seLogSources;
 }
 
-uint64_t iso8601ToUnixTimeMilliseconds(const std::string &timeIso8601) {
-  std::tm tmb = {};
-  std::istringstream ss(timeIso8601);
-  ss >> std::get_time(&tmb, "%Y-%m-%dT%H:%M:%S");
-#if (defined(_MSC_VER))
-#define timegm _mkgmtime
-#endif
-  auto timeUnix = timegm(&tmb);
-  return static_cast<uint64_t>(timeUnix * 1000);
+StringRef nodeName(const json &node) {
+  const auto name = node.find("name");
+  if (name == node.end() || !name->is_string()) {
+    return {"", 0};
+  }
+  const auto &nameStr = name->get_ref<const ArenaString &>();
+  return {nameStr.data(), nameStr.size()};
 }
 
-const std::string entryGroupName = "raw_data_1";
+// Charge a deferred child of the entry to the section it is part of
+void enterSection(BuildStatsRecorder::SectionScope &section,
+                  const DeferredNode &node) {
+  if (dynamic_cast<const SELogSources *>(&node) != nullptr) {
+    section.enter(BuildSection::SELOG);
+  } else if (dynamic_cast<const PeriodsNode *>(&node) != nullptr) {
+    section.enter(BuildSection::PERIODS);
+  } else if (dynamic_cast<const MonitorRangeNode *>(&node) != nullptr) {
+    section.enter(BuildSection::MONITORS);
+  } else if (dynamic_cast<const SpectrumMapNode *>(&node) != nullptr) {
+    section.enter(BuildSection::DETECTORS);
+  } else if (const auto *raw = dynamic_cast<const RawJsonNode *>(&node)) {
+    section.enterNode(raw->name());
+  } else if (const auto *preSerialised =
+                 dynamic_cast<const PreSerialisedNode *>(&node)) {
+    const auto name = preSerialised->node().find("name");
+    if (name != preSerialised->node().end() && name->is_string()) {
+      section.enterNode(name->get_ref<const std::string &>());
+    }
+  }
+}
 }
 
 NexusWriteCommandBuilder::NexusWriteCommandBuilder(
@@ -37,7 +105,10 @@ NexusWriteCommandBuilder::NexusWriteCommandBuilder(
     : m_jobID(instrumentName + "_" + std::to_string(runNumber)),
       m_instrumentName(instrumentName), m_broker(broker),
       m_filename(instrumentName + "_" + std::to_string(runNumber) + ".nxs"),
-      m_startTimeIso8601(startTimeIso8601) {
+      m_startTimeIso8601(startTimeIso8601),
+      m_startTimeUnixMilliseconds(
+          iso8601ToUnixTimeMilliseconds(startTimeIso8601)) {
+  ArenaScope scope(m_arena);
   initEntryGroupJson();
   initIsisVmsCompat();
   initRunlog();
@@ -45,137 +116,421 @@ NexusWriteCommandBuilder::NexusWriteCommandBuilder(
   addRunCycle(runCycle);
   addRunNumber(runNumber);
   addInstrument(instrumentName);
+  m_trailingEntryChildren = {
+      std::make_shared<PreSerialisedNode>(convertJson<nlohmann::json>(
+          createInstrumentNameJson(m_instrumentName))),
+      std::make_shared<PreSerialisedNode>(convertJson<nlohmann::json>(
+          createBeamlineJson(m_instrumentName)))};
+}
+
+NexusWriteCommandBuilder::NexusWriteCommandBuilder(
+    std::shared_ptr<const InstrumentSkeleton> skeleton, const int32_t runNumber,
+    const std::string &broker, const std::string &runCycle,
+    const std::string &startTimeIso8601)
+    : m_jobID(skeleton->instrumentName() + "_" + std::to_string(runNumber)),
+      m_instrumentName(skeleton->instrumentName()), m_broker(broker),
+      m_filename(skeleton->instrumentName() + "_" + std::to_string(runNumber) +
+                 ".nxs"),
+      m_startTimeIso8601(startTimeIso8601),
+      m_startTimeUnixMilliseconds(
+          iso8601ToUnixTimeMilliseconds(startTimeIso8601)),
+      m_skeleton(std::move(skeleton)),
+      m_trailingEntryChildren(m_skeleton->trailingEntryChildren()) {
+  ArenaScope scope(m_arena);
+  initEntryGroupJson();
+  m_isisVmsCompatJson = convertJson<json>(m_skeleton->isisVmsCompatJson());
+  indexGroup(isisVmsCompatPath, m_isisVmsCompatJson);
+  m_runlogJson = convertJson<json>(m_skeleton->runlogJson());
+  indexGroup(runlogPath, m_runlogJson);
+  m_framelogJson = convertJson<json>(m_skeleton->framelogJson());
+  indexGroup(framelogPath, m_framelogJson);
+  addRunCycle(runCycle);
+  addRunNumber(runNumber);
+  for (const auto &node : m_skeleton->entryChildren()) {
+    addDeferredNode(entryGroupPath, node);
+  }
+}
+
+std::shared_ptr<const InstrumentSkeleton>
+NexusWriteCommandBuilder::createInstrumentSkeleton(
+    const InstrumentConfig &config) {
+  // Build the static groups with an ordinary builder, they are the instrument
+  // group, which the constructor adds last, and everything added after it
+  // The run details are placeholders, none of them are part of the skeleton
+  NexusWriteCommandBuilder builder(config.instrumentName, 0, "", "",
+                                   "1970-01-01T00:00:00");
+  ArenaScope scope(builder.m_arena);
+  auto &entryChildren = builder.groupChildren(entryGroupPath);
+  const auto firstStaticChild = entryChildren.size() - 1;
+
+  for (const auto &detector : config.detectors) {
+    builder.addDetector(detector.detectorNumber,
+                        detector.sourceDetectorDistance);
+  }
+  for (const auto &monitor : config.monitors) {
+    builder.addMonitor(monitor.monitorNumber, monitor.spectrumIndex);
+  }
+  if (!config.seLogPVs.empty()) {
+    builder.addSELogSources(config.seLogPVs);
+  }
+
+  // The skeleton outlives the builder's arena, so its nodes are copied out
+  std::vector<std::shared_ptr<const DeferredNode>> staticChildren;
+  for (auto i = firstStaticChild; i < entryChildren.size(); i++) {
+    staticChildren.push_back(std::make_shared<PreSerialisedNode>(
+        convertJson<nlohmann::json>(entryChildren[i])));
+  }
+  // The selog group is deferred and added last, so it follows the others
+  if (builder.m_seLogSources) {
+    staticChildren.push_back(
+        std::make_shared<PreSerialisedNode>(builder.m_seLogSources->toJson()));
+  }
+
+  return std::make_shared<InstrumentSkeleton>(
+      config.instrumentName, std::move(staticChildren),
+      builder.m_trailingEntryChildren,
+      convertJson<nlohmann::json>(builder.m_isisVmsCompatJson),
+      convertJson<nlohmann::json>(builder.m_runlogJson),
+      convertJson<nlohmann::json>(builder.m_framelogJson));
+}
+
+NexusWriteCommandBuilder
+NexusWriteCommandBuilder::fromStartMessage(std::string startMessage) {
+  // The loaded nodes are written with JsonWriter::rawValue, which takes
+  // compact JSON
+  compactJson(startMessage);
+  const auto document =
+      std::make_shared<const std::string>(std::move(startMessage));
+  const auto parse = [](const StringRef value) {
+    return nlohmann::json::parse(value.data(), value.data() + value.size());
+  };
+  std::string cmd;
+  std::string jobID;
+  std::string broker;
+  std::string filename;
+  int64_t startTime = 0;
+  StringRef nexusStructure("", 0);
+  forEachRawMember(*document, [&](const StringRef key, const StringRef value) {
+    if (key == "cmd") {
+      cmd = parse(value).get<std::string>();
+    } else if (key == "job_id") {
+      jobID = parse(value).get<std::string>();
+    } else if (key == "broker") {
+      broker = parse(value).get<std::string>();
+    } else if (key == "file_attributes") {
+      filename = parse(value).at("file_name").get<std::string>();
+    } else if (key == "start_time") {
+      startTime = parse(value).get<int64_t>();
+    } else if (key == "nexus_structure") {
+      nexusStructure = value;
+    }
+  });
+  if (cmd != "FileWriter_new") {
+    throw std::runtime_error("Not a FileWriter_new start message");
+  }
+
+  StringRef children("", 0);
+  RawNodeParts entry;
+  if (!nexusStructure.empty() &&
+      findRawMember(nexusStructure, "children", children)) {
+    forEachRawElement(children, [&](const StringRef child) {
+      if (entry.children.empty()) {
+        auto parts = splitRawNode(child);
+        if (parts.name == entryGroupName) {
+          entry = std::move(parts);
+        }
+      }
+    });
+  }
+  if (entry.children.empty()) {
+    throw std::runtime_error("Start message has no " + entryGroupName +
+                             " group");
+  }
+
+  NexusWriteCommandBuilder builder(std::move(jobID), std::move(broker),
+                                   std::move(filename), startTime);
+  builder.loadEntry(document, entry);
+  return builder;
+}
+
+NexusWriteCommandBuilder::NexusWriteCommandBuilder(
+    std::string jobID, std::string broker, std::string filename,
+    const int64_t startTimeUnixMilliseconds)
+    : m_jobID(std::move(jobID)),
+      m_instrumentName(m_jobID.substr(0, m_jobID.rfind('_'))),
+      m_broker(std::move(broker)), m_filename(std::move(filename)),
+      m_startTimeUnixMilliseconds(startTimeUnixMilliseconds) {}
+
+void NexusWriteCommandBuilder::loadEntry(
+    const std::shared_ptr<const std::string> &document,
+    const RawNodeParts &entry) {
+  ArenaScope scope(m_arena);
+  openGroup(entryGroupPath, m_entryGroupJson, entry);
+  forEachRawElement(entry.children, [&](const StringRef child) {
+    const auto parts = splitRawNode(child);
+    const auto &name = parts.name;
+    if (name == "isis_vms_compat") {
+      loadGroup(isisVmsCompatPath, m_isisVmsCompatJson, document, parts);
+    } else if (name == "runlog") {
+      loadGroup(runlogPath, m_runlogJson, document, parts);
+    } else if (name == "framelog") {
+      loadGroup(framelogPath, m_framelogJson, document, parts);
+    } else if (name == "selog" && !m_seLogSources) {
+      // Parsed so that PVs can be added to it, unless it was not written by
+      // a builder, in which case it is kept as it was read and cannot be
+      m_seLogSources =
+          loadSELogSources(child, parts, m_instrumentName + "_sampleEnv",
+                           "/" + entryGroupName + "/selog");
+      if (m_seLogSources) {
+        m_seLogSources->keepWhenEmpty();
+        addDeferredNode(entryGroupPath, m_seLogSources);
+      } else {
+        addLoadedNode(entryGroupPath, document, child, name);
+      }
+    } else if (name == "instrument") {
+      // Opened so that detectors can be added to it
+      auto &siblings = groupChildren(entryGroupPath);
+      siblings.push_back(nullptr);
+      loadGroup(instrumentPath, siblings.back(), document, parts);
+    } else {
+      if (name.size() > 5 && std::memcmp(name.data(), "user_", 5) == 0) {
+        m_numberOfUsers++;
+      }
+      addLoadedNode(entryGroupPath, document, child, name);
+    }
+  });
+  if (m_isisVmsCompatJson.is_null()) {
+    initIsisVmsCompat();
+  }
+  if (m_runlogJson.is_null()) {
+    initRunlog();
+  }
+  if (m_framelogJson.is_null()) {
+    initFramelog();
+  }
+}
+
+void NexusWriteCommandBuilder::openGroup(const std::string &groupPath,
+                                         json &group,
+                                         const RawNodeParts &node) {
+  auto members = nlohmann::json::object();
+  members["name"] = node.name.str();
+  for (const auto &member : node.otherMembers) {
+    const auto &value = member.second;
+    members[member.first.str()] =
+        nlohmann::json::parse(value.data(), value.data() + value.size());
+  }
+  group = convertJson<json>(members);
+  group["children"] = json::array();
+  indexGroup(groupPath, group);
+}
+
+void NexusWriteCommandBuilder::loadGroup(
+    const std::string &groupPath, json &group,
+    const std::shared_ptr<const std::string> &document,
+    const RawNodeParts &node) {
+  openGroup(groupPath, group, node);
+  if (!node.children.empty()) {
+    forEachRawElement(node.children, [&](const StringRef child) {
+      addLoadedNode(groupPath, document, child, rawNodeName(child));
+    });
+  }
+}
+
+void NexusWriteCommandBuilder::addLoadedNode(
+    const std::string &parentPath,
+    const std::shared_ptr<const std::string> &document, const StringRef node,
+    const StringRef name) {
+  auto loadedNode = std::make_shared<RawJsonNode>(document, node, name);
+  if (!name.empty()) {
+    m_loadedNodes[parentPath + "/" + name.str()] = loadedNode;
+  }
+  addDeferredNode(parentPath, std::move(loadedNode));
+}
+
+void NexusWriteCommandBuilder::replaceLoadedNode(const std::string &parentPath,
+                                                 const StringRef name) {
+  const auto node = m_loadedNodes.find(parentPath + "/" + name.str());
+  if (node != m_loadedNodes.end()) {
+    node->second->remove();
+    m_loadedNodes.erase(node);
+  }
 }
 
 void NexusWriteCommandBuilder::addStartTime() {
-  auto dataset =
-      createDataset<std::string>("start_time", "string", m_startTimeIso8601,
-                                 {Attribute{"units", "ISO8601"}});
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  auto dataset = createDataset<std::string>(
+      "start_time", m_startTimeIso8601, {Attribute{"units", "ISO8601"}});
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addEndTime(const std::string &endTimeIso8601) {
-  auto dataset = createDataset<std::string>(
-      "end_time", "string", endTimeIso8601, {Attribute{"units", "ISO8601"}});
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<std::string>("end_time", endTimeIso8601,
+                                            {Attribute{"units", "ISO8601"}});
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addTitle(const std::string &title) {
-  auto dataset = createDataset<std::string>("title", "string", title);
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<std::string>("title", title);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addTotalCounts(const uint64_t totalCounts) {
-  auto dataset = createDataset<uint64_t>("total_counts", "uint64", totalCounts);
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<uint64_t>("total_counts", totalCounts);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addMonitorEventsNotSaved(
     const int64_t monitorEventsNotSaved) {
-  auto dataset = createDataset<int64_t>("monitor_events_not_saved", "int64",
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<int64_t>("monitor_events_not_saved",
                                         monitorEventsNotSaved);
-  m_entryGroupJson["children"].push_back(dataset);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addTotalUncountedCounts(
     const int32_t uncountedCounts) {
-  auto dataset = createDataset<int32_t>("total_uncounted_counts", "int32",
-                                        uncountedCounts);
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset =
+      createDataset<int32_t>("total_uncounted_counts", uncountedCounts);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addRunNumber(const int32_t runNumber) {
-  auto dataset = createDataset<int32_t>("run_number", "int32", runNumber);
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  auto dataset = createDataset<int32_t>("run_number", runNumber);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addSeciConfig(const std::string &SeciConfig) {
-  auto dataset =
-      createDataset<std::string>("seci_config", "string", SeciConfig);
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<std::string>("seci_config", SeciConfig);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addProgramName(const std::string &programName,
                                               const std::string &version) {
-  auto dataset = createDataset<std::string>(
-      "program_name", "string", programName, {{"version", version}});
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<std::string>("program_name", programName,
+                                            {{"version", version}});
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addNexusDefinition(const std::string &name,
                                                   const std::string &version,
                                                   const std::string &url) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
   auto dataset = createDataset<std::string>(
-      "definition", "string", name, {{"version", version}, {"url", url}});
-  m_entryGroupJson["children"].push_back(dataset);
+      "definition", name, {{"version", version}, {"url", url}});
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addLocalNexusDefinition(
     const std::string &name, const std::string &version,
     const std::string &url) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
   auto dataset = createDataset<std::string>(
-      "definition_local", "string", name, {{"version", version}, {"url", url}});
-  m_entryGroupJson["children"].push_back(dataset);
+      "definition_local", name, {{"version", version}, {"url", url}});
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addNotes(const std::string &notes) {
-  auto dataset = createDataset<std::string>("notes", "string", notes);
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<std::string>("notes", notes);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addProtonChargeRawInMicroAmpHours(
     float protonCharge) {
-  auto dataset = createDataset<float>("proton_charge_raw", "float",
-                                      protonCharge, {{"units", "uAh"}});
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<float>("proton_charge_raw", protonCharge,
+                                      {{"units", "uAh"}});
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addProtonChargeInMicroAmpHours(
     float protonCharge) {
-  auto dataset = createDataset<float>("proton_charge", "float", protonCharge,
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<float>("proton_charge", protonCharge,
                                       {{"units", "uAh"}});
-  m_entryGroupJson["children"].push_back(dataset);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addCollectionTime(
     float collectionTimeInSeconds) {
-  auto dataset =
-      createDataset<float>("collection_time", "float", collectionTimeInSeconds,
-                           {{"units", "second"}});
-  m_entryGroupJson["children"].push_back(dataset);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<float>(
+      "collection_time", collectionTimeInSeconds, {{"units", "second"}});
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addDuration(float durationInSeconds) {
-  auto dataset = createDataset<float>("duration", "float", durationInSeconds,
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  auto dataset = createDataset<float>("duration", durationInSeconds,
                                       {{"units", "second"}});
-  m_entryGroupJson["children"].push_back(dataset);
+  addNode(entryGroupPath, std::move(dataset));
 }
 
 void NexusWriteCommandBuilder::addUser(const std::string &name,
                                        const std::string &affiliation) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
   m_numberOfUsers++;
   auto userGroup = createGroup("user_" + std::to_string(m_numberOfUsers),
                                {{"NX_class", "NXuser"}});
-  userGroup["children"].push_back(createDataset("name", "string", name));
-  userGroup["children"].push_back(
-      createDataset("affiliation", "string", affiliation));
+  reserveArray(userGroup["children"], 2);
+  userGroup["children"].push_back(createDataset("name", name));
+  userGroup["children"].push_back(createDataset("affiliation", affiliation));
 
-  m_entryGroupJson["children"].push_back(userGroup);
+  addGroup(entryGroupPath, std::move(userGroup));
 }
 
 void NexusWriteCommandBuilder::addDetector(uint32_t detectorNumber,
                                            float sourceDetectorDistance) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::DETECTORS);
+  checkNotFromSkeleton("detectors");
+  ArenaScope scope(m_arena);
   auto detectorGroup = createGroup("detector_" + std::to_string(detectorNumber),
                                    {{"NX_class", "NXdetector"}});
-  detectorGroup["children"].push_back(createDataset<float>(
-      "source_detector_distance", "float", sourceDetectorDistance));
+  detectorGroup["children"].push_back(
+      createDataset<float>("source_detector_distance", sourceDetectorDistance));
   detectorGroup["children"].push_back(createGroup("period_index"));
 
-  for (auto &node : m_entryGroupJson["children"]) {
-    if (node["name"] == "instrument") {
-      node["children"].push_back(detectorGroup);
-    }
+  addGroup(instrumentPath, std::move(detectorGroup));
+}
+
+void NexusWriteCommandBuilder::addDetector(const uint32_t detectorNumber,
+                                           const float sourceDetectorDistance,
+                                           SpectrumMap spectrumMap) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::DETECTORS);
+  addDetector(detectorNumber, sourceDetectorDistance);
+  const auto detectorPath =
+      instrumentPath + "/detector_" + std::to_string(detectorNumber);
+  const auto sharedMap =
+      std::make_shared<const SpectrumMap>(std::move(spectrumMap));
+  for (const auto column : {SpectrumMapNode::Column::DETECTOR_NUMBER,
+                            SpectrumMapNode::Column::SPECTRUM_INDEX}) {
+    addDeferredNode(detectorPath,
+                    std::make_shared<SpectrumMapNode>(sharedMap, column));
   }
+  BuildStatsRecorder::addNodes(2);
 }
 
 void NexusWriteCommandBuilder::addMeasurement(const std::string &label,
@@ -183,67 +538,125 @@ void NexusWriteCommandBuilder::addMeasurement(const std::string &label,
                                               const std::string &subId,
                                               const std::string &type,
                                               int32_t firstRun) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
   auto measurementGroup =
       createGroup("measurement", {{"NX_class", "NXcollection"}});
+  measurementGroup["children"].push_back(createDataset<std::string>("id", id));
   measurementGroup["children"].push_back(
-      createDataset<std::string>("id", "string", id));
-  measurementGroup["children"].push_back(
-      createDataset<std::string>("subid", "string", subId));
+      createDataset<std::string>("subid", subId));
   measurementGroup["children"].push_back(
-      createDataset<std::string>("type", "string", type));
+      createDataset<std::string>("type", type));
   measurementGroup["children"].push_back(
-      createDataset<std::string>("label", "string", label));
+      createDataset<std::string>("label", label));
   measurementGroup["children"].push_back(
-      createDataset<int32_t>("first_run", "int32", firstRun));
-
-  m_entryGroupJson["children"].push_back(measurementGroup);
-  m_entryGroupJson["children"].push_back(
-      createDataset<std::string>("measurement_label", "string", label));
-  m_entryGroupJson["children"].push_back(
-      createDataset<std::string>("measurement_id", "string", id));
-  m_entryGroupJson["children"].push_back(
-      createDataset<std::string>("measurement_subid", "string", subId));
-  m_entryGroupJson["children"].push_back(
-      createDataset<std::string>("measurement_type", "string", type));
-  m_entryGroupJson["children"].push_back(
-      createDataset<int32_t>("measurement_first_run", "int32", firstRun));
-}
-
-json NexusWriteCommandBuilder::createStream(const std::string &module,
-                                            const std::string &nexusPath,
-                                            const std::string &source,
-                                            const std::string &topic) const {
-  json stream = {{"type", "stream"}};
-  stream["stream"] = {{"writer_module", module},
-                      {"nexus_path", nexusPath},
-                      {"source", source},
-                      {"topic", topic}};
-
-  return stream;
+      createDataset<int32_t>("first_run", firstRun));
+
+  addGroup(entryGroupPath, std::move(measurementGroup));
+  addNode(entryGroupPath,
+          createDataset<std::string>("measurement_label", label));
+  addNode(entryGroupPath, createDataset<std::string>("measurement_id", id));
+  addNode(entryGroupPath,
+          createDataset<std::string>("measurement_subid", subId));
+  addNode(entryGroupPath, createDataset<std::string>("measurement_type", type));
+  addNode(entryGroupPath,
+          createDataset<int32_t>("measurement_first_run", firstRun));
+}
+
+void NexusWriteCommandBuilder::addStream(const std::string &parentPath,
+                                         const StringRef module,
+                                         const StringRef nexusPath,
+                                         const StringRef source,
+                                         const StringRef topic) {
+  addDeferredNode(parentPath, std::make_shared<StreamNode>(
+                                  m_stringPool.intern(module),
+                                  m_stringPool.intern(nexusPath),
+                                  m_stringPool.intern(source),
+                                  m_stringPool.intern(topic)));
+  BuildStatsRecorder::addNodes(1);
 }
 
 void NexusWriteCommandBuilder::addEventDataSource(
     uint32_t detectorNumber, const std::string &sourceName) {
-  auto eventDataStream =
-      createStream("ev42", "/" + entryGroupName + "/detector_" +
-                               std::to_string(detectorNumber) + "_events",
-                   sourceName, m_instrumentName + "_events");
-
-  m_entryGroupJson["children"].push_back(eventDataStream);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  addStream(entryGroupPath, "ev42",
+            "/" + entryGroupName + "/detector_" +
+                std::to_string(detectorNumber) + "_events",
+            sourceName, m_instrumentName + "_events");
 }
 
 void NexusWriteCommandBuilder::addSELogSources(
     const std::vector<std::string> &pVs) {
-  const std::string topicName = m_instrumentName + "_sampleEnv";
-  auto selogGroup = createGroup("selog", {{"NX_class", "IXselog"}});
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::SELOG);
+  std::vector<StringRef> pVRefs(pVs.begin(), pVs.end());
+  addSELogSources(pVRefs.data(), pVRefs.size());
+}
+
+void NexusWriteCommandBuilder::addSELogSources(const StringRef *pVs,
+                                               const size_t count) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::SELOG);
+  checkNotFromSkeleton("SE log PVs");
+  if (m_loadedNodes.count(entryGroupPath + "/selog") != 0) {
+    throw std::runtime_error("Cannot add SE log PVs to a loaded selog group "
+                             "which was not written by a builder");
+  }
+  if (m_seLogSources) {
+    const auto previousSize = m_seLogSources->size();
+    m_seLogSources->add(pVs, count);
+    m_seLogSources->keepWhenEmpty();
+    BuildStatsRecorder::addNodes(m_seLogSources->size() - previousSize);
+    return;
+  }
+  // The group is only added once its first batch has been accepted
+  auto seLogSources = std::make_shared<SELogSources>(
+      m_instrumentName + "_sampleEnv", "/" + entryGroupName + "/selog");
+  seLogSources->add(pVs, count);
+  seLogSources->keepWhenEmpty();
+  addDeferredNode(entryGroupPath, seLogSources);
+  BuildStatsRecorder::addNodes(1 + seLogSources->size());
+  m_seLogSources = std::move(seLogSources);
+}
+
+void NexusWriteCommandBuilder::addSELogSource(const StringRef pv) {
+  addSELogSources(&pv, 1);
+}
+
+std::shared_ptr<StagingQueue> NexusWriteCommandBuilder::createStagingQueue() {
+  // SE log PVs staged in the queue are a shard of the selog group. Without
+  // one the group is added here, it is left out while it has no PVs. PVs
+  // cannot be staged for a skeleton's selog group or a loaded one which was
+  // not written by a builder.
+  std::shared_ptr<SELogSources> seLogShard;
+  if (!m_skeleton && m_loadedNodes.count(entryGroupPath + "/selog") == 0) {
+    if (!m_seLogSources) {
+      m_seLogSources = std::make_shared<SELogSources>(
+          m_instrumentName + "_sampleEnv", "/" + entryGroupName + "/selog");
+      addDeferredNode(entryGroupPath, m_seLogSources);
+    }
+    seLogShard = std::make_shared<SELogSources>(
+        m_instrumentName + "_sampleEnv", "/" + entryGroupName + "/selog");
+    m_seLogSources->addShard(seLogShard);
+  }
+  std::shared_ptr<StagingQueue> queue(new StagingQueue(std::move(seLogShard)));
+  m_stagingQueues.push_back(queue);
+  return queue;
+}
+
+void NexusWriteCommandBuilder::addPeriod(Period period) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::PERIODS);
+  auto periods = m_periods ? m_periods : std::make_shared<Periods>();
+  periods->add(std::move(period));
+  usePeriods(std::move(periods));
+}
 
-  for (const auto &pv : pVs) {
-    auto splitPV = split(pv, ':');
-    selogGroup["children"].push_back(
-        createStream("f142", "/" + entryGroupName + "/selog/" + splitPV.back(),
-                     pv, topicName));
+void NexusWriteCommandBuilder::addPeriods(PeriodColumns periods) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::PERIODS);
+  if (periods.size() == 0) {
+    return;
   }
-  m_entryGroupJson["children"].push_back(selogGroup);
+  auto allPeriods = m_periods ? m_periods : std::make_shared<Periods>();
+  allPeriods->add(std::move(periods));
+  usePeriods(std::move(allPeriods));
 }
 
 void NexusWriteCommandBuilder::addPeriods(
@@ -252,81 +665,186 @@ void NexusWriteCommandBuilder::addPeriods(
     int32_t framesRequested, int32_t goodFrames, int32_t number,
     int32_t highestUsed, const std::string &labels,
     float protonChargeRawInMicroAmpHours, int32_t type, int32_t rawFrames) {
-  auto periodsGroup = createGroup("periods", {{"NX_class", "IXperiods"}});
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("output", "int32", output));
-  periodsGroup["children"].push_back(
-      createDataset<float>("total_counts", "int32",
-                           totalCountsInMegaElectronVolts, {{"units", "Mev"}}));
-  periodsGroup["children"].push_back(
-      createDataset<float>("proton_charge", "float",
-                           protonChargeInMicroAmpHours, {{"units", "uAh"}}));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("good_frames_daq", "int32", goodFramesDaq));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("sequences", "int32", sequences));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("frames_requested", "int32", framesRequested));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("good_frames", "int32", goodFrames));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("number", "int32", number));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("highest_used", "int32", highestUsed));
-  periodsGroup["children"].push_back(
-      createDataset<std::string>("labels", "string", labels));
-  periodsGroup["children"].push_back(
-      createDataset<float>("proton_charge_raw", "float",
-                           protonChargeRawInMicroAmpHours, {{"units", "uAh"}}));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("type", "int32", type));
-  periodsGroup["children"].push_back(
-      createDataset<int32_t>("raw_frames", "int32", rawFrames));
-
-  m_entryGroupJson["children"].push_back(periodsGroup);
-  m_entryGroupJson["children"].push_back(
-      createDataset<int32_t>("good_frames", "int32", goodFrames));
-  m_entryGroupJson["children"].push_back(
-      createDataset<int32_t>("raw_frames", "int32", rawFrames));
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::PERIODS);
+  Period period;
+  period.output = output;
+  period.totalCountsInMegaElectronVolts = totalCountsInMegaElectronVolts;
+  period.protonChargeInMicroAmpHours = protonChargeInMicroAmpHours;
+  period.goodFramesDaq = goodFramesDaq;
+  period.sequences = sequences;
+  period.framesRequested = framesRequested;
+  period.goodFrames = goodFrames;
+  period.number = number;
+  period.highestUsed = highestUsed;
+  period.label = labels;
+  period.protonChargeRawInMicroAmpHours = protonChargeRawInMicroAmpHours;
+  period.type = type;
+  period.rawFrames = rawFrames;
+  addPeriod(std::move(period));
 }
 
 void NexusWriteCommandBuilder::addExperimentIdentifier(
     const std::string &experimentIdentifier) {
-  m_entryGroupJson["children"].push_back(
-      createDataset("experiment_identifier", "string", experimentIdentifier));
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  addNode(entryGroupPath,
+          createDataset("experiment_identifier", experimentIdentifier));
 }
 
 void NexusWriteCommandBuilder::addScriptName(const std::string &scriptName) {
-  m_entryGroupJson["children"].push_back(
-      createDataset("script_name", "string", scriptName));
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
+  addNode(entryGroupPath, createDataset("script_name", scriptName));
 }
 
 void NexusWriteCommandBuilder::initIsisVmsCompat() {
   m_isisVmsCompatJson = createGroup("isis_vms_compat", {{"NX_class", "IXvms"}});
+  indexGroup(isisVmsCompatPath, m_isisVmsCompatJson);
 }
 
 void NexusWriteCommandBuilder::initFramelog() {
   m_framelogJson = createGroup("framelog", {{"NX_class", "NXcollection"}});
+  indexGroup(framelogPath, m_framelogJson);
 }
 
 void NexusWriteCommandBuilder::initRunlog() {
   m_runlogJson = createGroup("runlog", {{"NX_class", "IXrunlog"}});
+  indexGroup(runlogPath, m_runlogJson);
 }
 
 void NexusWriteCommandBuilder::initEntryGroupJson() {
   m_entryGroupJson = createGroup(entryGroupName, {{"NX_class", "NXentry"}});
+  indexGroup(entryGroupPath, m_entryGroupJson);
   addStartTime();
 }
 
+void NexusWriteCommandBuilder::indexGroup(const std::string &groupPath,
+                                          json &group) {
+  // The children array lives in the group's heap allocated object, so the
+  // pointer stays valid when the group itself is moved, for example when the
+  // parent's children array is reallocated
+  auto &children = group["children"];
+  m_groupChildrenIndex[groupPath] = &children;
+  for (auto &child : children) {
+    const auto type = child.find("type");
+    if (type != child.end() && type->is_string() &&
+        type->get_ref<const ArenaString &>() == "group") {
+      const auto &name = child["name"].get_ref<const ArenaString &>();
+      indexGroup(groupPath + "/" + std::string(name.data(), name.size()),
+                 child);
+    }
+  }
+}
+
+void NexusWriteCommandBuilder::checkNotFromSkeleton(const char *what) const {
+  if (m_skeleton) {
+    throw std::runtime_error(std::string("Cannot add ") + what +
+                             " to a builder made from an instrument skeleton");
+  }
+}
+
+json &NexusWriteCommandBuilder::groupChildren(const std::string &groupPath) {
+  const auto children = m_groupChildrenIndex.find(groupPath);
+  if (children == m_groupChildrenIndex.end()) {
+    throw std::runtime_error("No group at " + groupPath +
+                             " in NexusWriteCommandBuilder");
+  }
+  return *children->second;
+}
+
+void NexusWriteCommandBuilder::addNode(const std::string &parentPath,
+                                       json node) {
+  if (buildStatsEnabled) {
+    BuildStatsRecorder::addNodes(countNodes(node));
+  }
+  if (!m_loadedNodes.empty()) {
+    replaceLoadedNode(parentPath, nodeName(node));
+  }
+  groupChildren(parentPath).push_back(std::move(node));
+}
+
+void NexusWriteCommandBuilder::addGroup(const std::string &parentPath,
+                                        json group) {
+  if (buildStatsEnabled) {
+    BuildStatsRecorder::addNodes(countNodes(group));
+  }
+  if (!m_loadedNodes.empty()) {
+    replaceLoadedNode(parentPath, nodeName(group));
+  }
+  auto &siblings = groupChildren(parentPath);
+  siblings.push_back(std::move(group));
+  auto &addedGroup = siblings.back();
+  const auto &name = addedGroup["name"].get_ref<const ArenaString &>();
+  indexGroup(parentPath + "/" + std::string(name.data(), name.size()),
+             addedGroup);
+}
+
+void NexusWriteCommandBuilder::addDeferredNode(
+    const std::string &parentPath, std::shared_ptr<const DeferredNode> node) {
+  auto &siblings = groupChildren(parentPath);
+  m_deferredChildren[&siblings].emplace_back(siblings.size(), std::move(node));
+}
+
+void NexusWriteCommandBuilder::addLogColumns(const std::string &parentPath,
+                                             LogColumns columns) {
+  const auto sharedColumns =
+      std::make_shared<const LogColumns>(std::move(columns));
+  for (size_t i = 0; i < sharedColumns->numberOfColumns(); i++) {
+    addDeferredNode(parentPath,
+                    std::make_shared<LogColumnNode>(sharedColumns, i));
+  }
+  // An NXlog group with time and value datasets per column
+  BuildStatsRecorder::addNodes(3 * sharedColumns->numberOfColumns());
+}
+
+void NexusWriteCommandBuilder::usePeriods(std::shared_ptr<Periods> periods) {
+  if (!m_periods) {
+    m_periods = std::move(periods);
+    for (const auto name : {"periods", "good_frames", "raw_frames"}) {
+      replaceLoadedNode(entryGroupPath, name);
+    }
+    for (const auto part :
+         {PeriodsNode::Part::GROUP, PeriodsNode::Part::GOOD_FRAMES,
+          PeriodsNode::Part::RAW_FRAMES}) {
+      addDeferredNode(entryGroupPath,
+                      std::make_shared<PeriodsNode>(m_periods, part));
+    }
+    // The periods group with its 13 datasets, good_frames and raw_frames
+    BuildStatsRecorder::addNodes(16);
+  }
+}
+
+void NexusWriteCommandBuilder::addRunlogColumns(LogColumns columns) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::RUNLOG);
+  addLogColumns(runlogPath, std::move(columns));
+}
+
+void NexusWriteCommandBuilder::addFramelogColumns(LogColumns columns) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::FRAMELOG);
+  addLogColumns(framelogPath, std::move(columns));
+}
+
+void NexusWriteCommandBuilder::addRunlogStream(const std::string &name) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::RUNLOG);
+  addStream(runlogPath, "f142", runlogPath + "/" + name, name,
+            runlogStreamTopic());
+}
+
+void NexusWriteCommandBuilder::addFramelogStream(const std::string &name) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::FRAMELOG);
+  addStream(framelogPath, "f142", framelogPath + "/" + name, name,
+            framelogStreamTopic());
+}
+
 json NexusWriteCommandBuilder::createBeamlineJson(
-    const std::string &beamlineName) {
-  return createDataset<std::string>("beamline", "string", beamlineName);
+    const std::string &beamlineName) const {
+  return createDataset<std::string>("beamline", beamlineName);
 }
 
 void NexusWriteCommandBuilder::addRunCycle(const std::string &runCycleStr) {
-  auto runCycle =
-      createDataset<std::string>("run_cycle", "string", runCycleStr);
-  m_entryGroupJson["children"].push_back(runCycle);
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  auto runCycle = createDataset<std::string>("run_cycle", runCycleStr);
+  addNode(entryGroupPath, std::move(runCycle));
 }
 
 void NexusWriteCommandBuilder::addSample(float height, float thickness,
@@ -335,101 +853,365 @@ void NexusWriteCommandBuilder::addSample(float height, float thickness,
                                          const std::string &name,
                                          const std::string &type,
                                          const std::string &id) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::ENTRY);
+  ArenaScope scope(m_arena);
   auto sampleGroup = createGroup("sample", {{"NX_class", "NXsample"}});
 
+  sampleGroup["children"].push_back(createDataset<float>("height", height));
   sampleGroup["children"].push_back(
-      createDataset<float>("height", "float", height));
-  sampleGroup["children"].push_back(
-      createDataset<float>("thickness", "float", thickness));
-  sampleGroup["children"].push_back(
-      createDataset<float>("width", "float", width));
+      createDataset<float>("thickness", thickness));
+  sampleGroup["children"].push_back(createDataset<float>("width", width));
+  sampleGroup["children"].push_back(createDataset<std::string>("shape", shape));
+  sampleGroup["children"].push_back(createDataset<std::string>("name", name));
   sampleGroup["children"].push_back(
-      createDataset<std::string>("shape", "string", shape));
-  sampleGroup["children"].push_back(
-      createDataset<std::string>("name", "string", name));
-  sampleGroup["children"].push_back(
-      createDataset<double>("distance", "string", distance));
-  sampleGroup["children"].push_back(
-      createDataset<std::string>("type", "string", type));
-  sampleGroup["children"].push_back(
-      createDataset<std::string>("id", "string", id));
+      createDataset<double>("distance", distance));
+  sampleGroup["children"].push_back(createDataset<std::string>("type", type));
+  sampleGroup["children"].push_back(createDataset<std::string>("id", id));
 
-  m_entryGroupJson["children"].push_back(sampleGroup);
+  addGroup(entryGroupPath, std::move(sampleGroup));
 }
 
 void NexusWriteCommandBuilder::addInstrument(
     const std::string &instrumentNameStr) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::INSTRUMENT);
 
   auto moderatorGroup = createGroup("moderator", {{"NX_class", "NXmoderator"}});
   moderatorGroup["children"].push_back(
-      createDataset<float>("distance", "float", 0.0, {{"units", "metre"}}));
+      createDataset<float>("distance", 0.0f, {{"units", "metre"}}));
 
   auto sourceGroup = createGroup("source", {{"NX_class", "NXsource"}});
   sourceGroup["children"].push_back(
-      createDataset<std::string>("probe", "string", "neutrons"));
-  sourceGroup["children"].push_back(
-      createDataset<std::string>("type", "string", "Pulsed Neutron Source"));
+      createDataset<std::string>("probe", "neutrons"));
   sourceGroup["children"].push_back(
-      createDataset<std::string>("name", "string", "ISIS"));
+      createDataset<std::string>("type", "Pulsed Neutron Source"));
+  sourceGroup["children"].push_back(createDataset<std::string>("name", "ISIS"));
 
   auto instrumentGroup =
       createGroup("instrument", {{"NX_class", "NXinstrument"}});
-  instrumentGroup["children"].push_back(moderatorGroup);
-  instrumentGroup["children"].push_back(sourceGroup);
+  instrumentGroup["children"].push_back(std::move(moderatorGroup));
+  instrumentGroup["children"].push_back(std::move(sourceGroup));
 
   instrumentGroup["children"].push_back(
       createInstrumentNameJson(instrumentNameStr));
 
-  m_entryGroupJson["children"].push_back(instrumentGroup);
+  addGroup(entryGroupPath, std::move(instrumentGroup));
 }
 
 json NexusWriteCommandBuilder::createInstrumentNameJson(
-    const std::string &instrumentNameStr) {
+    const std::string &instrumentNameStr) const {
   return createDataset<std::string>(
-      "name", "string", instrumentNameStr,
+      "name", instrumentNameStr,
       {{"short_name", instrumentNameStr.substr(0, 3)}});
 }
 
 void NexusWriteCommandBuilder::addMonitor(uint32_t monitorNumber,
                                           uint32_t spectrumIndex) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::MONITORS);
+  checkNotFromSkeleton("monitors");
+  ArenaScope scope(m_arena);
   const std::string monitorName = "monitor_" + std::to_string(monitorNumber);
 
   auto monitorGroup = createGroup(monitorName, {{"NX_class", "NXmonitor"}});
   monitorGroup["children"].push_back(
-      createDataset<int32_t>("monitor_number", "int32", monitorNumber));
+      createDataset<int32_t>("monitor_number", monitorNumber));
   monitorGroup["children"].push_back(
-      createDataset<int32_t>("spectrum_index", "int32", spectrumIndex));
+      createDataset<int32_t>("spectrum_index", spectrumIndex));
   monitorGroup["children"].push_back(createGroup("period_index"));
 
-  m_entryGroupJson["children"].push_back(monitorGroup);
+  addGroup(entryGroupPath, std::move(monitorGroup));
+}
+
+void NexusWriteCommandBuilder::addMonitors(const uint32_t firstMonitorNumber,
+                                           const uint32_t count,
+                                           const uint32_t firstSpectrumIndex,
+                                           const int32_t spectrumIndexStep) {
+  BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::MONITORS);
+  checkNotFromSkeleton("monitors");
+  if (count == 0) {
+    return;
+  }
+  if (!m_loadedNodes.empty()) {
+    for (uint32_t i = 0; i < count; i++) {
+      replaceLoadedNode(entryGroupPath,
+                        "monitor_" + std::to_string(firstMonitorNumber + i));
+    }
+  }
+  addDeferredNode(entryGroupPath,
+                  std::make_shared<MonitorRangeNode>(
+                      MonitorRange{firstMonitorNumber, count,
+                                   firstSpectrumIndex, spectrumIndexStep}));
+  // Each monitor group holds two datasets and the period_index group
+  BuildStatsRecorder::addNodes(4 * uint64_t(count));
+}
+
+std::string
+NexusWriteCommandBuilder::startMessageAsString(const int indent) const {
+  std::string output;
+  writeStartMessage(output, indent);
+  return output;
+}
+
+std::string
+NexusWriteCommandBuilder::stopMessageAsString(const int indent) const {
+  std::string output;
+  writeStopMessage(output, indent);
+  return output;
+}
+
+void NexusWriteCommandBuilder::writeStartMessage(
+    std::string &buffer, const int indent,
+    const FloatFormat floatFormat) const {
+  buffer.clear();
+  JsonWriter writer(buffer, indent, floatFormat);
+  writeStartMessageJson(writer);
+}
+
+void NexusWriteCommandBuilder::writeStopMessage(std::string &buffer,
+                                                const int indent) const {
+  buffer.clear();
+  JsonWriter writer(buffer, indent);
+  writeStopMessageJson(writer);
+}
+
+void NexusWriteCommandBuilder::writeStartMessage(
+    OutputSink &sink, const int indent, const FloatFormat floatFormat) const {
+  JsonWriter writer(sink, indent, floatFormat);
+  writeStartMessageJson(writer);
+  writer.flush();
+}
+
+void NexusWriteCommandBuilder::writeStopMessage(OutputSink &sink,
+                                                const int indent) const {
+  JsonWriter writer(sink, indent);
+  writeStopMessageJson(writer);
+  writer.flush();
+}
+
+void NexusWriteCommandBuilder::writeStartMessageJson(JsonWriter &writer) const {
+  const auto queuesInUse = useStagingQueues(m_stagingQueues);
+  BuildStatsRecorder::SerialiseScope stats(m_buildStats, writer);
+  // Keys are written in the sorted order that nlohmann::json uses so that the
+  // output matches startMessageAsJson()
+  writer.startObject();
+  writer.key("broker");
+  writer.value(m_broker);
+  writer.key("cmd");
+  writer.value("FileWriter_new");
+  writer.key("file_attributes");
+  writer.startObject();
+  writer.key("file_name");
+  writer.value(m_filename);
+  writer.endObject();
+  writer.key("job_id");
+  writer.value(m_jobID);
+  writer.key("nexus_structure");
+  writer.startObject();
+  writer.key("children");
+  writer.startArray();
+  writeEntryGroup(writer);
+  writer.endArray();
+  writer.endObject();
+  writer.key("start_time");
+  writer.value(m_startTimeUnixMilliseconds);
+  writer.key("use_hdf_swmr");
+  writer.value(false);
+  writer.endObject();
+}
+
+void NexusWriteCommandBuilder::writeEntryGroup(JsonWriter &writer) const {
+  writer.startObject();
+  for (auto it = m_entryGroupJson.cbegin(); it != m_entryGroupJson.cend();
+       ++it) {
+    writer.key(it.key());
+    if (it.key() != "children") {
+      writer.value(it.value());
+      continue;
+    }
+    // The entry's own children followed by those that are only added to the
+    // output message, in the same order as startMessageAsJson()
+    writer.startArray();
+    writeChildNodes(writer, it.value());
+    for (const auto &node : m_trailingEntryChildren) {
+      writeDeferredNode(writer, *node);
+    }
+    writeNode(writer, m_isisVmsCompatJson);
+    writeNode(writer, m_runlogJson);
+    writeNode(writer, m_framelogJson);
+    writer.endArray();
+  }
+  writer.endObject();
+}
+
+void NexusWriteCommandBuilder::writeNode(JsonWriter &writer,
+                                         const json &node) const {
+  BuildStatsRecorder::SectionScope section;
+  if (BuildStatsRecorder::serialising()) {
+    section.enterNode(nodeName(node));
+  }
+  // Groups are walked while recording statistics, so that their children can
+  // be charged to other sections
+  if ((m_deferredChildren.empty() && m_stagingQueues.empty() &&
+       !BuildStatsRecorder::serialising()) ||
+      node.find("children") == node.end()) {
+    writer.value(node);
+    return;
+  }
+  writer.startObject();
+  for (auto it = node.cbegin(); it != node.cend(); ++it) {
+    writer.key(it.key());
+    if (it.key() == "children") {
+      writer.startArray();
+      writeChildNodes(writer, it.value());
+      writer.endArray();
+    } else {
+      writer.value(it.value());
+    }
+  }
+  writer.endObject();
+}
+
+void NexusWriteCommandBuilder::writeChildNodes(JsonWriter &writer,
+                                               const json &children) const {
+  const auto deferred = m_deferredChildren.find(&children);
+  if (deferred == m_deferredChildren.end()) {
+    for (const auto &child : children) {
+      writeNode(writer, child);
+    }
+  } else {
+    auto deferredNode = deferred->second.cbegin();
+    const auto deferredEnd = deferred->second.cend();
+    for (size_t i = 0; i <= children.size(); i++) {
+      for (; deferredNode != deferredEnd && deferredNode->first == i;
+           ++deferredNode) {
+        if (!deferredNode->second->empty()) {
+          writeDeferredNode(writer, *deferredNode->second);
+        }
+      }
+      if (i < children.size()) {
+        writeNode(writer, children[i]);
+      }
+    }
+  }
+  for (const auto &queue : m_stagingQueues) {
+    const auto staged = stagedRecords(*queue, children);
+    if (staged != nullptr) {
+      for (const auto &node : *staged) {
+        writer.value(node);
+      }
+    }
+  }
+}
+
+void NexusWriteCommandBuilder::writeDeferredNode(
+    JsonWriter &writer, const DeferredNode &node) const {
+  BuildStatsRecorder::SectionScope section;
+  if (BuildStatsRecorder::serialising()) {
+    enterSection(section, node);
+  }
+  node.write(writer);
+}
+
+const std::vector<json> *
+NexusWriteCommandBuilder::stagedRecords(const StagingQueue &queue,
+                                        const json &children) const {
+  const auto isGroup = [&](const std::string &groupPath) {
+    const auto group = m_groupChildrenIndex.find(groupPath);
+    return group != m_groupChildrenIndex.end() && group->second == &children;
+  };
+  if (isGroup(runlogPath)) {
+    return &queue.m_runlogRecords;
+  }
+  if (isGroup(framelogPath)) {
+    return &queue.m_framelogRecords;
+  }
+  if (isGroup(isisVmsCompatPath)) {
+    return &queue.m_vmsRecords;
+  }
+  return nullptr;
+}
+
+nlohmann::json NexusWriteCommandBuilder::expandNode(const json &node) const {
+  const auto children = node.find("children");
+  if ((m_deferredChildren.empty() && m_stagingQueues.empty()) ||
+      children == node.end()) {
+    return convertJson<nlohmann::json>(node);
+  }
+  const auto deferred = m_deferredChildren.find(&*children);
+  auto expandedChildren = nlohmann::json::array();
+  size_t position = 0;
+  if (deferred != m_deferredChildren.end()) {
+    for (const auto &deferredNode : deferred->second) {
+      for (; position < deferredNode.first; position++) {
+        expandedChildren.push_back(expandNode((*children)[position]));
+      }
+      if (deferredNode.second->empty()) {
+        continue;
+      }
+      if (deferredNode.second->isSiblingRange()) {
+        for (auto &sibling : deferredNode.second->toJson()) {
+          expandedChildren.push_back(std::move(sibling));
+        }
+      } else {
+        expandedChildren.push_back(deferredNode.second->toJson());
+      }
+    }
+  }
+  for (; position < children->size(); position++) {
+    expandedChildren.push_back(expandNode((*children)[position]));
+  }
+  for (const auto &queue : m_stagingQueues) {
+    const auto staged = stagedRecords(*queue, *children);
+    if (staged != nullptr) {
+      for (const auto &stagedNode : *staged) {
+        expandedChildren.push_back(convertJson<nlohmann::json>(stagedNode));
+      }
+    }
+  }
+  auto expanded = nlohmann::json::object();
+  for (auto it = node.cbegin(); it != node.cend(); ++it) {
+    if (it.key() != "children") {
+      expanded[std::string(it.key().data(), it.key().size())] =
+          convertJson<nlohmann::json>(it.value());
+    }
+  }
+  expanded["children"] = std::move(expandedChildren);
+  return expanded;
 }
 
-std::string NexusWriteCommandBuilder::startMessageAsString() {
-  json nexusStructureJson = {{"children", json::array()}};
-  nexusStructureJson["children"].push_back(m_entryGroupJson);
-  json startMessageJson = {
+nlohmann::json NexusWriteCommandBuilder::startMessageAsJson() const {
+  const auto queuesInUse = useStagingQueues(m_stagingQueues);
+  nlohmann::json nexusStructureJson = {{"children", nlohmann::json::array()}};
+  nexusStructureJson["children"].push_back(expandNode(m_entryGroupJson));
+  nlohmann::json startMessageJson = {
       {"cmd", "FileWriter_new"},
       {"broker", m_broker},
       {"job_id", m_jobID},
       {"use_hdf_swmr", false},
-      {"start_time", iso8601ToUnixTimeMilliseconds(m_startTimeIso8601)},
+      {"start_time", m_startTimeUnixMilliseconds},
       {"nexus_structure", nexusStructureJson},
       {"file_attributes", {{"file_name", m_filename}}}};
 
-  startMessageJson["nexus_structure"]["children"][0]["children"].push_back(
-      createInstrumentNameJson(m_instrumentName));
-  startMessageJson["nexus_structure"]["children"][0]["children"].push_back(
-      createBeamlineJson(m_instrumentName));
-  startMessageJson["nexus_structure"]["children"][0]["children"].push_back(
-      m_isisVmsCompatJson);
-  startMessageJson["nexus_structure"]["children"][0]["children"].push_back(
-      m_runlogJson);
-  startMessageJson["nexus_structure"]["children"][0]["children"].push_back(
-      m_framelogJson);
-  return startMessageJson.dump(4);
-}
-
-std::string NexusWriteCommandBuilder::stopMessageAsString() {
-  json stopMessageJson = {{"job_id", m_jobID}, {"cmd", "FileWriter_stop"}};
-  return stopMessageJson.dump(4);
+  auto &entryChildren =
+      startMessageJson["nexus_structure"]["children"][0]["children"];
+  for (const auto &node : m_trailingEntryChildren) {
+    entryChildren.push_back(node->toJson());
+  }
+  entryChildren.push_back(expandNode(m_isisVmsCompatJson));
+  entryChildren.push_back(expandNode(m_runlogJson));
+  entryChildren.push_back(expandNode(m_framelogJson));
+  return startMessageJson;
+}
+
+nlohmann::json NexusWriteCommandBuilder::startMessageDelta(
+    const nlohmann::json &baseline) const {
+  return createStartMessageDelta(baseline, startMessageAsJson());
+}
+
+void NexusWriteCommandBuilder::writeStopMessageJson(JsonWriter &writer) const {
+  writer.startObject();
+  writer.key("cmd");
+  writer.value("FileWriter_stop");
+  writer.key("job_id");
+  writer.value(m_jobID);
+  writer.endObject();
 }
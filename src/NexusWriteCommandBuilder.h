@@ -1,9 +1,35 @@
 #pragma once
 
+#include "BuildStats.h"
+#include "BuilderJson.h"
+#include "DeferredNode.h"
+#include "DeviceRanges.h"
+#include "InstrumentSkeleton.h"
+#include "JsonWriter.h"
+#include "LogColumns.h"
+#include "MonotonicArena.h"
+#include "NexusTypes.h"
+#include "Periods.h"
+#include "SELogSources.h"
+#include "StringPool.h"
+#include "StringRef.h"
+#include <memory>
 #include <nlohmann/json.hpp>
+#include <unordered_map>
+
+class RawJsonNode;
+struct RawNodeParts;
+class StagingQueue;
 
 namespace {
 
+const std::string entryGroupName = "raw_data_1";
+const std::string entryGroupPath = "/" + entryGroupName;
+const std::string instrumentPath = entryGroupPath + "/instrument";
+const std::string isisVmsCompatPath = entryGroupPath + "/isis_vms_compat";
+const std::string runlogPath = entryGroupPath + "/runlog";
+const std::string framelogPath = entryGroupPath + "/framelog";
+
 struct Attribute {
   const std::string name;
   const std::string value;
@@ -11,9 +37,9 @@ struct Attribute {
 
 enum class NodeType { DATASET, GROUP };
 
-nlohmann::json createNode(const std::string &name, const NodeType nodeType,
-                          const std::vector<Attribute> &attributes) {
-  auto node = nlohmann::json::object();
+BuilderJson createNode(const std::string &name, const NodeType nodeType,
+                       const std::vector<Attribute> &attributes) {
+  auto node = BuilderJson::object();
 
   node["name"] = name;
 
@@ -21,15 +47,16 @@ nlohmann::json createNode(const std::string &name, const NodeType nodeType,
     node["type"] = "dataset";
   } else if (nodeType == NodeType::GROUP) {
     node["type"] = "group";
-    node["children"] = nlohmann::json::array();
+    node["children"] = BuilderJson::array();
   } else {
     throw std::runtime_error("Unhandled NodeType in createNode");
   }
 
   if (!attributes.empty()) {
-    node["attributes"] = {};
+    auto &nodeAttributes = node["attributes"] = BuilderJson::array();
+    reserveArray(nodeAttributes, attributes.size());
     for (const auto &attribute : attributes) {
-      node["attributes"].push_back(
+      nodeAttributes.push_back(
           {{"name", attribute.name}, {"values", attribute.value}});
     }
   }
@@ -38,34 +65,44 @@ nlohmann::json createNode(const std::string &name, const NodeType nodeType,
 }
 
 template <typename T>
-nlohmann::json createDataset(const std::string &name,
-                             const std::string &typeStr, T value,
-                             const std::vector<Attribute> &attributes = {}) {
+BuilderJson createDataset(const std::string &name, const std::string &typeStr,
+                          T value,
+                          const std::vector<Attribute> &attributes = {}) {
   auto dataset = createNode(name, NodeType::DATASET, attributes);
-  dataset["values"] = value;
+  dataset["values"] = std::move(value);
   dataset["dataset"] = {{"type", typeStr}, {"size", {"unlimited"}}};
 
   return dataset;
 }
 
-nlohmann::json createGroup(const std::string &name,
-                           const std::vector<Attribute> &attributes = {}) {
+// A dataset labelled with the NeXus type of its values, see NexusTypes.h
+template <typename T>
+BuilderJson createDataset(const std::string &name, T value,
+                          const std::vector<Attribute> &attributes = {}) {
+  return createDataset<T>(name, nexusTypeName<T>(), std::move(value),
+                          attributes);
+}
+
+BuilderJson createGroup(const std::string &name,
+                        const std::vector<Attribute> &attributes = {}) {
   return createNode(name, NodeType::GROUP, attributes);
 }
 
 template <typename T>
-nlohmann::json
-createLogGroup(const std::string &name, const std::string &typeStr,
-               const T &values, const std::vector<float> &times,
-               const std::string &startTime, const std::string &units) {
+BuilderJson createLogGroup(const std::string &name, const std::string &typeStr,
+                           T values, std::vector<float> times,
+                           const std::string &startTime,
+                           const std::string &units) {
   auto logGroup = createGroup(name, {{"NX_class", "NXlog"}});
-  logGroup["children"].push_back(createDataset<std::vector<float>>(
-      "time", "float", times, {{"start", startTime}, {"units", "second"}}));
+  auto &children = logGroup["children"];
+  reserveArray(children, 2);
+  children.push_back(createDataset<std::vector<float>>(
+      "time", std::move(times), {{"start", startTime}, {"units", "second"}}));
   if (!units.empty()) {
-    logGroup["children"].push_back(
-        createDataset<T>("value", typeStr, values, {{"units", units}}));
+    children.push_back(createDataset<T>("value", typeStr, std::move(values),
+                                        {{"units", units}}));
   } else {
-    logGroup["children"].push_back(createDataset<T>("value", typeStr, values));
+    children.push_back(createDataset<T>("value", typeStr, std::move(values)));
   }
   return logGroup;
 }
@@ -78,12 +115,84 @@ public:
                            const std::string &runCycle,
                            const std::string &startTimeIso8601);
 
-  // Get the output command messages as strings
-  std::string startMessageAsString();
-  std::string stopMessageAsString();
+  // Construct from a compiled instrument skeleton, only the per-run parts of
+  // the message are built. Groups which are part of the skeleton, such as the
+  // instrument group, cannot have anything added to them.
+  NexusWriteCommandBuilder(std::shared_ptr<const InstrumentSkeleton> skeleton,
+                           int32_t runNumber, const std::string &broker,
+                           const std::string &runCycle,
+                           const std::string &startTimeIso8601);
+
+  // Compile the static parts of the file structure for an instrument, see
+  // also InstrumentSkeletonCache
+  static std::shared_ptr<const InstrumentSkeleton>
+  createInstrumentSkeleton(const InstrumentConfig &config);
+
+  // Re-open a start message, such as one from writeStartMessage, so that it
+  // can be amended. Only the envelope and the entry, instrument,
+  // isis_vms_compat, runlog, framelog and selog groups are parsed, every other
+  // node is kept as the bytes it was read as and written back out verbatim. A
+  // node added with the name of a loaded one replaces it, so addTitle
+  // corrects the title and addPeriod replaces the loaded periods, while
+  // addUser adds the next user_N and addSELogSources or a staging queue adds
+  // to the loaded PVs. A selog group not written by a builder is kept
+  // verbatim, and adding PVs to it throws. Throws std::runtime_error if the
+  // message is not a FileWriter_new command with a raw_data_1 group.
+  static NexusWriteCommandBuilder fromStartMessage(std::string startMessage);
 
-  // Add stuff to the file
+  // Groups are indexed by pointers into the builder's own tree, so a copy
+  // would refer to the original's groups
+  NexusWriteCommandBuilder(const NexusWriteCommandBuilder &) = delete;
+  NexusWriteCommandBuilder &
+  operator=(const NexusWriteCommandBuilder &) = delete;
+  NexusWriteCommandBuilder(NexusWriteCommandBuilder &&) = default;
+
+  // The job ID shared by the start and stop messages
+  const std::string &jobID() const { return m_jobID; }
+
+  // Get the output command messages as strings, indent has the same meaning as
+  // for nlohmann::json::dump, JsonWriter::COMPACT gives the compact form
+  std::string startMessageAsString(int indent = 4) const;
+  std::string stopMessageAsString(int indent = 4) const;
+
+  // Serialise the command messages into a caller owned buffer. The buffer is
+  // cleared first but keeps its capacity, so it can be reused for every run.
+  // FloatFormat::SHORTEST_FLOAT32 shortens the values of log columns, see
+  // JsonWriter.h.
+  void
+  writeStartMessage(std::string &buffer, int indent = 4,
+                    FloatFormat floatFormat = FloatFormat::AS_DOUBLE) const;
+  void writeStopMessage(std::string &buffer, int indent = 4) const;
+
+  // Serialise the command messages to a sink, see OutputSink.h
+  void
+  writeStartMessage(OutputSink &sink, int indent = 4,
+                    FloatFormat floatFormat = FloatFormat::AS_DOUBLE) const;
+  void writeStopMessage(OutputSink &sink, int indent = 4) const;
+
+  // Reference implementation of the start message which builds the whole
+  // document as a DOM, startMessageAsString(indent) produces the same bytes as
+  // startMessageAsJson().dump(indent)
+  nlohmann::json startMessageAsJson() const;
+
+  // The start message as a delta against an earlier start message, see
+  // StartMessageDelta.h
+  nlohmann::json startMessageDelta(const nlohmann::json &baseline) const;
+
+  // Cost of the add* calls and start message serialisations so far by
+  // section, all zero unless built with NEXUS_JSON_INSTRUMENTATION, see
+  // BuildStats.h. Records added through a StagingQueue are not included.
+  BuildStats buildStats() const { return m_buildStats.stats(); }
+
+  // Add stuff to the file. Monitors, detectors and SE log PVs are part of an
+  // instrument skeleton, so adding them to a builder constructed from one
+  // throws std::runtime_error.
   void addMonitor(uint32_t monitorNumber, uint32_t spectrumNumber);
+  // The same groups as calling addMonitor for count monitors from
+  // firstMonitorNumber, with spectrum indices going up by spectrumIndexStep.
+  // Only the range is stored, the groups are written out by each message.
+  void addMonitors(uint32_t firstMonitorNumber, uint32_t count,
+                   uint32_t firstSpectrumIndex, int32_t spectrumIndexStep = 1);
   void addSample(float height, float thickness, float width,
                  double distance = 0.0, const std::string &shape = "",
                  const std::string &name = "", const std::string &type = "",
@@ -97,12 +206,22 @@ public:
   void addTotalUncountedCounts(int32_t uncountedCounts);
   void addSeciConfig(const std::string &SeciConfig);
   void addDetector(uint32_t detectorNumber, float sourceDetectorDistance);
+  // A detector bank with the detector_number and spectrum_index datasets of
+  // its pixels, which are expanded from the map's runs by each message
+  void addDetector(uint32_t detectorNumber, float sourceDetectorDistance,
+                   SpectrumMap spectrumMap);
   void addMeasurement(const std::string &label = "", const std::string &id = "",
                       const std::string &subId = "",
                       const std::string &type = "", int32_t firstRun = 0);
   void addEventDataSource(uint32_t detectorNumber,
                           const std::string &sourceName);
+  // Register sample environment PVs as f142 streams in the entry's selog
+  // group. Calls add to the same group; a PV registered twice is ignored and a
+  // PV whose last colon separated part is taken by another PV throws. Once
+  // called the group is part of the message, even if it has no PVs.
   void addSELogSources(const std::vector<std::string> &pVs);
+  void addSELogSources(const StringRef *pVs, size_t count);
+  void addSELogSource(StringRef pv);
   void addProgramName(const std::string &programName,
                       const std::string &version);
   void addNexusDefinition(const std::string &name, const std::string &version,
@@ -113,6 +232,12 @@ public:
   void addNotes(const std::string &notes);
   void addProtonChargeRawInMicroAmpHours(float protonCharge);
   void addProtonChargeInMicroAmpHours(float protonCharge);
+  // Periods accumulate, each call appends to the single periods group, whose
+  // datasets hold one value per period. The entry's good_frames and
+  // raw_frames are the totals over all periods.
+  void addPeriod(Period period);
+  void addPeriods(PeriodColumns periods);
+  // Append one period
   void addPeriods(int32_t output, float totalCountsInMegaElectronVolts,
                   float protonChargeInMicroAmpHours, int32_t goodFramesDaq,
                   int32_t sequences, int32_t framesRequested,
@@ -123,37 +248,110 @@ public:
   void addExperimentIdentifier(const std::string &experimentIdentifier);
   void addScriptName(const std::string &scriptName);
 
+  // Records and log values are taken by value, pass them with std::move to
+  // avoid copying large arrays on their way into the file structure
   template <typename T>
   void addVmsRecord(const std::string &name, const std::string &typeStr,
                     T record) {
-    m_isisVmsCompatJson["children"].push_back(
-        createDataset<T>(name, typeStr, record));
+    BuildStatsRecorder::AddScope stats(m_buildStats,
+                                       BuildSection::ISIS_VMS_COMPAT);
+    ArenaScope scope(m_arena);
+    addNode(isisVmsCompatPath,
+            createDataset<T>(name, typeStr, std::move(record)));
   }
 
   template <typename T>
   void addRunlogRecord(const std::string &name, const std::string &typeStr,
-                       const T &values, const std::vector<float> &times,
+                       T values, std::vector<float> times,
                        const std::string &startTime,
                        const std::string &units = "") {
-    auto logGroup =
-        createLogGroup<T>(name, typeStr, values, times, startTime, units);
-    m_runlogJson["children"].push_back(logGroup);
+    BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::RUNLOG);
+    ArenaScope scope(m_arena);
+    addGroup(runlogPath,
+             createLogGroup<T>(name, typeStr, std::move(values),
+                               std::move(times), startTime, units));
   }
 
   template <typename T>
   void addFramelogRecord(const std::string &name, const std::string &typeStr,
-                         const T &values, const std::vector<float> &times,
+                         T values, std::vector<float> times,
+                         const std::string &startTime,
+                         const std::string &units = "") {
+    BuildStatsRecorder::AddScope stats(m_buildStats, BuildSection::FRAMELOG);
+    ArenaScope scope(m_arena);
+    addGroup(framelogPath,
+             createLogGroup<T>(name, typeStr, std::move(values),
+                               std::move(times), startTime, units));
+  }
+
+  // As above, labelled with the NeXus type of T, see NexusTypes.h
+  template <typename T> void addVmsRecord(const std::string &name, T record) {
+    addVmsRecord<T>(name, nexusTypeName<T>(), std::move(record));
+  }
+
+  template <typename T>
+  void addRunlogRecord(const std::string &name, T values,
+                       std::vector<float> times, const std::string &startTime,
+                       const std::string &units = "") {
+    addRunlogRecord<T>(name, nexusTypeName<T>(), std::move(values),
+                       std::move(times), startTime, units);
+  }
+
+  template <typename T>
+  void addFramelogRecord(const std::string &name, T values,
+                         std::vector<float> times,
                          const std::string &startTime,
                          const std::string &units = "") {
-    auto logGroup =
-        createLogGroup<T>(name, typeStr, values, times, startTime, units);
-    m_framelogJson["children"].push_back(logGroup);
+    addFramelogRecord<T>(name, nexusTypeName<T>(), std::move(values),
+                         std::move(times), startTime, units);
+  }
+
+  // Add a batch of logs which share a time axis, one NXlog group per column.
+  // The values stay in their columns until a message is serialised.
+  void addRunlogColumns(LogColumns columns);
+  void addFramelogColumns(LogColumns columns);
+
+  // Register a log whose values are published during the run as f142
+  // messages with the log name as their source (see F142Encoder.h), instead
+  // of being written into the start message. The file writer records it at
+  // runlog/<name> or framelog/<name>, so the start message stays the same
+  // size however long the run lasts.
+  void addRunlogStream(const std::string &name);
+  void addFramelogStream(const std::string &name);
+  // Topics of those streams
+  std::string runlogStreamTopic() const { return m_instrumentName + "_runLog"; }
+  std::string framelogStreamTopic() const {
+    return m_instrumentName + "_frameLog";
   }
 
   // Can be called multiple times to add more users
   void addUser(const std::string &name, const std::string &affiliation);
 
+  // Create a queue through which another thread can add records without
+  // locking the builder, see StagingQueue.h. Queues are merged in the order
+  // they were created.
+  std::shared_ptr<StagingQueue> createStagingQueue();
+
 private:
+  // Used by fromStartMessage, the entry is filled in by loadEntry
+  NexusWriteCommandBuilder(std::string jobID, std::string broker,
+                           std::string filename,
+                           int64_t startTimeUnixMilliseconds);
+  void loadEntry(const std::shared_ptr<const std::string> &document,
+                 const RawNodeParts &entry);
+  // Parse the group's own members into group and index it
+  void openGroup(const std::string &groupPath, BuilderJson &group,
+                 const RawNodeParts &node);
+  // Open the group and keep its children as loaded nodes
+  void loadGroup(const std::string &groupPath, BuilderJson &group,
+                 const std::shared_ptr<const std::string> &document,
+                 const RawNodeParts &node);
+  void addLoadedNode(const std::string &parentPath,
+                     const std::shared_ptr<const std::string> &document,
+                     StringRef node, StringRef name);
+  // Remove the loaded node, if any, which a new node called name replaces
+  void replaceLoadedNode(const std::string &parentPath, StringRef name);
+
   void initEntryGroupJson();
   void addInstrument(const std::string &instrumentNameStr);
   void addRunCycle(const std::string &runCycleStr);
@@ -163,22 +361,75 @@ private:
   void initFramelog();
   void initRunlog();
 
-  nlohmann::json createStream(const std::string &module,
-                              const std::string &nexusPath,
-                              const std::string &source,
-                              const std::string &topic) const;
+  // Throws if the builder was constructed from an instrument skeleton, which
+  // already holds the group that what would be added to
+  void checkNotFromSkeleton(const char *what) const;
+
+  // Index the group and any groups nested in it by NeXus path, for example
+  // /raw_data_1/instrument, so that nodes can be added in constant time
+  void indexGroup(const std::string &groupPath, BuilderJson &group);
+  BuilderJson &groupChildren(const std::string &groupPath);
+  void addNode(const std::string &parentPath, BuilderJson node);
+  void addGroup(const std::string &parentPath, BuilderJson group);
+  void addDeferredNode(const std::string &parentPath,
+                       std::shared_ptr<const DeferredNode> node);
+  void addLogColumns(const std::string &parentPath, LogColumns columns);
+  // Called once periods have been accepted, the first time with the new
+  // Periods, whose nodes are then added to the entry
+  void usePeriods(std::shared_ptr<Periods> periods);
+
+  void writeStartMessageJson(JsonWriter &writer) const;
+  void writeStopMessageJson(JsonWriter &writer) const;
+  void writeEntryGroup(JsonWriter &writer) const;
+  void writeNode(JsonWriter &writer, const BuilderJson &node) const;
+  void writeDeferredNode(JsonWriter &writer, const DeferredNode &node) const;
+  void writeChildNodes(JsonWriter &writer,
+                       const BuilderJson &children) const;
+  nlohmann::json expandNode(const BuilderJson &node) const;
+  // The records staged in a queue for the group whose children these are, if
+  // any can be
+  const std::vector<BuilderJson> *
+  stagedRecords(const StagingQueue &queue, const BuilderJson &children) const;
+
+  // A stream node whose strings are interned in m_stringPool
+  void addStream(const std::string &parentPath, StringRef module,
+                 StringRef nexusPath, StringRef source, StringRef topic);
 
-  nlohmann::json createInstrumentNameJson(const std::string &instrumentNameStr);
-  nlohmann::json createBeamlineJson(const std::string &beamlineName);
+  BuilderJson
+  createInstrumentNameJson(const std::string &instrumentNameStr) const;
+  BuilderJson createBeamlineJson(const std::string &beamlineName) const;
 
+  // Backs every BuilderJson value in the builder's document, so it must be
+  // declared before them. Methods which modify the document open an
+  // ArenaScope for it.
+  MonotonicArena m_arena;
   const std::string m_jobID;
   const std::string m_instrumentName;
   const std::string m_broker;
   const std::string m_filename;
   const std::string m_startTimeIso8601;
-  nlohmann::json m_entryGroupJson;
-  nlohmann::json m_isisVmsCompatJson;
-  nlohmann::json m_framelogJson;
-  nlohmann::json m_runlogJson;
+  const int64_t m_startTimeUnixMilliseconds;
+  const std::shared_ptr<const InstrumentSkeleton> m_skeleton;
+  // Strings repeated across stream nodes, such as topics and writer modules
+  StringPool m_stringPool;
+  BuilderJson m_entryGroupJson;
+  BuilderJson m_isisVmsCompatJson;
+  BuilderJson m_framelogJson;
+  BuilderJson m_runlogJson;
+  // Added to the entry after its own children, before isis_vms_compat
+  std::vector<std::shared_ptr<const DeferredNode>> m_trailingEntryChildren;
+  std::unordered_map<std::string, BuilderJson *> m_groupChildrenIndex;
+  std::shared_ptr<SELogSources> m_seLogSources;
+  std::shared_ptr<Periods> m_periods;
+  std::vector<std::shared_ptr<const StagingQueue>> m_stagingQueues;
+  // Nodes of a start message loaded by fromStartMessage, by NeXus path
+  std::unordered_map<std::string, std::shared_ptr<RawJsonNode>> m_loadedNodes;
+  // Deferred nodes keyed by the children array of the group they belong to,
+  // each with the number of ordinary children which precede it
+  std::unordered_map<
+      const BuilderJson *,
+      std::vector<std::pair<size_t, std::shared_ptr<const DeferredNode>>>>
+      m_deferredChildren;
   uint32_t m_numberOfUsers = 0;
+  BuildStatsRecorder m_buildStats;
 };
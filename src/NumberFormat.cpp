@@ -0,0 +1,97 @@
+#include "NumberFormat.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <nlohmann/json.hpp>
+
+namespace {
+
+// Values are written in fixed point notation from 10^-4 up to 10^15 and in
+// exponential notation outside that range, as nlohmann::json does for doubles
+const int minFixedExponent = -4;
+const int maxFixedExponent = std::numeric_limits<double>::digits10;
+const double maxFixedValue = 1e15;
+
+// Write number as digits followed by ".0", which is how nlohmann::json
+// formats integral values below 10^15. Returns nullptr if number is not such a
+// value.
+template <typename FloatType>
+char *formatIntegral(char *first, const FloatType number) {
+  const double magnitude = std::fabs(static_cast<double>(number));
+  if (!(magnitude < maxFixedValue) || std::trunc(magnitude) != magnitude) {
+    return nullptr;
+  }
+  if (std::signbit(number)) {
+    *first++ = '-';
+  }
+  first = formatUnsigned(first, static_cast<uint64_t>(magnitude));
+  *first++ = '.';
+  *first++ = '0';
+  return first;
+}
+
+char *formatNull(char *first) {
+  std::memcpy(first, "null", 4);
+  return first + 4;
+}
+}
+
+char *formatDouble(char *first, const double number) {
+  if (!std::isfinite(number)) {
+    return formatNull(first);
+  }
+  // Counts, frame numbers and times on a whole second are common enough in
+  // logs to skip Grisu2 for them
+  if (char *end = formatIntegral(first, number)) {
+    return end;
+  }
+  return nlohmann::detail::to_chars(first, first + maxFormattedNumberLength,
+                                    number);
+}
+
+char *formatFloat(char *first, float number) {
+  if (!std::isfinite(number)) {
+    return formatNull(first);
+  }
+  if (char *end = formatIntegral(first, number)) {
+    return end;
+  }
+  // The shortest form of this float reads back through strtod as a double
+  // which rounds to its neighbour, so write it in full
+  if (number == 7.0385307e-26f || number == -7.0385307e-26f) {
+    return formatDouble(first, number);
+  }
+  if (std::signbit(number)) {
+    *first++ = '-';
+    number = -number;
+  }
+  // Grisu2 with float boundaries gives the shortest digits, they are laid out
+  // as for a double so that the output is never longer than AS_DOUBLE
+  int length = 0;
+  int decimalExponent = 0;
+  nlohmann::detail::dtoa_impl::grisu2(first, length, decimalExponent, number);
+  return nlohmann::detail::dtoa_impl::format_buffer(
+      first, length, decimalExponent, minFixedExponent, maxFixedExponent);
+}
+
+char *formatInteger(char *first, const int64_t number) {
+  if (number < 0) {
+    *first++ = '-';
+    // Negate in unsigned arithmetic so that INT64_MIN is handled
+    return formatUnsigned(first, 0 - static_cast<uint64_t>(number));
+  }
+  return formatUnsigned(first, static_cast<uint64_t>(number));
+}
+
+char *formatUnsigned(char *first, uint64_t number) {
+  char buffer[20];
+  char *end = buffer + sizeof(buffer);
+  char *begin = end;
+  do {
+    *--begin = static_cast<char>('0' + number % 10);
+    number /= 10;
+  } while (number != 0);
+  const auto length = static_cast<size_t>(end - begin);
+  std::memcpy(first, begin, length);
+  return first + length;
+}
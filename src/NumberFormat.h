@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// How JsonWriter formats values held as float
+enum class FloatFormat {
+  // As a double, which is how nlohmann::json stores every floating point
+  // value, so the output matches nlohmann::json::dump()
+  AS_DOUBLE,
+  // The fewest digits which read back as the same float, for example 0.37
+  // rather than 0.3700000047683716
+  SHORTEST_FLOAT32
+};
+
+// Upper bound on the number of characters written by the functions below
+constexpr size_t maxFormattedNumberLength = 32;
+
+// Shortest representation which reads back as the same double, in the format
+// used by nlohmann::json::dump(). Non-finite values are written as null.
+// Each function returns a pointer to the character after the last one written.
+char *formatDouble(char *first, double number);
+// As formatDouble, but the shortest representation which reads back as the
+// same float
+char *formatFloat(char *first, float number);
+char *formatInteger(char *first, int64_t number);
+char *formatUnsigned(char *first, uint64_t number);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+// Destination for serialised command messages
+class OutputSink {
+public:
+  virtual ~OutputSink() = default;
+  virtual void write(const char *data, size_t size) = 0;
+};
+
+// Appends to a caller owned buffer, the buffer is not cleared so that several
+// messages can be accumulated in it
+class StringSink : public OutputSink {
+public:
+  explicit StringSink(std::string &buffer) : m_buffer(buffer) {}
+  void write(const char *data, size_t size) override {
+    m_buffer.append(data, size);
+  }
+
+private:
+  std::string &m_buffer;
+};
+
+class StreamSink : public OutputSink {
+public:
+  explicit StreamSink(std::ostream &stream) : m_stream(stream) {}
+  void write(const char *data, size_t size) override {
+    m_stream.write(data, static_cast<std::streamsize>(size));
+  }
+
+private:
+  std::ostream &m_stream;
+};
+
+// Hands each serialised chunk to a callback, for example a Kafka producer.
+// The data pointer is only valid for the duration of the call.
+class CallbackSink : public OutputSink {
+public:
+  using Callback = std::function<void(const char *data, size_t size)>;
+  explicit CallbackSink(Callback callback) : m_callback(std::move(callback)) {}
+  void write(const char *data, size_t size) override {
+    m_callback(data, size);
+  }
+
+private:
+  Callback m_callback;
+};
@@ -0,0 +1,295 @@
+#include "Periods.h"
+#include "NexusTypes.h"
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+void append(std::vector<T> &values, std::vector<T> &&newValues) {
+  if (values.empty()) {
+    values = std::move(newValues);
+  } else {
+    values.insert(values.end(), std::make_move_iterator(newValues.begin()),
+                  std::make_move_iterator(newValues.end()));
+  }
+}
+
+void checkLength(const char *name, const size_t length, const size_t size) {
+  if (length != size) {
+    throw std::runtime_error("Period column " + std::string(name) + " has " +
+                             std::to_string(length) + " values but there are " +
+                             std::to_string(size) + " periods");
+  }
+}
+
+void writeValues(JsonWriter &writer, const int32_t value) {
+  writer.value(value);
+}
+
+// One period is written as a scalar, as a single value always has been
+template <typename T>
+void writeValues(JsonWriter &writer, const std::vector<T> &values) {
+  if (values.size() == 1) {
+    writer.value(values.front());
+  } else {
+    writer.array(values.data(), values.size());
+  }
+}
+
+void writeValues(JsonWriter &writer, const std::vector<std::string> &values) {
+  if (values.size() == 1) {
+    writer.value(values.front());
+    return;
+  }
+  writer.startArray();
+  for (const auto &value : values) {
+    writer.value(value);
+  }
+  writer.endArray();
+}
+
+nlohmann::json valuesToJson(const int32_t value) { return value; }
+
+template <typename T>
+nlohmann::json valuesToJson(const std::vector<T> &values) {
+  if (values.size() == 1) {
+    return values.front();
+  }
+  return values;
+}
+
+// The type of each dataset is that of its values, see NexusTypes.h
+template <typename T>
+void writeDataset(JsonWriter &writer, const char *name, const T &values,
+                  const char *units = nullptr) {
+  // Keys in sorted order, matching createDataset() in the builder
+  writer.startObject();
+  if (units != nullptr) {
+    writer.key("attributes");
+    writer.startArray();
+    writer.startObject();
+    writer.key("name");
+    writer.value("units");
+    writer.key("values");
+    writer.value(units);
+    writer.endObject();
+    writer.endArray();
+  }
+  writer.key("dataset");
+  writer.startObject();
+  writer.key("size");
+  writer.startArray();
+  writer.value("unlimited");
+  writer.endArray();
+  writer.key("type");
+  writer.value(nexusTypeName<T>());
+  writer.endObject();
+  writer.key("name");
+  writer.value(name);
+  writer.key("type");
+  writer.value("dataset");
+  writer.key("values");
+  writeValues(writer, values);
+  writer.endObject();
+}
+
+template <typename T>
+nlohmann::json datasetToJson(const char *name, const T &values,
+                             const char *units = nullptr) {
+  nlohmann::json dataset = {
+      {"name", name},
+      {"type", "dataset"},
+      {"values", valuesToJson(values)},
+      {"dataset", {{"type", nexusTypeName<T>()}, {"size", {"unlimited"}}}}};
+  if (units != nullptr) {
+    dataset["attributes"] = nlohmann::json::array(
+        {nlohmann::json{{"name", "units"}, {"values", units}}});
+  }
+  return dataset;
+}
+
+int64_t sum(const std::vector<int32_t> &values) {
+  int64_t total = 0;
+  for (const auto value : values) {
+    total += value;
+  }
+  return total;
+}
+
+// Totals are kept in 64 bits, as the frames of many periods can add up to
+// more than the int32 dataset they are written to holds
+int64_t checkedTotal(const char *name, const int64_t total,
+                     const int64_t added) {
+  const auto newTotal = total + added;
+  if (newTotal < std::numeric_limits<int32_t>::min() ||
+      newTotal > std::numeric_limits<int32_t>::max()) {
+    throw std::runtime_error("Total " + std::string(name) + " of " +
+                             std::to_string(newTotal) +
+                             " does not fit in int32");
+  }
+  return newTotal;
+}
+}
+
+size_t PeriodColumns::size() const {
+  const auto size = output.size();
+  checkLength("total_counts", totalCountsInMegaElectronVolts.size(), size);
+  checkLength("proton_charge", protonChargeInMicroAmpHours.size(), size);
+  checkLength("good_frames_daq", goodFramesDaq.size(), size);
+  checkLength("sequences", sequences.size(), size);
+  checkLength("frames_requested", framesRequested.size(), size);
+  checkLength("good_frames", goodFrames.size(), size);
+  checkLength("number", number.size(), size);
+  checkLength("highest_used", highestUsed.size(), size);
+  checkLength("labels", labels.size(), size);
+  checkLength("proton_charge_raw", protonChargeRawInMicroAmpHours.size(), size);
+  checkLength("type", type.size(), size);
+  checkLength("raw_frames", rawFrames.size(), size);
+  return size;
+}
+
+void Periods::add(Period period) {
+  const auto goodFrames =
+      checkedTotal("good_frames", m_goodFrames, period.goodFrames);
+  const auto rawFrames =
+      checkedTotal("raw_frames", m_rawFrames, period.rawFrames);
+  m_periods.output.push_back(period.output);
+  m_periods.totalCountsInMegaElectronVolts.push_back(
+      period.totalCountsInMegaElectronVolts);
+  m_periods.protonChargeInMicroAmpHours.push_back(
+      period.protonChargeInMicroAmpHours);
+  m_periods.goodFramesDaq.push_back(period.goodFramesDaq);
+  m_periods.sequences.push_back(period.sequences);
+  m_periods.framesRequested.push_back(period.framesRequested);
+  m_periods.goodFrames.push_back(period.goodFrames);
+  m_periods.number.push_back(period.number);
+  m_periods.highestUsed.push_back(period.highestUsed);
+  m_periods.labels.push_back(std::move(period.label));
+  m_periods.protonChargeRawInMicroAmpHours.push_back(
+      period.protonChargeRawInMicroAmpHours);
+  m_periods.type.push_back(period.type);
+  m_periods.rawFrames.push_back(period.rawFrames);
+  m_goodFrames = goodFrames;
+  m_rawFrames = rawFrames;
+}
+
+void Periods::add(PeriodColumns periods) {
+  // Check every column before appending any of them
+  periods.size();
+  const auto goodFrames =
+      checkedTotal("good_frames", m_goodFrames, sum(periods.goodFrames));
+  const auto rawFrames =
+      checkedTotal("raw_frames", m_rawFrames, sum(periods.rawFrames));
+  append(m_periods.output, std::move(periods.output));
+  append(m_periods.totalCountsInMegaElectronVolts,
+         std::move(periods.totalCountsInMegaElectronVolts));
+  append(m_periods.protonChargeInMicroAmpHours,
+         std::move(periods.protonChargeInMicroAmpHours));
+  append(m_periods.goodFramesDaq, std::move(periods.goodFramesDaq));
+  append(m_periods.sequences, std::move(periods.sequences));
+  append(m_periods.framesRequested, std::move(periods.framesRequested));
+  append(m_periods.goodFrames, std::move(periods.goodFrames));
+  append(m_periods.number, std::move(periods.number));
+  append(m_periods.highestUsed, std::move(periods.highestUsed));
+  append(m_periods.labels, std::move(periods.labels));
+  append(m_periods.protonChargeRawInMicroAmpHours,
+         std::move(periods.protonChargeRawInMicroAmpHours));
+  append(m_periods.type, std::move(periods.type));
+  append(m_periods.rawFrames, std::move(periods.rawFrames));
+  m_goodFrames = goodFrames;
+  m_rawFrames = rawFrames;
+}
+
+
+void Periods::writeGroup(JsonWriter &writer) const {
+  // Keys in sorted order, matching createGroup() in the builder
+  writer.startObject();
+  writer.key("attributes");
+  writer.startArray();
+  writer.startObject();
+  writer.key("name");
+  writer.value("NX_class");
+  writer.key("values");
+  writer.value("IXperiods");
+  writer.endObject();
+  writer.endArray();
+  writer.key("children");
+  writer.startArray();
+  writeDataset(writer, "output", m_periods.output);
+  writeDataset(writer, "total_counts", m_periods.totalCountsInMegaElectronVolts,
+               "Mev");
+  writeDataset(writer, "proton_charge", m_periods.protonChargeInMicroAmpHours,
+               "uAh");
+  writeDataset(writer, "good_frames_daq", m_periods.goodFramesDaq);
+  writeDataset(writer, "sequences", m_periods.sequences);
+  writeDataset(writer, "frames_requested", m_periods.framesRequested);
+  writeDataset(writer, "good_frames", m_periods.goodFrames);
+  writeDataset(writer, "number", m_periods.number);
+  writeDataset(writer, "highest_used", m_periods.highestUsed);
+  writeDataset(writer, "labels", m_periods.labels);
+  writeDataset(writer, "proton_charge_raw",
+               m_periods.protonChargeRawInMicroAmpHours, "uAh");
+  writeDataset(writer, "type", m_periods.type);
+  writeDataset(writer, "raw_frames", m_periods.rawFrames);
+  writer.endArray();
+  writer.key("name");
+  writer.value("periods");
+  writer.key("type");
+  writer.value("group");
+  writer.endObject();
+}
+
+nlohmann::json Periods::groupToJson() const {
+  nlohmann::json group = {{"name", "periods"}, {"type", "group"}};
+  group["attributes"] = nlohmann::json::array(
+      {nlohmann::json{{"name", "NX_class"}, {"values", "IXperiods"}}});
+  group["children"] = {
+      datasetToJson("output", m_periods.output),
+      datasetToJson("total_counts", m_periods.totalCountsInMegaElectronVolts,
+                    "Mev"),
+      datasetToJson("proton_charge", m_periods.protonChargeInMicroAmpHours,
+                    "uAh"),
+      datasetToJson("good_frames_daq", m_periods.goodFramesDaq),
+      datasetToJson("sequences", m_periods.sequences),
+      datasetToJson("frames_requested", m_periods.framesRequested),
+      datasetToJson("good_frames", m_periods.goodFrames),
+      datasetToJson("number", m_periods.number),
+      datasetToJson("highest_used", m_periods.highestUsed),
+      datasetToJson("labels", m_periods.labels),
+      datasetToJson("proton_charge_raw",
+                    m_periods.protonChargeRawInMicroAmpHours, "uAh"),
+      datasetToJson("type", m_periods.type),
+      datasetToJson("raw_frames", m_periods.rawFrames)};
+  return group;
+}
+
+PeriodsNode::PeriodsNode(std::shared_ptr<const Periods> periods,
+                         const Part part)
+    : m_periods(std::move(periods)), m_part(part) {}
+
+void PeriodsNode::write(JsonWriter &writer) const {
+  switch (m_part) {
+  case Part::GROUP:
+    m_periods->writeGroup(writer);
+    break;
+  case Part::GOOD_FRAMES:
+    writeDataset(writer, "good_frames", m_periods->goodFrames());
+    break;
+  case Part::RAW_FRAMES:
+    writeDataset(writer, "raw_frames", m_periods->rawFrames());
+    break;
+  }
+}
+
+nlohmann::json PeriodsNode::toJson() const {
+  switch (m_part) {
+  case Part::GROUP:
+    return m_periods->groupToJson();
+  case Part::GOOD_FRAMES:
+    return datasetToJson("good_frames", m_periods->goodFrames());
+  case Part::RAW_FRAMES:
+    return datasetToJson("raw_frames", m_periods->rawFrames());
+  }
+  return nullptr;
+}
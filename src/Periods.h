@@ -0,0 +1,89 @@
+#pragma once
+
+#include "DeferredNode.h"
+#include "JsonWriter.h"
+#include <cstdint>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+// The values for a single period, as passed to addPeriod
+struct Period {
+  int32_t output = 0;
+  float totalCountsInMegaElectronVolts = 0.0f;
+  float protonChargeInMicroAmpHours = 0.0f;
+  int32_t goodFramesDaq = 0;
+  int32_t sequences = 0;
+  int32_t framesRequested = 0;
+  int32_t goodFrames = 0;
+  int32_t number = 0;
+  int32_t highestUsed = 0;
+  std::string label;
+  float protonChargeRawInMicroAmpHours = 0.0f;
+  int32_t type = 0;
+  int32_t rawFrames = 0;
+};
+
+// Any number of periods held as one array per field, element i of each array
+// belongs to period i
+struct PeriodColumns {
+  std::vector<int32_t> output;
+  std::vector<float> totalCountsInMegaElectronVolts;
+  std::vector<float> protonChargeInMicroAmpHours;
+  std::vector<int32_t> goodFramesDaq;
+  std::vector<int32_t> sequences;
+  std::vector<int32_t> framesRequested;
+  std::vector<int32_t> goodFrames;
+  std::vector<int32_t> number;
+  std::vector<int32_t> highestUsed;
+  std::vector<std::string> labels;
+  std::vector<float> protonChargeRawInMicroAmpHours;
+  std::vector<int32_t> type;
+  std::vector<int32_t> rawFrames;
+
+  // The number of periods, throws std::runtime_error if the arrays are not
+  // all the same length
+  size_t size() const;
+};
+
+// The periods of a run, which make up the IXperiods group and the entry's
+// good_frames and raw_frames. Each field of the group is a single dataset
+// holding the value for every period, a run with one period has scalar
+// datasets.
+class Periods {
+public:
+  // Throws std::runtime_error, adding nothing, if the total good_frames or
+  // raw_frames would not fit in int32
+  void add(Period period);
+  void add(PeriodColumns periods);
+
+  size_t size() const { return m_periods.output.size(); }
+
+  // Totals over every period, as written to the entry
+  int32_t goodFrames() const { return static_cast<int32_t>(m_goodFrames); }
+  int32_t rawFrames() const { return static_cast<int32_t>(m_rawFrames); }
+
+  void writeGroup(JsonWriter &writer) const;
+  nlohmann::json groupToJson() const;
+
+private:
+  PeriodColumns m_periods;
+  int64_t m_goodFrames = 0;
+  int64_t m_rawFrames = 0;
+};
+
+// One of the entry's children made from the periods
+class PeriodsNode : public DeferredNode {
+public:
+  enum class Part { GROUP, GOOD_FRAMES, RAW_FRAMES };
+
+  PeriodsNode(std::shared_ptr<const Periods> periods, Part part);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+
+private:
+  const std::shared_ptr<const Periods> m_periods;
+  const Part m_part;
+};
@@ -0,0 +1,162 @@
+#include "PublishPipeline.h"
+#include <algorithm>
+
+PublishPipeline::PublishPipeline(MessageProducer &producer, std::string topic,
+                                 size_t numberOfThreads,
+                                 const size_t queueCapacity,
+                                 const size_t maxBatchSize)
+    : m_producer(producer), m_topic(std::move(topic)),
+      m_queueCapacity(std::max<size_t>(1, queueCapacity)),
+      m_maxBatchSize(std::max<size_t>(1, maxBatchSize)) {
+  if (numberOfThreads == 0) {
+    numberOfThreads = 1;
+  }
+  for (size_t i = 0; i < numberOfThreads; i++) {
+    m_serialisers.emplace_back(&PublishPipeline::serialiserLoop, this);
+  }
+  m_deliverer = std::thread(&PublishPipeline::deliveryLoop, this);
+}
+
+PublishPipeline::~PublishPipeline() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_jobAvailable.notify_all();
+  m_payloadAvailable.notify_all();
+  for (auto &serialiser : m_serialisers) {
+    serialiser.join();
+  }
+  m_deliverer.join();
+}
+
+bool PublishPipeline::tryPublish(
+    std::shared_ptr<const NexusWriteCommandBuilder> builder,
+    const Command command) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_nextSequence - m_delivered >= m_queueCapacity) {
+      return false;
+    }
+    queueJob(std::move(builder), command);
+  }
+  m_jobAvailable.notify_one();
+  return true;
+}
+
+void PublishPipeline::publish(
+    std::shared_ptr<const NexusWriteCommandBuilder> builder,
+    const Command command) {
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_spaceAvailable.wait(lock, [this] {
+      return m_nextSequence - m_delivered < m_queueCapacity;
+    });
+    queueJob(std::move(builder), command);
+  }
+  m_jobAvailable.notify_one();
+}
+
+void PublishPipeline::flush() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const auto published = m_nextSequence;
+  m_spaceAvailable.wait(lock, [this, published] {
+    return m_delivered >= published;
+  });
+  if (m_error) {
+    std::exception_ptr error;
+    std::swap(error, m_error);
+    std::rethrow_exception(error);
+  }
+}
+
+void PublishPipeline::queueJob(
+    std::shared_ptr<const NexusWriteCommandBuilder> builder,
+    const Command command) {
+  m_jobs.push_back({m_nextSequence++, std::move(builder), command});
+}
+
+void PublishPipeline::serialiserLoop() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_jobAvailable.wait(lock,
+                          [this] { return m_stopping || !m_jobs.empty(); });
+      if (m_jobs.empty()) {
+        return;
+      }
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+
+    std::unique_ptr<std::string> payload(new std::string);
+    try {
+      if (job.command == Command::START) {
+        job.builder->writeStartMessage(*payload, JsonWriter::COMPACT);
+      } else {
+        job.builder->writeStopMessage(*payload, JsonWriter::COMPACT);
+      }
+    } catch (...) {
+      payload.reset();
+      setError(std::current_exception());
+    }
+    // Release the builder here rather than on the delivery thread
+    job.builder.reset();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_payloads.emplace(job.sequence, std::move(payload));
+    }
+    m_payloadAvailable.notify_one();
+  }
+}
+
+void PublishPipeline::deliveryLoop() {
+  std::vector<PublishedMessage> batch;
+  uint64_t next = 0;
+  while (true) {
+    batch.clear();
+    size_t numberOfMessages = 0;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_payloadAvailable.wait(lock, [this, next] {
+        return m_payloads.count(next) != 0 ||
+               (m_stopping && m_nextSequence == next);
+      });
+      if (m_payloads.count(next) == 0) {
+        return;
+      }
+      // Everything which is ready in sequence, up to a full batch
+      for (auto payload = m_payloads.find(next);
+           payload != m_payloads.end() && payload->first == next &&
+           numberOfMessages < m_maxBatchSize;
+           payload = m_payloads.erase(payload), next++, numberOfMessages++) {
+        if (payload->second) {
+          batch.push_back({m_topic, std::move(*payload->second)});
+        }
+      }
+    }
+
+    try {
+      if (!batch.empty()) {
+        m_producer.produce(batch);
+      }
+    } catch (...) {
+      setError(std::current_exception());
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_delivered = next;
+    }
+    m_spaceAvailable.notify_all();
+  }
+}
+
+void PublishPipeline::setError(std::exception_ptr error) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_error) {
+    m_error = std::move(error);
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "MessageProducer.h"
+#include "NexusWriteCommandBuilder.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Serialises the command messages of finished builders on worker threads and
+// hands them to a producer from a single delivery thread, in the order they
+// were published. Messages which are ready together are delivered as one
+// batch. At most queueCapacity messages are in the pipeline at once, from
+// being published until they have been delivered.
+//
+// A builder must not be modified once it has been published.
+class PublishPipeline {
+public:
+  enum class Command { START, STOP };
+
+  PublishPipeline(MessageProducer &producer, std::string topic,
+                  size_t numberOfThreads, size_t queueCapacity = 64,
+                  size_t maxBatchSize = 16);
+  // Delivers every message which has already been published
+  ~PublishPipeline();
+
+  PublishPipeline(const PublishPipeline &) = delete;
+  PublishPipeline &operator=(const PublishPipeline &) = delete;
+
+  // Never blocks, returns false without queueing the message if the pipeline
+  // is full
+  bool tryPublish(std::shared_ptr<const NexusWriteCommandBuilder> builder,
+                  Command command = Command::START);
+  // Blocks while the pipeline is full
+  void publish(std::shared_ptr<const NexusWriteCommandBuilder> builder,
+               Command command = Command::START);
+
+  // Block until every message published so far has been delivered. Rethrows
+  // the first serialisation or delivery error since the last flush, the
+  // messages it affected are dropped.
+  void flush();
+
+private:
+  struct Job {
+    uint64_t sequence;
+    std::shared_ptr<const NexusWriteCommandBuilder> builder;
+    Command command;
+  };
+
+  void queueJob(std::shared_ptr<const NexusWriteCommandBuilder> builder,
+                Command command);
+  void serialiserLoop();
+  void deliveryLoop();
+  void setError(std::exception_ptr error);
+
+  MessageProducer &m_producer;
+  const std::string m_topic;
+  const size_t m_queueCapacity;
+  const size_t m_maxBatchSize;
+
+  std::mutex m_mutex;
+  std::condition_variable m_jobAvailable;
+  std::condition_variable m_payloadAvailable;
+  std::condition_variable m_spaceAvailable;
+  std::deque<Job> m_jobs;
+  // Serialised messages waiting for those before them, keyed by sequence
+  // number. A message which could not be serialised is null.
+  std::map<uint64_t, std::unique_ptr<std::string>> m_payloads;
+  uint64_t m_nextSequence = 0;
+  // Every message before this one has been delivered, or dropped
+  uint64_t m_delivered = 0;
+  std::exception_ptr m_error;
+  bool m_stopping = false;
+
+  std::vector<std::thread> m_serialisers;
+  std::thread m_deliverer;
+};
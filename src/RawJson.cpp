@@ -0,0 +1,281 @@
+#include "RawJson.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// The characters which skipValue stops at inside an object or array
+std::array<bool, 256> makeStructuralCharacters() {
+  std::array<bool, 256> structural{};
+  for (const unsigned char character : {'"', '{', '}', '[', ']'}) {
+    structural[character] = true;
+  }
+  return structural;
+}
+
+const std::array<bool, 256> structuralCharacters = makeStructuralCharacters();
+
+// Whether any byte of word is character, eight bytes at a time
+bool hasByte(const uint64_t word, const char character) {
+  const uint64_t ones = 0x0101010101010101;
+  const auto bytes = word ^ (ones * static_cast<unsigned char>(character));
+  return ((bytes - ones) & ~bytes & (ones << 7)) != 0;
+}
+
+// Position of the first structural character at or after position
+size_t findStructural(const StringRef json, size_t position) {
+  const char *data = json.data();
+  for (uint64_t word; position + sizeof(word) <= json.size();
+       position += sizeof(word)) {
+    std::memcpy(&word, data + position, sizeof(word));
+    if (hasByte(word, '"') || hasByte(word, '{') || hasByte(word, '}') ||
+        hasByte(word, '[') || hasByte(word, ']')) {
+      break;
+    }
+  }
+  while (position < json.size() &&
+         !structuralCharacters[static_cast<unsigned char>(data[position])]) {
+    position++;
+  }
+  return position;
+}
+
+[[noreturn]] void throwMalformed(const char *expected, const size_t position) {
+  throw std::runtime_error("Malformed JSON, expected " + std::string(expected) +
+                           " at offset " + std::to_string(position));
+}
+
+bool isWhitespace(const char character) {
+  return character == ' ' || character == '\n' || character == '\r' ||
+         character == '\t';
+}
+
+size_t skipWhitespace(const StringRef json, size_t position) {
+  while (position < json.size() && isWhitespace(json.data()[position])) {
+    position++;
+  }
+  return position;
+}
+
+// position is that of the opening quote, returns the position after the
+// closing one
+size_t skipString(const StringRef json, size_t position) {
+  const char *data = json.data();
+  for (position++; position < json.size(); position++) {
+    if (data[position] == '\\') {
+      position++;
+    } else if (data[position] == '"') {
+      return position + 1;
+    }
+  }
+  throwMalformed("the end of a string", position);
+}
+
+// Returns the position after the value which starts at position
+size_t skipValue(const StringRef json, size_t position) {
+  const char *data = json.data();
+  if (position >= json.size()) {
+    throwMalformed("a value", position);
+  }
+  switch (data[position]) {
+  case '"':
+    return skipString(json, position);
+  case '{':
+  case '[': {
+    size_t depth = 0;
+    for (; position < json.size(); position++) {
+      // Step over numbers and separators, most of a large array
+      position = findStructural(json, position);
+      if (position == json.size()) {
+        break;
+      }
+      switch (data[position]) {
+      case '"':
+        position = skipString(json, position) - 1;
+        break;
+      case '{':
+      case '[':
+        depth++;
+        break;
+      case '}':
+      case ']':
+        if (--depth == 0) {
+          return position + 1;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+    throwMalformed("the end of an object or array", position);
+  }
+  default: {
+    // A number, true, false or null
+    const auto start = position;
+    while (position < json.size() && data[position] != ',' &&
+           data[position] != '}' && data[position] != ']' &&
+           !isWhitespace(data[position])) {
+      position++;
+    }
+    if (position == start) {
+      throwMalformed("a value", position);
+    }
+    return position;
+  }
+  }
+}
+
+// Position after the separator which follows a member or element, or npos at
+// the closing bracket
+size_t nextItem(const StringRef json, size_t position, const char closing) {
+  position = skipWhitespace(json, position);
+  if (position < json.size() && json.data()[position] == ',') {
+    return skipWhitespace(json, position + 1);
+  }
+  if (position < json.size() && json.data()[position] == closing) {
+    return StringRef::npos;
+  }
+  throwMalformed(closing == '}' ? "',' or '}'" : "',' or ']'", position);
+}
+
+// Position of the first member or element, or npos if there are none
+size_t firstItem(const StringRef json, const char opening,
+                 const char closing) {
+  if (json.empty() || json.data()[0] != opening) {
+    throwMalformed(opening == '{' ? "an object" : "an array", 0);
+  }
+  const auto position = skipWhitespace(json, 1);
+  if (position < json.size() && json.data()[position] == closing) {
+    return StringRef::npos;
+  }
+  return position;
+}
+
+// Calls visit(key, value) for each member until it returns false
+template <typename F> void visitMembers(const StringRef object, F visit) {
+  for (auto position = firstItem(object, '{', '}');
+       position != StringRef::npos;
+       position = nextItem(object, position, '}')) {
+    if (position >= object.size() || object.data()[position] != '"') {
+      throwMalformed("a key", position);
+    }
+    const auto keyEnd = skipString(object, position);
+    const StringRef key(object.data() + position + 1, keyEnd - position - 2);
+    position = skipWhitespace(object, keyEnd);
+    if (position >= object.size() || object.data()[position] != ':') {
+      throwMalformed("':'", position);
+    }
+    position = skipWhitespace(object, position + 1);
+    const auto valueEnd = skipValue(object, position);
+    const StringRef value(object.data() + position, valueEnd - position);
+    if (!visit(key, value)) {
+      return;
+    }
+    position = valueEnd;
+  }
+}
+}
+
+void compactJson(std::string &json) {
+  size_t output = 0;
+  bool inString = false;
+  for (size_t i = 0; i < json.size(); i++) {
+    const char character = json[i];
+    if (inString) {
+      json[output++] = character;
+      if (character == '\\' && i + 1 < json.size()) {
+        json[output++] = json[++i];
+      } else if (character == '"') {
+        inString = false;
+      }
+      continue;
+    }
+    if (isWhitespace(character)) {
+      continue;
+    }
+    if (character == '"') {
+      inString = true;
+    }
+    json[output++] = character;
+  }
+  json.resize(output);
+}
+
+void forEachRawMember(
+    const StringRef object,
+    const std::function<void(StringRef key, StringRef value)> &function) {
+  visitMembers(object, [&](const StringRef key, const StringRef value) {
+    function(key, value);
+    return true;
+  });
+}
+
+void forEachRawElement(const StringRef array,
+                       const std::function<void(StringRef value)> &function) {
+  for (auto position = firstItem(array, '[', ']');
+       position != StringRef::npos; position = nextItem(array, position, ']')) {
+    const auto valueEnd = skipValue(array, position);
+    function(StringRef(array.data() + position, valueEnd - position));
+    position = valueEnd;
+  }
+}
+
+bool findRawMember(const StringRef object, const StringRef key,
+                   StringRef &value) {
+  bool found = false;
+  visitMembers(object, [&](const StringRef memberKey,
+                           const StringRef memberValue) {
+    if (memberKey == key) {
+      value = memberValue;
+      found = true;
+    }
+    return !found;
+  });
+  return found;
+}
+
+StringRef rawString(const StringRef value) {
+  if (value.size() < 2 || value.data()[0] != '"' ||
+      value.data()[value.size() - 1] != '"') {
+    throwMalformed("a string", 0);
+  }
+  return {value.data() + 1, value.size() - 2};
+}
+
+StringRef rawNodeName(const StringRef node) {
+  StringRef name("", 0);
+  if (!findRawMember(node, "name", name) || name.empty() ||
+      name.data()[0] != '"') {
+    return {"", 0};
+  }
+  return rawString(name);
+}
+
+RawNodeParts splitRawNode(const StringRef node) {
+  RawNodeParts parts;
+  visitMembers(node, [&](const StringRef key, const StringRef value) {
+    if (key == "name" && !value.empty() && value.data()[0] == '"') {
+      parts.name = rawString(value);
+    } else if (key == "children") {
+      parts.children = value;
+    } else {
+      parts.otherMembers.emplace_back(key, value);
+    }
+    return true;
+  });
+  return parts;
+}
+
+RawJsonNode::RawJsonNode(std::shared_ptr<const std::string> document,
+                         const StringRef node, const StringRef name)
+    : m_document(std::move(document)), m_node(node), m_name(name) {}
+
+void RawJsonNode::write(JsonWriter &writer) const {
+  writer.rawValue(m_node.data(), m_node.size());
+}
+
+nlohmann::json RawJsonNode::toJson() const {
+  return nlohmann::json::parse(m_node.data(), m_node.data() + m_node.size());
+}
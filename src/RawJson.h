@@ -0,0 +1,71 @@
+#pragma once
+
+#include "DeferredNode.h"
+#include "StringRef.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Locating values in serialised JSON without building a DOM. A value is
+// skipped by matching brackets outside of strings, so stepping over a large
+// array is a scan of its bytes rather than a parse. Keys are compared as they
+// appear in the document, escapes in them are not decoded. Throws
+// std::runtime_error for malformed JSON.
+
+// Remove the whitespace between tokens in place, giving the compact form
+// that JsonWriter::rawValue takes
+void compactJson(std::string &json);
+
+// Call function with each key and value of an object, or each element of an
+// array, in document order. The views refer into json.
+void forEachRawMember(StringRef object,
+                      const std::function<void(StringRef key, StringRef value)>
+                          &function);
+void forEachRawElement(StringRef array,
+                       const std::function<void(StringRef value)> &function);
+
+// The value of the named member of an object, returns false if there is none
+bool findRawMember(StringRef object, StringRef key, StringRef &value);
+
+// The contents of a string value between its quotes, as they appear in the
+// document
+StringRef rawString(StringRef value);
+
+// The name member of a node of a file structure, empty if it has none
+StringRef rawNodeName(StringRef node);
+
+// A node of a file structure split into its name and children, either of
+// which is empty if the node has none, and its other members
+struct RawNodeParts {
+  StringRef name{"", 0};
+  StringRef children{"", 0};
+  std::vector<std::pair<StringRef, StringRef>> otherMembers;
+};
+
+// Split a node with a single pass over it
+RawNodeParts splitRawNode(StringRef node);
+
+// A node of a loaded message which is written out exactly as it was read.
+// It is left out of the message once removed, for example when a node of the
+// same name replaces it.
+class RawJsonNode : public DeferredNode {
+public:
+  // node is a compact JSON value within document, name is its rawNodeName
+  RawJsonNode(std::shared_ptr<const std::string> document, StringRef node,
+              StringRef name);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+  bool empty() const override { return m_removed; }
+
+  StringRef name() const { return m_name; }
+  void remove() { m_removed = true; }
+
+private:
+  const std::shared_ptr<const std::string> m_document;
+  const StringRef m_node;
+  const StringRef m_name;
+  bool m_removed = false;
+};
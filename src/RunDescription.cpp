@@ -0,0 +1,330 @@
+#include "RunDescription.h"
+#include "Iso8601.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+bool has(const json &object, const char *key) {
+  return object.find(key) != object.end();
+}
+
+InstrumentConfig instrumentConfig(const json &run) {
+  InstrumentConfig config;
+  config.instrumentName = run.at("instrument").get<std::string>();
+  if (has(run, "monitors")) {
+    for (const auto &monitor : run["monitors"]) {
+      config.monitors.push_back({monitor.at("number").get<uint32_t>(),
+                                 monitor.at("spectrum").get<uint32_t>()});
+    }
+  }
+  if (has(run, "detectors")) {
+    for (const auto &detector : run["detectors"]) {
+      config.detectors.push_back(
+          {detector.at("number").get<uint32_t>(),
+           detector.value("source_detector_distance", 0.0f)});
+    }
+  }
+  if (has(run, "se_log_pvs")) {
+    config.seLogPVs = run["se_log_pvs"].get<std::vector<std::string>>();
+  }
+  return config;
+}
+
+template <typename T>
+void addVmsRecord(NexusWriteCommandBuilder &builder, const std::string &name,
+                  const std::string &type, const json &value) {
+  if (value.is_array()) {
+    builder.addVmsRecord(name, type, value.get<std::vector<T>>());
+  } else {
+    builder.addVmsRecord(name, type, value.get<T>());
+  }
+}
+
+void addVmsRecord(NexusWriteCommandBuilder &builder, const json &record) {
+  const auto name = record.at("name").get<std::string>();
+  const auto type = record.at("type").get<std::string>();
+  const auto &value = record.at("value");
+  if (type == "string") {
+    builder.addVmsRecord<std::string>(name, type, value.get<std::string>());
+  } else if (type == "int32") {
+    addVmsRecord<int32_t>(builder, name, type, value);
+  } else if (type == "int64") {
+    addVmsRecord<int64_t>(builder, name, type, value);
+  } else if (type == "float") {
+    addVmsRecord<float>(builder, name, type, value);
+  } else if (type == "double") {
+    addVmsRecord<double>(builder, name, type, value);
+  } else {
+    throw std::runtime_error("Unsupported type " + type +
+                             " for VMS record " + name);
+  }
+}
+
+enum class LogKind { RUNLOG, FRAMELOG };
+
+// Log times are either relative to the start time or absolute timestamps
+std::vector<float> logTimes(const json &log, const std::string &startTime) {
+  if (has(log, "timestamps")) {
+    return relativeLogTimes(
+        startTime, log["timestamps"].get<std::vector<std::string>>());
+  }
+  return log.at("times").get<std::vector<float>>();
+}
+
+template <typename T>
+void addLogRecord(NexusWriteCommandBuilder &builder, const LogKind kind,
+                  const std::string &name, const std::string &type,
+                  T values, const json &record) {
+  const auto startTime = record.at("start_time").get<std::string>();
+  auto times = logTimes(record, startTime);
+  const auto units = record.value("units", std::string());
+  if (kind == LogKind::RUNLOG) {
+    builder.addRunlogRecord<T>(name, type, std::move(values), std::move(times),
+                               startTime, units);
+  } else {
+    builder.addFramelogRecord<T>(name, type, std::move(values),
+                                 std::move(times), startTime, units);
+  }
+}
+
+void addLogRecord(NexusWriteCommandBuilder &builder, const LogKind kind,
+                  const json &record) {
+  const auto name = record.at("name").get<std::string>();
+  const auto type = record.at("type").get<std::string>();
+  const auto &values = record.at("values");
+  if (type == "string") {
+    addLogRecord(builder, kind, name, type, values.get<std::string>(),
+                 record);
+  } else if (type == "int32") {
+    addLogRecord(builder, kind, name, type,
+                 values.get<std::vector<int32_t>>(), record);
+  } else if (type == "int64") {
+    addLogRecord(builder, kind, name, type,
+                 values.get<std::vector<int64_t>>(), record);
+  } else if (type == "float") {
+    addLogRecord(builder, kind, name, type, values.get<std::vector<float>>(),
+                 record);
+  } else if (type == "double") {
+    addLogRecord(builder, kind, name, type,
+                 values.get<std::vector<double>>(), record);
+  } else {
+    throw std::runtime_error("Unsupported type " + type + " for log " + name);
+  }
+}
+
+template <typename T>
+void addLogColumn(LogColumns &columns, const json &column) {
+  columns.addColumn(column.at("name").get<std::string>(),
+                    column.at("type").get<std::string>(),
+                    column.at("values").get<std::vector<T>>(),
+                    column.value("units", std::string()));
+}
+
+void addLogColumns(NexusWriteCommandBuilder &builder, const LogKind kind,
+                   const json &batch) {
+  const auto startTime = batch.at("start_time").get<std::string>();
+  LogColumns columns(logTimes(batch, startTime), startTime);
+  for (const auto &column : batch.at("columns")) {
+    const auto type = column.at("type").get<std::string>();
+    if (type == "int32") {
+      addLogColumn<int32_t>(columns, column);
+    } else if (type == "int64") {
+      addLogColumn<int64_t>(columns, column);
+    } else if (type == "float") {
+      addLogColumn<float>(columns, column);
+    } else if (type == "double") {
+      addLogColumn<double>(columns, column);
+    } else {
+      throw std::runtime_error("Unsupported type " + type + " for log column " +
+                               column.at("name").get<std::string>());
+    }
+  }
+  if (kind == LogKind::RUNLOG) {
+    builder.addRunlogColumns(std::move(columns));
+  } else {
+    builder.addFramelogColumns(std::move(columns));
+  }
+}
+
+// Periods given as one array per field
+void addPeriodColumns(NexusWriteCommandBuilder &builder, const json &periods) {
+  PeriodColumns columns;
+  columns.output = periods.at("output").get<std::vector<int32_t>>();
+  columns.totalCountsInMegaElectronVolts =
+      periods.at("total_counts").get<std::vector<float>>();
+  columns.protonChargeInMicroAmpHours =
+      periods.at("proton_charge").get<std::vector<float>>();
+  columns.goodFramesDaq =
+      periods.at("good_frames_daq").get<std::vector<int32_t>>();
+  columns.sequences = periods.at("sequences").get<std::vector<int32_t>>();
+  columns.framesRequested =
+      periods.at("frames_requested").get<std::vector<int32_t>>();
+  columns.goodFrames = periods.at("good_frames").get<std::vector<int32_t>>();
+  columns.number = periods.at("number").get<std::vector<int32_t>>();
+  columns.highestUsed =
+      periods.at("highest_used").get<std::vector<int32_t>>();
+  columns.labels = periods.at("labels").get<std::vector<std::string>>();
+  columns.protonChargeRawInMicroAmpHours =
+      periods.at("proton_charge_raw").get<std::vector<float>>();
+  columns.type = periods.at("type").get<std::vector<int32_t>>();
+  columns.rawFrames = periods.at("raw_frames").get<std::vector<int32_t>>();
+  builder.addPeriods(std::move(columns));
+}
+
+std::shared_ptr<const InstrumentSkeleton>
+instrumentSkeleton(const json &run, InstrumentSkeletonCache &skeletons) {
+  if (has(run, "config_id")) {
+    return skeletons.get(run.at("instrument").get<std::string>(),
+                         run["config_id"].get<std::string>(),
+                         [&run] { return instrumentConfig(run); });
+  }
+  return skeletons.get(instrumentConfig(run));
+}
+}
+
+NexusWriteCommandBuilder
+createBuilderFromRunDescription(const json &run,
+                                InstrumentSkeletonCache &skeletons) {
+  NexusWriteCommandBuilder builder(
+      instrumentSkeleton(run, skeletons),
+      run.at("run_number").get<int32_t>(),
+      run.at("broker").get<std::string>(),
+      run.at("run_cycle").get<std::string>(),
+      run.at("start_time").get<std::string>());
+
+  if (has(run, "sample")) {
+    const auto &sample = run["sample"];
+    builder.addSample(
+        sample.at("height").get<float>(), sample.at("thickness").get<float>(),
+        sample.at("width").get<float>(), sample.value("distance", 0.0),
+        sample.value("shape", std::string()),
+        sample.value("name", std::string()),
+        sample.value("type", std::string()), sample.value("id", std::string()));
+  }
+  if (has(run, "end_time")) {
+    builder.addEndTime(run["end_time"].get<std::string>());
+  }
+  if (has(run, "title")) {
+    builder.addTitle(run["title"].get<std::string>());
+  }
+  if (has(run, "total_counts")) {
+    builder.addTotalCounts(run["total_counts"].get<uint64_t>());
+  }
+  if (has(run, "monitor_events_not_saved")) {
+    builder.addMonitorEventsNotSaved(
+        run["monitor_events_not_saved"].get<int64_t>());
+  }
+  if (has(run, "total_uncounted_counts")) {
+    builder.addTotalUncountedCounts(
+        run["total_uncounted_counts"].get<int32_t>());
+  }
+  if (has(run, "measurement")) {
+    const auto &measurement = run["measurement"];
+    builder.addMeasurement(measurement.value("label", std::string()),
+                           measurement.value("id", std::string()),
+                           measurement.value("sub_id", std::string()),
+                           measurement.value("type", std::string()),
+                           measurement.value("first_run", 0));
+  }
+  if (has(run, "collection_time")) {
+    builder.addCollectionTime(run["collection_time"].get<float>());
+  }
+  if (has(run, "duration")) {
+    builder.addDuration(run["duration"].get<float>());
+  }
+  if (has(run, "program_name")) {
+    const auto &program = run["program_name"];
+    builder.addProgramName(program.at("name").get<std::string>(),
+                           program.value("version", std::string()));
+  }
+  if (has(run, "definition")) {
+    const auto &definition = run["definition"];
+    builder.addNexusDefinition(definition.at("name").get<std::string>(),
+                               definition.value("version", std::string()),
+                               definition.value("url", std::string()));
+  }
+  if (has(run, "local_definition")) {
+    const auto &definition = run["local_definition"];
+    builder.addLocalNexusDefinition(definition.at("name").get<std::string>(),
+                                    definition.value("version", std::string()),
+                                    definition.value("url", std::string()));
+  }
+  if (has(run, "proton_charge_raw")) {
+    builder.addProtonChargeRawInMicroAmpHours(
+        run["proton_charge_raw"].get<float>());
+  }
+  if (has(run, "proton_charge")) {
+    builder.addProtonChargeInMicroAmpHours(run["proton_charge"].get<float>());
+  }
+  if (has(run, "seci_config")) {
+    builder.addSeciConfig(run["seci_config"].get<std::string>());
+  }
+  if (has(run, "notes")) {
+    builder.addNotes(run["notes"].get<std::string>());
+  }
+  if (has(run, "experiment_identifier")) {
+    builder.addExperimentIdentifier(
+        run["experiment_identifier"].get<std::string>());
+  }
+  if (has(run, "script_name")) {
+    builder.addScriptName(run["script_name"].get<std::string>());
+  }
+  if (has(run, "users")) {
+    for (const auto &user : run["users"]) {
+      builder.addUser(user.at("name").get<std::string>(),
+                      user.value("affiliation", std::string()));
+    }
+  }
+  if (has(run, "event_sources")) {
+    for (const auto &source : run["event_sources"]) {
+      builder.addEventDataSource(source.at("detector").get<uint32_t>(),
+                                 source.at("source").get<std::string>());
+    }
+  }
+  if (has(run, "periods")) {
+    const auto &periods = run["periods"];
+    if (periods.is_object()) {
+      addPeriodColumns(builder, periods);
+    } else {
+      for (const auto &period : periods) {
+        builder.addPeriods(
+            period.value("output", 0), period.value("total_counts", 0.0f),
+            period.value("proton_charge", 0.0f),
+            period.value("good_frames_daq", 0), period.value("sequences", 0),
+            period.value("frames_requested", 0),
+            period.value("good_frames", 0), period.value("number", 0),
+            period.value("highest_used", 0),
+            period.value("labels", std::string()),
+            period.value("proton_charge_raw", 0.0f), period.value("type", 0),
+            period.value("raw_frames", 0));
+      }
+    }
+  }
+  if (has(run, "vms_records")) {
+    for (const auto &record : run["vms_records"]) {
+      addVmsRecord(builder, record);
+    }
+  }
+  if (has(run, "runlog")) {
+    for (const auto &record : run["runlog"]) {
+      addLogRecord(builder, LogKind::RUNLOG, record);
+    }
+  }
+  if (has(run, "framelog")) {
+    for (const auto &record : run["framelog"]) {
+      addLogRecord(builder, LogKind::FRAMELOG, record);
+    }
+  }
+  if (has(run, "runlog_columns")) {
+    for (const auto &batch : run["runlog_columns"]) {
+      addLogColumns(builder, LogKind::RUNLOG, batch);
+    }
+  }
+  if (has(run, "framelog_columns")) {
+    for (const auto &batch : run["framelog_columns"]) {
+      addLogColumns(builder, LogKind::FRAMELOG, batch);
+    }
+  }
+  return builder;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "InstrumentSkeleton.h"
+#include "NexusWriteCommandBuilder.h"
+#include <nlohmann/json.hpp>
+
+// Create the command builder for a run from a JSON description of it, as
+// used by batch mode. The instrument, run_number, broker, run_cycle and
+// start_time fields are required, the others correspond to the add* methods:
+//
+// {"instrument": "ZOOM", "run_number": 4112, "broker": "livedata",
+//  "run_cycle": "18_2", "start_time": "2018-07-06T09:47:44",
+//  "end_time": "2018-07-06T10:18:21", "title": "MT Beam", "total_counts": 1,
+//  "monitor_events_not_saved": 0, "total_uncounted_counts": 0,
+//  "collection_time": 1837.0, "duration": 1837.0, "seci_config": "",
+//  "notes": "", "experiment_identifier": "0", "script_name": "",
+//  "proton_charge": 20.06, "proton_charge_raw": 20.06,
+//  "program_name": {"name": "ISISICP.EXE", "version": "1"},
+//  "definition": {"name": "TOFRAW", "version": "1.0", "url": "..."},
+//  "local_definition": {"name": "ISISTOFRAW", "version": "1.0", "url": "..."},
+//  "sample": {"height": 6.0, "thickness": 1.0, "width": 6.0, "distance": 0.0,
+//             "shape": "", "name": "", "type": "", "id": ""},
+//  "measurement": {"label": "", "id": "", "sub_id": "", "type": "",
+//                  "first_run": 0},
+//  "users": [{"name": "Alice", "affiliation": "The Unseen University"}],
+//  "event_sources": [{"detector": 1, "source": "ICP"}],
+//  "periods": [{"output": 0, "total_counts": 21.2, "proton_charge": 20.06,
+//               "good_frames_daq": 1, "sequences": 1, "frames_requested": 0,
+//               "good_frames": 1, "number": 1, "highest_used": 1,
+//               "labels": "Period 1", "proton_charge_raw": 20.06,
+//               "type": 1, "raw_frames": 1}],
+//  "vms_records": [{"name": "CRAT", "type": "int32", "value": [0, 1]}],
+//  "runlog": [{"name": "count_rate", "type": "float", "values": [0.0, 40.8],
+//              "times": [-30.0, 12.0], "start_time": "2018-07-06T09:47:44",
+//              "units": "counts"}],
+//  "framelog": [...same as runlog...],
+//  "runlog_columns": [{"times": [-30.0, 12.0],
+//                      "start_time": "2018-07-06T09:47:44",
+//                      "columns": [{"name": "count_rate", "type": "float",
+//                                   "values": [0.0, 40.8],
+//                                   "units": "counts"}]}],
+//  "framelog_columns": [...same as runlog_columns...],
+//  "monitors": [{"number": 1, "spectrum": 1}],
+//  "detectors": [{"number": 1, "source_detector_distance": 0.0}],
+//  "se_log_pvs": ["full:pv:name"], "config_id": "2018-07"}
+//
+// The periods may instead be one object of arrays, with the same fields each
+// holding a value per period.
+// Instead of times, logs may give "timestamps", absolute ISO8601 times which
+// are converted to times relative to the start_time.
+// Record types may be "string", "int32", "int64", "float" or "double", log
+// columns may be any of these except "string".
+// The monitors, detectors and se_log_pvs make up the instrument skeleton,
+// which is compiled once per distinct configuration using the cache. Runs
+// may give a "config_id" string, runs of an instrument with the same one must
+// have the same skeleton fields and only those of the first are read.
+NexusWriteCommandBuilder
+createBuilderFromRunDescription(const nlohmann::json &run,
+                                InstrumentSkeletonCache &skeletons);
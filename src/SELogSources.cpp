@@ -0,0 +1,177 @@
+#include "SELogSources.h"
+#include <stdexcept>
+
+struct SELogSources::LeafOf {
+  StringRef operator()(const size_t index) const {
+    return sources->leafName(index);
+  }
+  const SELogSources *sources;
+};
+
+SELogSources::SELogSources(std::string topic, std::string selogPath)
+    : m_topic(std::move(topic)), m_selogPath(std::move(selogPath)) {}
+
+void SELogSources::add(const StringRef *pVs, const size_t count) {
+  const auto previousNumberOfSources = m_sources.size();
+  const auto previousNamesSize = m_names.size();
+  try {
+    for (size_t i = 0; i < count; i++) {
+      addSource(pVs[i]);
+    }
+  } catch (...) {
+    m_sources.resize(previousNumberOfSources);
+    m_names.resize(previousNamesSize);
+    m_index.rebuild(m_sources.size(), LeafOf{this});
+    throw;
+  }
+}
+
+void SELogSources::addSource(const StringRef pv) {
+  const auto lastColon = pv.rfind(':');
+  const auto leafOffset = lastColon == StringRef::npos ? 0 : lastColon + 1;
+  const auto leaf = pv.substr(leafOffset);
+  if (leaf.empty()) {
+    throw std::runtime_error("SE log PV " + pv.str() +
+                             " has no name after its last colon");
+  }
+  const LeafOf keyOf{this};
+  m_index.reserveOneMore(m_sources.size(), keyOf);
+  const auto slot = m_index.findSlot(leaf, keyOf);
+  if (m_index.occupied(slot)) {
+    const auto existing = pvName(m_index.index(slot));
+    if (existing == pv) {
+      return;
+    }
+    throw std::runtime_error("SE log PVs " + existing.str() + " and " +
+                             pv.str() + " would both be written to " +
+                             nexusPath(leaf));
+  }
+  m_sources.push_back({static_cast<uint32_t>(m_names.size()),
+                       static_cast<uint32_t>(pv.size()),
+                       static_cast<uint32_t>(leafOffset)});
+  m_names.append(pv.data(), pv.size());
+  m_index.insert(slot, m_sources.size() - 1);
+}
+
+StringRef SELogSources::pvName(const size_t index) const {
+  const auto &source = m_sources[index];
+  return {m_names.data() + source.offset, source.length};
+}
+
+StringRef SELogSources::leafName(const size_t index) const {
+  return pvName(index).substr(m_sources[index].leafOffset);
+}
+
+std::string SELogSources::nexusPath(const StringRef leaf) const {
+  std::string path;
+  path.reserve(m_selogPath.size() + 1 + leaf.size());
+  path.append(m_selogPath);
+  path.push_back('/');
+  path.append(leaf.data(), leaf.size());
+  return path;
+}
+
+
+void SELogSources::addShard(std::shared_ptr<const SELogSources> shard) {
+  m_shards.push_back(std::move(shard));
+}
+
+bool SELogSources::empty() const {
+  if (m_keepWhenEmpty) {
+    return false;
+  }
+  for (const auto &shard : m_shards) {
+    if (!shard->empty()) {
+      return false;
+    }
+  }
+  return m_sources.empty();
+}
+
+SELogSources SELogSources::merged() const {
+  SELogSources merged(m_topic, m_selogPath);
+  merged.m_names = m_names;
+  merged.m_sources = m_sources;
+  merged.m_index = m_index;
+  for (const auto &shard : m_shards) {
+    for (size_t i = 0; i < shard->m_sources.size(); i++) {
+      merged.addSource(shard->pvName(i));
+    }
+  }
+  return merged;
+}
+
+void SELogSources::write(JsonWriter &writer) const {
+  if (m_shards.empty()) {
+    writeGroup(writer);
+  } else {
+    merged().writeGroup(writer);
+  }
+}
+
+nlohmann::json SELogSources::toJson() const {
+  return m_shards.empty() ? groupToJson() : merged().groupToJson();
+}
+
+void SELogSources::writeGroup(JsonWriter &writer) const {
+  // Keys in sorted order, matching createGroup() in the builder and
+  // StreamNode
+  writer.startObject();
+  writer.key("attributes");
+  writer.startArray();
+  writer.startObject();
+  writer.key("name");
+  writer.value("NX_class");
+  writer.key("values");
+  writer.value("IXselog");
+  writer.endObject();
+  writer.endArray();
+  writer.key("children");
+  writer.startArray();
+  std::string path = m_selogPath + "/";
+  const auto prefixLength = path.size();
+  for (size_t i = 0; i < m_sources.size(); i++) {
+    const auto pv = pvName(i);
+    const auto leaf = leafName(i);
+    path.resize(prefixLength);
+    path.append(leaf.data(), leaf.size());
+    writer.startObject();
+    writer.key("stream");
+    writer.startObject();
+    writer.key("nexus_path");
+    writer.value(path);
+    writer.key("source");
+    writer.value(pv.data(), pv.size());
+    writer.key("topic");
+    writer.value(m_topic);
+    writer.key("writer_module");
+    writer.value("f142");
+    writer.endObject();
+    writer.key("type");
+    writer.value("stream");
+    writer.endObject();
+  }
+  writer.endArray();
+  writer.key("name");
+  writer.value("selog");
+  writer.key("type");
+  writer.value("group");
+  writer.endObject();
+}
+
+nlohmann::json SELogSources::groupToJson() const {
+  auto streams = nlohmann::json::array();
+  for (size_t i = 0; i < m_sources.size(); i++) {
+    nlohmann::json stream = {{"type", "stream"}};
+    stream["stream"] = {{"writer_module", "f142"},
+                        {"nexus_path", nexusPath(leafName(i))},
+                        {"source", pvName(i).str()},
+                        {"topic", m_topic}};
+    streams.push_back(std::move(stream));
+  }
+  nlohmann::json group = {{"name", "selog"}, {"type", "group"}};
+  group["attributes"] = nlohmann::json::array(
+      {{{"name", "NX_class"}, {"values", "IXselog"}}});
+  group["children"] = std::move(streams);
+  return group;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "DeferredNode.h"
+#include "StringIndex.h"
+#include "StringRef.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The selog group of f142 streams, one per sample environment PV, each
+// written to <selogPath>/<last colon separated part of the PV name>. PV names
+// are stored back to back in a single buffer and indexed by that leaf name,
+// the stream nodes are only created when the group is serialised.
+class SELogSources : public DeferredNode {
+public:
+  SELogSources(std::string topic, std::string selogPath);
+
+  // Register a batch of PVs. A PV which is already registered is ignored.
+  // Throws std::runtime_error if a PV has no leaf name or its leaf name is
+  // used by a different PV, in which case none of the batch is added.
+  void add(const StringRef *pVs, size_t count);
+  void add(StringRef pv) { add(&pv, 1); }
+
+  size_t size() const { return m_sources.size(); }
+
+  // A group with no sources is left out of the message unless this has been
+  // called, as addSELogSources does so that adding no PVs still gives an
+  // empty selog group
+  void keepWhenEmpty() { m_keepWhenEmpty = true; }
+
+  // Sources registered with another instance, for example from another
+  // thread, which are written as part of this group. Leaf names are checked
+  // across the shards each time the group is written.
+  void addShard(std::shared_ptr<const SELogSources> shard);
+
+  void write(JsonWriter &writer) const override;
+  nlohmann::json toJson() const override;
+  bool empty() const override;
+
+private:
+  struct Source {
+    uint32_t offset;
+    uint32_t length;
+    // Offset of the leaf name within the PV name
+    uint32_t leafOffset;
+  };
+
+  void addSource(StringRef pv);
+  // This group with the sources of its shards added
+  SELogSources merged() const;
+  void writeGroup(JsonWriter &writer) const;
+  nlohmann::json groupToJson() const;
+  StringRef pvName(size_t index) const;
+  StringRef leafName(size_t index) const;
+  std::string nexusPath(StringRef leaf) const;
+  // Gives m_index the leaf name of each source
+  struct LeafOf;
+
+  const std::string m_topic;
+  const std::string m_selogPath;
+  std::string m_names;
+  std::vector<Source> m_sources;
+  // Sources by leaf name
+  StringIndex m_index{16};
+  std::vector<std::shared_ptr<const SELogSources>> m_shards;
+  bool m_keepWhenEmpty = false;
+};
@@ -0,0 +1,32 @@
+#include "StagingQueue.h"
+
+StagingQueue::UseScope::UseScope(const StagingQueue &queue) : m_queue(&queue) {
+  if (queue.m_inUse.exchange(true, std::memory_order_acquire)) {
+    throw std::runtime_error("A StagingQueue was used by two threads at once, "
+                             "or while its builder serialised a message");
+  }
+}
+
+StagingQueue::UseScope::~UseScope() {
+  if (m_queue != nullptr) {
+    m_queue->m_inUse.store(false, std::memory_order_release);
+  }
+}
+
+StagingQueue::StagingQueue(std::shared_ptr<SELogSources> seLogSources)
+    : m_seLogSources(std::move(seLogSources)) {}
+
+void StagingQueue::addSELogSources(const std::vector<std::string> &pVs) {
+  std::vector<StringRef> pVRefs(pVs.begin(), pVs.end());
+  addSELogSources(pVRefs.data(), pVRefs.size());
+}
+
+void StagingQueue::addSELogSources(const StringRef *pVs, const size_t count) {
+  if (!m_seLogSources) {
+    throw std::runtime_error("SE log PVs cannot be staged for a builder made "
+                             "from an instrument skeleton or with a loaded "
+                             "selog group not written by a builder");
+  }
+  UseScope use(*this);
+  m_seLogSources->add(pVs, count);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "BuilderJson.h"
+#include "MonotonicArena.h"
+#include "NexusWriteCommandBuilder.h"
+#include "SELogSources.h"
+#include "StringRef.h"
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Records added to a NexusWriteCommandBuilder from another thread. Each
+// producer thread has its own queue, created by
+// NexusWriteCommandBuilder::createStagingQueue, so producers never share a
+// lock. The nodes are built on the producer's thread, in the queue's own
+// arena, and are only merged into the builder's groups when a message is
+// serialised: after the records added to the builder directly, queue by queue
+// in the order the queues were created, each in the order its records were
+// added. The output therefore does not depend on how the producers were
+// scheduled.
+//
+// A queue must only be used by one thread at a time, and the builder must not
+// serialise a message while records are being added to any of its queues.
+// Both are checked: an add which overlaps another, or a serialisation, throws
+// std::runtime_error.
+class StagingQueue {
+public:
+  // Marks the queue as in use, held by each add and by the builder while it
+  // serialises a message. Throws std::runtime_error if it is already in use.
+  class UseScope {
+  public:
+    explicit UseScope(const StagingQueue &queue);
+    UseScope(UseScope &&other) : m_queue(other.m_queue) {
+      other.m_queue = nullptr;
+    }
+    UseScope(const UseScope &) = delete;
+    UseScope &operator=(const UseScope &) = delete;
+    ~UseScope();
+
+  private:
+    const StagingQueue *m_queue;
+  };
+
+  template <typename T>
+  void addVmsRecord(const std::string &name, const std::string &typeStr,
+                    T record) {
+    UseScope use(*this);
+    ArenaScope scope(m_arena);
+    m_vmsRecords.push_back(createDataset<T>(name, typeStr, std::move(record)));
+  }
+
+  template <typename T>
+  void addRunlogRecord(const std::string &name, const std::string &typeStr,
+                       T values, std::vector<float> times,
+                       const std::string &startTime,
+                       const std::string &units = "") {
+    UseScope use(*this);
+    ArenaScope scope(m_arena);
+    m_runlogRecords.push_back(createLogGroup<T>(
+        name, typeStr, std::move(values), std::move(times), startTime, units));
+  }
+
+  template <typename T>
+  void addFramelogRecord(const std::string &name, const std::string &typeStr,
+                         T values, std::vector<float> times,
+                         const std::string &startTime,
+                         const std::string &units = "") {
+    UseScope use(*this);
+    ArenaScope scope(m_arena);
+    m_framelogRecords.push_back(createLogGroup<T>(
+        name, typeStr, std::move(values), std::move(times), startTime, units));
+  }
+
+  // Labelled with the NeXus type of T, see NexusTypes.h
+  template <typename T> void addVmsRecord(const std::string &name, T record) {
+    addVmsRecord<T>(name, nexusTypeName<T>(), std::move(record));
+  }
+
+  template <typename T>
+  void addRunlogRecord(const std::string &name, T values,
+                       std::vector<float> times, const std::string &startTime,
+                       const std::string &units = "") {
+    addRunlogRecord<T>(name, nexusTypeName<T>(), std::move(values),
+                       std::move(times), startTime, units);
+  }
+
+  template <typename T>
+  void addFramelogRecord(const std::string &name, T values,
+                         std::vector<float> times,
+                         const std::string &startTime,
+                         const std::string &units = "") {
+    addFramelogRecord<T>(name, nexusTypeName<T>(), std::move(values),
+                         std::move(times), startTime, units);
+  }
+
+  // As NexusWriteCommandBuilder::addSELogSources. Leaf names are checked
+  // against the queue's own PVs here and against every other PV in the selog
+  // group when a message is serialised. Throws std::runtime_error for a
+  // builder made from an instrument skeleton, whose PVs are fixed, or with a
+  // loaded selog group not written by a builder.
+  void addSELogSources(const std::vector<std::string> &pVs);
+  void addSELogSources(const StringRef *pVs, size_t count);
+
+private:
+  friend class NexusWriteCommandBuilder;
+
+  explicit StagingQueue(std::shared_ptr<SELogSources> seLogSources);
+
+  // Backs every staged node, so it must be declared before them
+  MonotonicArena m_arena;
+  std::vector<BuilderJson> m_vmsRecords;
+  std::vector<BuilderJson> m_runlogRecords;
+  std::vector<BuilderJson> m_framelogRecords;
+  const std::shared_ptr<SELogSources> m_seLogSources;
+  mutable std::atomic<bool> m_inUse{false};
+};
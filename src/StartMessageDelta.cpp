@@ -0,0 +1,64 @@
+#include "StartMessageDelta.h"
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+const char *const deltaCommand = "FileWriter_new_delta";
+}
+
+nlohmann::json createStartMessageDelta(const nlohmann::json &baseline,
+                                       const nlohmann::json &startMessage) {
+  return {{"cmd", deltaCommand},
+          {"baseline_job_id", baseline.at("job_id")},
+          {"patch", nlohmann::json::diff(baseline, startMessage)}};
+}
+
+nlohmann::json applyStartMessageDelta(const nlohmann::json &baseline,
+                                      const nlohmann::json &delta) {
+  if (!isStartMessageDelta(delta)) {
+    throw std::runtime_error("Message is not a start message delta");
+  }
+  if (delta.at("baseline_job_id") != baseline.at("job_id")) {
+    throw std::runtime_error(
+        "Start message delta is against job " +
+        delta["baseline_job_id"].get<std::string>() + " but the baseline is " +
+        baseline["job_id"].get<std::string>());
+  }
+  return baseline.patch(delta.at("patch"));
+}
+
+bool isStartMessageDelta(const nlohmann::json &message) {
+  const auto command = message.find("cmd");
+  return command != message.end() && *command == deltaCommand;
+}
+
+size_t restoreStartMessages(std::istream &messages, std::ostream &output) {
+  std::unordered_map<std::string, nlohmann::json> baselines;
+  std::string line;
+  size_t numberOfMessages = 0;
+  while (std::getline(messages, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+      continue;
+    }
+    auto message = nlohmann::json::parse(line);
+    if (isStartMessageDelta(message)) {
+      const auto baselineJobID =
+          message.at("baseline_job_id").get<std::string>();
+      const auto baseline = baselines.find(baselineJobID);
+      if (baseline == baselines.end()) {
+        throw std::runtime_error("No baseline start message for job " +
+                                 baselineJobID);
+      }
+      output << applyStartMessageDelta(baseline->second, message).dump()
+             << '\n';
+    } else {
+      output << line << '\n';
+      const auto jobID = message.at("job_id").get<std::string>();
+      baselines[jobID] = std::move(message);
+    }
+    numberOfMessages++;
+  }
+  return numberOfMessages;
+}
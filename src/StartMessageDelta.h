@@ -0,0 +1,29 @@
+#pragma once
+
+#include <istream>
+#include <nlohmann/json.hpp>
+#include <ostream>
+
+// Consecutive runs on an instrument differ in few datasets, so a start message
+// can be archived as a delta against an earlier one, the baseline:
+//
+// {"cmd": "FileWriter_new_delta", "baseline_job_id": "ZOOM_4112",
+//  "patch": [{"op": "replace", "path": "/job_id", "value": "ZOOM_4113"}, ...]}
+//
+// The patch is a JSON Patch (RFC 6902) which turns the baseline into the
+// message. Applying it to the baseline rebuilds the message, it serialises to
+// the same bytes.
+nlohmann::json createStartMessageDelta(const nlohmann::json &baseline,
+                                       const nlohmann::json &startMessage);
+
+// Throws std::runtime_error if the delta is not one or was created against a
+// different baseline
+nlohmann::json applyStartMessageDelta(const nlohmann::json &baseline,
+                                      const nlohmann::json &delta);
+
+bool isStartMessageDelta(const nlohmann::json &message);
+
+// Rebuild the full start messages from a file of compact messages, one per
+// line, in which deltas follow their baselines, as written by generateBatch.
+// Returns the number of messages.
+size_t restoreStartMessages(std::istream &messages, std::ostream &output);
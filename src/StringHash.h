@@ -0,0 +1,29 @@
+#pragma once
+
+#include "StringRef.h"
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, over any number of byte ranges in turn. Fast for the short strings
+// it is used for, such as names and PVs, but not resistant to collisions
+// chosen by an attacker.
+class Fnv1aHash {
+public:
+  void add(const void *data, const size_t size) {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+      m_hash ^= bytes[i];
+      m_hash *= 1099511628211ull;
+    }
+  }
+  uint64_t value() const { return m_hash; }
+
+private:
+  uint64_t m_hash = 14695981039346656037ull;
+};
+
+inline uint64_t hashString(const StringRef str) {
+  Fnv1aHash hash;
+  hash.add(str.data(), str.size());
+  return hash.value();
+}
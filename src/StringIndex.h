@@ -0,0 +1,64 @@
+#pragma once
+
+#include "StringHash.h"
+#include "StringRef.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Open addressing hash table of strings held elsewhere, such as in a vector,
+// looked up by their index there. Each slot holds the index of a string plus
+// one, or zero when it is empty. keyOf(index) gives the string at an index.
+class StringIndex {
+public:
+  explicit StringIndex(const size_t minimumNumberOfSlots)
+      : m_minimumNumberOfSlots(minimumNumberOfSlots) {}
+
+  // Make room for a string to be added to the count already indexed, keeping
+  // the table at most half full
+  template <typename KeyOf>
+  void reserveOneMore(const size_t count, const KeyOf &keyOf) {
+    if (2 * (count + 1) > m_slots.size()) {
+      rebuild(std::max(m_minimumNumberOfSlots, 2 * m_slots.size()), count,
+              keyOf);
+    }
+  }
+
+  // The slot holding key, or the empty slot where it would be inserted
+  template <typename KeyOf>
+  size_t findSlot(const StringRef key, const KeyOf &keyOf) const {
+    const auto mask = m_slots.size() - 1;
+    auto slot = static_cast<size_t>(hashString(key)) & mask;
+    while (m_slots[slot] != 0 && keyOf(m_slots[slot] - 1) != key) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  bool occupied(const size_t slot) const { return m_slots[slot] != 0; }
+  size_t index(const size_t slot) const { return m_slots[slot] - 1; }
+  void insert(const size_t slot, const size_t index) {
+    m_slots[slot] = static_cast<uint32_t>(index + 1);
+  }
+
+  // Index the first count strings again, for example after any after them
+  // have been removed
+  template <typename KeyOf>
+  void rebuild(const size_t count, const KeyOf &keyOf) {
+    rebuild(m_slots.size(), count, keyOf);
+  }
+
+private:
+  template <typename KeyOf>
+  void rebuild(const size_t numberOfSlots, const size_t count,
+               const KeyOf &keyOf) {
+    m_slots.assign(numberOfSlots, 0);
+    for (size_t i = 0; i < count; i++) {
+      insert(findSlot(keyOf(i), keyOf), i);
+    }
+  }
+
+  size_t m_minimumNumberOfSlots;
+  std::vector<uint32_t> m_slots;
+};
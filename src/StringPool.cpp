@@ -0,0 +1,54 @@
+#include "StringPool.h"
+#include "EscapeScan.h"
+#include "JsonWriter.h"
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+InternedString StringPool::intern(const StringRef str) {
+  const auto keyOf = [this](const size_t index) {
+    return m_strings[index].str();
+  };
+  m_index.reserveOneMore(m_strings.size(), keyOf);
+  const auto slot = m_index.findSlot(str, keyOf);
+  if (m_index.occupied(slot)) {
+    return m_strings[m_index.index(slot)];
+  }
+  // Escaping can make a string up to six times as long
+  if (str.size() + 2 > std::numeric_limits<uint32_t>::max() / 6) {
+    throw std::runtime_error("String of " + std::to_string(str.size()) +
+                             " bytes is too long for a StringPool");
+  }
+  // Most strings need no escapes, their JSON form is just quoted and the
+  // string is that less its quotes
+  const char *jsonCopy;
+  size_t jsonLength;
+  const char *strCopy;
+  if (findSpecialByte(str.data(), 0, str.size()) == str.size()) {
+    jsonLength = str.size() + 2;
+    auto *copy = static_cast<char *>(m_arena.allocate(jsonLength, 1));
+    copy[0] = '"';
+    std::memcpy(copy + 1, str.data(), str.size());
+    copy[jsonLength - 1] = '"';
+    jsonCopy = copy;
+    strCopy = copy + 1;
+  } else {
+    std::string json;
+    JsonWriter writer(json);
+    writer.value(str.data(), str.size());
+    jsonLength = json.size();
+    auto *copy =
+        static_cast<char *>(m_arena.allocate(jsonLength + str.size(), 1));
+    std::memcpy(copy, json.data(), jsonLength);
+    std::memcpy(copy + jsonLength, str.data(), str.size());
+    jsonCopy = copy;
+    strCopy = copy + jsonLength;
+  }
+  m_strings.push_back(InternedString(strCopy,
+                                     static_cast<uint32_t>(str.size()),
+                                     jsonCopy,
+                                     static_cast<uint32_t>(jsonLength)));
+  m_index.insert(slot, m_strings.size() - 1);
+  return m_strings.back();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "MonotonicArena.h"
+#include "StringIndex.h"
+#include "StringRef.h"
+#include <cstdint>
+#include <vector>
+
+// A string held by a StringPool, which is only valid for the lifetime of the
+// pool. Besides the string itself it gives the JSON string it is written as,
+// quotes and escapes included, so that it can be copied into a message.
+class InternedString {
+public:
+  StringRef str() const { return {m_str, m_length}; }
+  StringRef json() const { return {m_json, m_jsonLength}; }
+
+  // Strings interned by the same pool are equal only if they are the same
+  bool operator==(const InternedString &other) const {
+    return m_json == other.m_json;
+  }
+  bool operator!=(const InternedString &other) const {
+    return !(*this == other);
+  }
+
+private:
+  friend class StringPool;
+  InternedString(const char *str, uint32_t length, const char *json,
+                 uint32_t jsonLength)
+      : m_str(str), m_json(json), m_length(length), m_jsonLength(jsonLength) {}
+
+  const char *m_str;
+  const char *m_json;
+  uint32_t m_length;
+  uint32_t m_jsonLength;
+};
+
+// Stores each distinct string once, for strings which are repeated across
+// many nodes such as topics, writer modules and NeXus paths. Strings are
+// escaped when they are interned, which throws std::runtime_error for invalid
+// UTF-8, and never freed until the pool is destroyed.
+class StringPool {
+public:
+  StringPool() = default;
+  StringPool(const StringPool &) = delete;
+  StringPool &operator=(const StringPool &) = delete;
+  StringPool(StringPool &&) = default;
+
+  InternedString intern(StringRef str);
+
+  // Number of distinct strings
+  size_t size() const { return m_strings.size(); }
+  // Bytes held for the strings and their JSON forms
+  size_t bytesAllocated() const { return m_arena.bytesAllocated(); }
+
+private:
+  MonotonicArena m_arena;
+  std::vector<InternedString> m_strings;
+  StringIndex m_index{64};
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// A non-owning reference to a sequence of characters, standing in for
+// std::string_view, which needs C++17. The referenced characters must outlive
+// it.
+class StringRef {
+public:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  StringRef(const char *str)
+      : m_data(str), m_size(std::char_traits<char>::length(str)) {}
+  StringRef(const std::string &str) : m_data(str.data()), m_size(str.size()) {}
+  StringRef(const char *data, const size_t size)
+      : m_data(data), m_size(size) {}
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  // Position of the last occurrence of character, or npos
+  size_t rfind(const char character) const {
+    for (size_t i = m_size; i > 0; i--) {
+      if (m_data[i - 1] == character) {
+        return i - 1;
+      }
+    }
+    return npos;
+  }
+
+  StringRef substr(const size_t position) const {
+    return {m_data + position, m_size - position};
+  }
+
+  std::string str() const { return {m_data, m_size}; }
+
+  bool operator==(const StringRef &other) const {
+    return m_size == other.m_size &&
+           std::memcmp(m_data, other.m_data, m_size) == 0;
+  }
+  bool operator!=(const StringRef &other) const { return !(*this == other); }
+
+private:
+  const char *m_data;
+  size_t m_size;
+};
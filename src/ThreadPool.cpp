@@ -0,0 +1,103 @@
+#include "ThreadPool.h"
+
+namespace {
+// Index of the pool worker running on this thread, if any
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local size_t currentWorkerIndex = 0;
+}
+
+ThreadPool::ThreadPool(size_t numberOfThreads) {
+  if (numberOfThreads == 0) {
+    numberOfThreads = 1;
+  }
+  for (size_t i = 0; i < numberOfThreads; i++) {
+    m_queues.emplace_back(new WorkQueue);
+  }
+  for (size_t i = 0; i < numberOfThreads; i++) {
+    m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_taskAvailable.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  const auto queueIndex = currentPool == this
+                              ? currentWorkerIndex
+                              : m_nextQueue++ % m_queues.size();
+  // Count the task before queueing it so the counters never underflow
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_unfinishedTasks++;
+    m_queuedTasks++;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_queues[queueIndex]->mutex);
+    m_queues[queueIndex]->tasks.push_back(std::move(task));
+  }
+  m_taskAvailable.notify_one();
+}
+
+void ThreadPool::waitForAll() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_allTasksDone.wait(lock, [this] { return m_unfinishedTasks == 0; });
+}
+
+bool ThreadPool::popTask(const size_t workerIndex,
+                         std::function<void()> &task) {
+  auto &queue = *m_queues[workerIndex];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  // Newest first from the worker's own queue, its data is most likely cached
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  return true;
+}
+
+bool ThreadPool::stealTask(const size_t thiefIndex,
+                           std::function<void()> &task) {
+  for (size_t offset = 1; offset < m_queues.size(); offset++) {
+    auto &queue = *m_queues[(thiefIndex + offset) % m_queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::workerLoop(const size_t workerIndex) {
+  currentPool = this;
+  currentWorkerIndex = workerIndex;
+  std::function<void()> task;
+  while (true) {
+    if (popTask(workerIndex, task) || stealTask(workerIndex, task)) {
+      m_queuedTasks--;
+      task();
+      task = nullptr;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--m_unfinishedTasks == 0) {
+        m_allTasksDone.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_taskAvailable.wait(
+        lock, [this] { return m_stopping || m_queuedTasks > 0; });
+    if (m_stopping && m_queuedTasks == 0) {
+      return;
+    }
+  }
+}
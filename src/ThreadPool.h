@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Each worker has its own queue, tasks submitted
+// from a worker go to that worker's queue and idle workers steal from the
+// other queues. Tasks must not throw.
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t numberOfThreads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task);
+
+  // Block until every submitted task has completed
+  void waitForAll();
+
+  size_t numberOfThreads() const { return m_threads.size(); }
+
+private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void workerLoop(size_t workerIndex);
+  bool popTask(size_t workerIndex, std::function<void()> &task);
+  bool stealTask(size_t thiefIndex, std::function<void()> &task);
+
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::atomic<size_t> m_nextQueue{0};
+  std::atomic<size_t> m_queuedTasks{0};
+
+  std::mutex m_mutex;
+  std::condition_variable m_taskAvailable;
+  std::condition_variable m_allTasksDone;
+  size_t m_unfinishedTasks = 0;
+  bool m_stopping = false;
+};
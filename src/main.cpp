@@ -1,8 +1,207 @@
+#include "BatchGenerator.h"
+#include "MessageJournal.h"
 #include "NexusWriteCommandBuilder.h"
+#include "StartMessageDelta.h"
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+namespace {
+
+int usage() {
+  std::cerr << "Usage: nexus_json_cpp [--batch <runs.jsonl> <start.jsonl> "
+               "<stop.jsonl> [threads]]\n"
+               "       nexus_json_cpp --batch-deltas <runs.jsonl> "
+               "<start.jsonl> <stop.jsonl> [threads]\n"
+               "       nexus_json_cpp --restore <start.jsonl> <output.jsonl>\n"
+               "       nexus_json_cpp --journal <runs.jsonl> <directory> "
+               "[threads]\n"
+               "       nexus_json_cpp --journal-get <directory> <job_id> "
+               "[start|stop]\n"
+               "       nexus_json_cpp --amend-title <start.json> <title> "
+               "<output.json>\n"
+               "Without arguments the messages for an example ZOOM run are "
+               "written to startMessage.json and stopMessage.json\n";
+  return 1;
+}
+
+// The number of threads given on the command line, or 0 if it is not a
+// positive whole number
+size_t parseNumberOfThreads(const std::string &argument) {
+  if (argument.empty() ||
+      argument.find_first_not_of("0123456789") != std::string::npos) {
+    return 0;
+  }
+  try {
+    return std::stoul(argument);
+  } catch (const std::exception &) {
+    return 0;
+  }
+}
+
+int runBatchMode(int argc, char *argv[]) {
+  if (argc != 5 && argc != 6) {
+    return usage();
+  }
+  auto numberOfThreads =
+      static_cast<size_t>(std::thread::hardware_concurrency());
+  if (argc == 6) {
+    numberOfThreads = parseNumberOfThreads(argv[5]);
+    if (numberOfThreads == 0) {
+      return usage();
+    }
+  }
+
+  std::ifstream runDescriptions(argv[2]);
+  if (!runDescriptions) {
+    std::cerr << "Could not open " << argv[2] << "\n";
+    return 1;
+  }
+  std::ofstream startMessages(argv[3]);
+  std::ofstream stopMessages(argv[4]);
+  const bool startMessageDeltas = std::string(argv[1]) == "--batch-deltas";
+  try {
+    const auto numberOfRuns =
+        generateBatch(runDescriptions, startMessages, stopMessages,
+                      numberOfThreads, startMessageDeltas);
+    std::cout << "Generated messages for " << numberOfRuns << " runs\n";
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+int runRestoreMode(int argc, char *argv[]) {
+  if (argc != 4) {
+    return usage();
+  }
+  std::ifstream messages(argv[2]);
+  if (!messages) {
+    std::cerr << "Could not open " << argv[2] << "\n";
+    return 1;
+  }
+  std::ofstream output(argv[3]);
+  try {
+    const auto numberOfMessages = restoreStartMessages(messages, output);
+    std::cout << "Restored " << numberOfMessages << " start messages\n";
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+int runJournalMode(int argc, char *argv[]) {
+  if (argc != 4 && argc != 5) {
+    return usage();
+  }
+  auto numberOfThreads =
+      static_cast<size_t>(std::thread::hardware_concurrency());
+  if (argc == 5) {
+    numberOfThreads = parseNumberOfThreads(argv[4]);
+    if (numberOfThreads == 0) {
+      return usage();
+    }
+  }
+
+  std::ifstream runDescriptions(argv[2]);
+  if (!runDescriptions) {
+    std::cerr << "Could not open " << argv[2] << "\n";
+    return 1;
+  }
+  try {
+    MessageJournalWriter journal(argv[3]);
+    const auto numberOfRuns =
+        generateBatch(runDescriptions, journal, numberOfThreads);
+    journal.sync();
+    std::cout << "Journalled messages for " << numberOfRuns << " runs\n";
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+int runJournalGetMode(int argc, char *argv[]) {
+  if (argc != 4 && argc != 5) {
+    return usage();
+  }
+  auto kind = JournalMessageKind::START;
+  if (argc == 5) {
+    const std::string kindName = argv[4];
+    if (kindName == "stop") {
+      kind = JournalMessageKind::STOP;
+    } else if (kindName != "start") {
+      return usage();
+    }
+  }
+  try {
+    const MessageJournalReader journal(argv[2]);
+    StringRef message("", 0);
+    if (!journal.find(argv[3], kind, message)) {
+      std::cerr << "No such message for job " << argv[3] << "\n";
+      return 1;
+    }
+    std::cout.write(message.data(), message.size());
+    std::cout << "\n";
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+int runAmendTitleMode(int argc, char *argv[]) {
+  if (argc != 5) {
+    return usage();
+  }
+  std::ifstream input(argv[2]);
+  if (!input) {
+    std::cerr << "Could not open " << argv[2] << "\n";
+    return 1;
+  }
+  std::string startMessage((std::istreambuf_iterator<char>(input)),
+                           std::istreambuf_iterator<char>());
+  try {
+    auto builder =
+        NexusWriteCommandBuilder::fromStartMessage(std::move(startMessage));
+    builder.addTitle(argv[3]);
+    std::string messageBuffer;
+    builder.writeStartMessage(messageBuffer);
+    std::ofstream output(argv[4]);
+    output << messageBuffer;
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    const std::string mode = argv[1];
+    if (mode == "--batch" || mode == "--batch-deltas") {
+      return runBatchMode(argc, argv);
+    }
+    if (mode == "--restore") {
+      return runRestoreMode(argc, argv);
+    }
+    if (mode == "--journal") {
+      return runJournalMode(argc, argv);
+    }
+    if (mode == "--journal-get") {
+      return runJournalGetMode(argc, argv);
+    }
+    if (mode == "--amend-title") {
+      return runAmendTitleMode(argc, argv);
+    }
+    return usage();
+  }
 
-int main() {
   const std::string instrumentName = "ZOOM";
   const uint32_t runNumber = 4112;
   const std::string broker = "livedata.isis.cclrc.ac.uk";
@@ -49,56 +248,61 @@ int main() {
 
   commandBuilder.addSELogSources({"full:pv:name", "bar:foo", "foo:bar"});
 
-  // TODO What if there are multiple periods? Should some/all of these
-  // parameters be vectors? Or allow calling "addPeriod" multiple times?
+  // A run with more periods calls this once per period, or passes them all
+  // at once with addPeriods(PeriodColumns)
   commandBuilder.addPeriods(0, 21.20301055908203f, 20.061872482299805f, 18234,
                             1, 0, 18234, 1, 1, "Period 1", 20.061872482299805f,
                             1, 18234);
 
   // Add 8 monitors (with 1:1 mapping of monitor and spectrum numbers)
-  for (uint32_t monitorNumber = 1; monitorNumber <= 8; monitorNumber++) {
-    auto spectrumNumber = monitorNumber;
-    commandBuilder.addMonitor(monitorNumber, spectrumNumber);
-  }
+  // Monitors 1 to 8 on spectra 1 to 8
+  commandBuilder.addMonitors(1, 8, 1);
 
   // Add some VMS compat records
   commandBuilder.addVmsRecord<std::string>(
-      "HDR", "string", "ZOO04112                    MT Beam A2=6mm SANS "
-                       "    06-JUL-2018 09:47:44   20.06");
-  commandBuilder.addVmsRecord<std::vector<int32_t>>("CRAT", "int32",
+      "HDR", "ZOO04112                    MT Beam A2=6mm SANS "
+             "    06-JUL-2018 09:47:44   20.06");
+  commandBuilder.addVmsRecord<std::vector<int32_t>>("CRAT",
                                                     {0, 1, 1, 0, 0, 1, 0});
 
-  // Add some runlog records
-  // TODO - is this interface convenient? Should we publish to Kafka as f142
-  // instead?
+  // Add some runlog records. Logs which grow through a long run can instead
+  // be registered with addRunlogStream and their values published as f142
+  // messages with an F142LogPublisher, see F142Encoder.h.
   const std::string startTime = "2018-07-06T09:47:44";
   const std::vector<float> times{-30.0, 12.0, 54.0, 97.0};
   commandBuilder.addRunlogRecord<std::vector<float>>(
-      "count_rate", "float", {0.0, 40.8772, 42.2018, 41.6405}, times, startTime,
+      "count_rate", {0.0, 40.8772, 42.2018, 41.6405}, times, startTime,
       "counts");
   commandBuilder.addRunlogRecord<std::vector<float>>(
-      "dae_beam_current", "float", {0.0, 38.6239, 39.7357, 39.4712}, times,
-      startTime, "uAh");
-  commandBuilder.addRunlogRecord<std::string>(
-      "icp_event", "string", "CHANGE_PERIOD 1", times, startTime);
-
-  // Add some framelog records
-  commandBuilder.addFramelogRecord<std::vector<int32_t>>(
-      "events_log", "int32", {11, 8, 6, 12}, times, startTime, "counts");
-  commandBuilder.addFramelogRecord<std::vector<float>>(
-      "proton_charge", "float", {0.001091, 0.001045, 0.001085, 0.001015}, times,
-      startTime, "uAh");
-
-  // The returned string can be used directly as a Kafka message payload
-  std::cout << commandBuilder.startMessageAsString() << std::endl;
-  std::cout << commandBuilder.stopMessageAsString() << std::endl;
+      "dae_beam_current", {0.0, 38.6239, 39.7357, 39.4712}, times, startTime,
+      "uAh");
+  commandBuilder.addRunlogRecord<std::string>("icp_event", "CHANGE_PERIOD 1",
+                                              times, startTime);
+
+  // Add some framelog records, logs which share a time axis can be added in
+  // one batch of columns
+  LogColumns framelogColumns(times, startTime);
+  framelogColumns.addColumn<int32_t>("events_log", {11, 8, 6, 12}, "counts");
+  framelogColumns.addColumn<float>(
+      "proton_charge", {0.001091, 0.001045, 0.001085, 0.001015}, "uAh");
+  commandBuilder.addFramelogColumns(std::move(framelogColumns));
+
+  // The buffer contents can be used directly as a Kafka message payload. It
+  // is reused for each message; use JsonWriter::COMPACT as the indent for
+  // the smallest payload. PublishPipeline serialises and delivers messages
+  // without blocking the caller.
+  std::string messageBuffer;
 
+  commandBuilder.writeStartMessage(messageBuffer);
+  std::cout << messageBuffer << std::endl;
   std::ofstream startOut("startMessage.json");
-  startOut << commandBuilder.startMessageAsString();
+  startOut << messageBuffer;
   startOut.close();
 
+  commandBuilder.writeStopMessage(messageBuffer);
+  std::cout << messageBuffer << std::endl;
   std::ofstream stopOut("stopMessage.json");
-  stopOut << commandBuilder.stopMessageAsString();
+  stopOut << messageBuffer;
   stopOut.close();
 
   return 0;
@@ -0,0 +1,879 @@
+// Correctness tests for NexusWriteCommandBuilder and the modules behind it,
+// run by CTest. The streamed messages are checked against the DOM reference,
+// startMessageAsJson(), and the fast paths against their simple equivalents.
+//
+// Usage: nexus_json_cpp_tests
+
+#include "BuildStats.h"
+#include "ChunkedPayload.h"
+#include "EscapeScan.h"
+#include "F142Encoder.h"
+#include "InstrumentSkeleton.h"
+#include "Iso8601.h"
+#include "MessageJournal.h"
+#include "NexusWriteCommandBuilder.h"
+#include "NumberFormat.h"
+#include "Periods.h"
+#include "StagingQueue.h"
+#include "StartMessageDelta.h"
+#include "StringPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace {
+
+int failedChecks = 0;
+
+void check(const bool passed, const char *condition, const int line) {
+  if (!passed) {
+    std::printf("  FAILED line %d: %s\n", line, condition);
+    failedChecks++;
+  }
+}
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+const std::string startTime = "2018-07-06T09:47:44";
+
+std::vector<std::string> makePVs(size_t count) {
+  std::vector<std::string> pVs;
+  for (size_t i = 0; i < count; i++) {
+    pVs.push_back("IN:ZOOM:SE_" + std::to_string(i) + ":VALUE_" +
+                  std::to_string(i));
+  }
+  return pVs;
+}
+
+std::vector<float> makeSeries(size_t length, float scale) {
+  std::vector<float> values(length);
+  for (size_t i = 0; i < length; i++) {
+    values[i] =
+        scale * static_cast<float>(i) + 0.1f * static_cast<float>(i % 7);
+  }
+  return values;
+}
+
+// A synthetic instrument with scale times the monitors of the ZOOM example
+void populateInstrument(NexusWriteCommandBuilder &builder, uint32_t scale) {
+  builder.addSample(6.0, 1.0, 6.0);
+  builder.addEndTime("2018-07-06T10:18:21");
+  builder.addTitle("MT Beam A2=6mm SANS");
+  builder.addTotalCounts(170700);
+  builder.addMeasurement();
+  builder.addProgramName("ISISICP.EXE", "SVN R1959");
+  builder.addUser("Alice", "The Unseen University");
+  builder.addPeriods(0, 21.20301055908203f, 20.061872482299805f, 18234, 1, 0,
+                     18234, 1, 1, "Period 1", 20.061872482299805f, 1, 18234);
+  for (uint32_t detector = 1; detector <= scale; detector++) {
+    builder.addDetector(detector, 10.0f + static_cast<float>(detector));
+    builder.addEventDataSource(detector, "ICP");
+  }
+  builder.addSELogSources(makePVs(3 * scale));
+  for (uint32_t monitor = 1; monitor <= 8 * scale; monitor++) {
+    builder.addMonitor(monitor, monitor);
+  }
+  const auto times = makeSeries(4 * scale, 1.5f);
+  builder.addRunlogRecord<std::vector<float>>(
+      "count_rate", makeSeries(4 * scale, 0.37f), times, startTime, "counts");
+  builder.addFramelogRecord<std::vector<float>>(
+      "proton_charge", makeSeries(4 * scale, 0.001f), times, startTime,
+      "uAh");
+}
+
+bool throwsRuntimeError(const std::function<void()> &call) {
+  try {
+    call();
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  return false;
+}
+
+// The streamed start message is the same as dumping the DOM reference
+bool matchesReference(const NexusWriteCommandBuilder &builder) {
+  std::string compact;
+  builder.writeStartMessage(compact, JsonWriter::COMPACT);
+  return compact == builder.startMessageAsJson().dump() &&
+         builder.startMessageAsString(4) ==
+             builder.startMessageAsJson().dump(4);
+}
+
+// The child of the entry with the given name, or null
+const nlohmann::json *entryChild(const nlohmann::json &startMessage,
+                                 const std::string &name) {
+  for (const auto &child :
+       startMessage["nexus_structure"]["children"][0]["children"]) {
+    if (child.find("name") != child.end() && child["name"] == name) {
+      return &child;
+    }
+  }
+  return nullptr;
+}
+
+void testSerialisation() {
+  for (const uint32_t scale : {1u, 16u}) {
+    NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2",
+                                     startTime);
+    populateInstrument(builder, scale);
+    CHECK(matchesReference(builder));
+  }
+}
+
+// addSELogSources always gives a selog group, a staging queue only once it
+// has PVs
+void testEmptySELogGroup() {
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  builder.addSELogSources(std::vector<std::string>());
+  const auto startMessage = builder.startMessageAsJson();
+  const auto *selog = entryChild(startMessage, "selog");
+  CHECK(selog != nullptr && (*selog)["children"].empty());
+  CHECK(matchesReference(builder));
+
+  NexusWriteCommandBuilder staged("ZOOM", 4112, "broker", "18_2", startTime);
+  const auto queue = staged.createStagingQueue();
+  CHECK(entryChild(staged.startMessageAsJson(), "selog") == nullptr);
+  CHECK(matchesReference(staged));
+}
+
+void testSkeletonCache() {
+  InstrumentConfig config;
+  config.instrumentName = "ZOOM";
+  config.monitors = {{1, 1}, {2, 2}};
+  config.detectors = {{1, 10.0f}};
+  config.seLogPVs = makePVs(3);
+  InstrumentSkeletonCache cache;
+  const auto skeleton = cache.get(config);
+  CHECK(cache.get(config) == skeleton);
+  auto other = config;
+  other.monitors[1].spectrumIndex = 3;
+  CHECK(cache.get(other) != skeleton);
+
+  // A configuration with an ID is only made the first time
+  int configsMade = 0;
+  const auto makeConfig = [&] {
+    configsMade++;
+    return config;
+  };
+  const auto byID = cache.get("ZOOM", "1", makeConfig);
+  CHECK(cache.get("ZOOM", "1", makeConfig) == byID);
+  CHECK(cache.get("ZOOM", "2", makeConfig) != byID);
+  CHECK(configsMade == 2);
+
+  NexusWriteCommandBuilder fromSkeleton(byID, 4112, "broker", "18_2",
+                                        startTime);
+  CHECK(matchesReference(fromSkeleton));
+
+  // The skeleton's groups are fixed
+  CHECK(throwsRuntimeError([&] { fromSkeleton.addMonitor(1, 1); }));
+  CHECK(throwsRuntimeError([&] { fromSkeleton.addMonitors(3, 2, 3); }));
+  CHECK(throwsRuntimeError([&] { fromSkeleton.addDetector(2, 10.0f); }));
+  CHECK(throwsRuntimeError(
+      [&] { fromSkeleton.addSELogSources({"IN:ZOOM:CS:SB:Field"}); }));
+  CHECK(throwsRuntimeError([&] {
+    fromSkeleton.createStagingQueue()->addSELogSources({"IN:ZOOM:CS:SB:B"});
+  }));
+  CHECK(matchesReference(fromSkeleton));
+}
+
+// Typed log columns are labelled with the NeXus type of their values
+void testLogColumns() {
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  LogColumns columns({0.0f, 1.0f}, startTime);
+  columns.addColumn<int32_t>("events_log", {11, 8}, "counts");
+  const std::vector<double> charges = {0.001091, 0.001045};
+  columns.addColumn("proton_charge", charges.data(), charges.size());
+  builder.addFramelogColumns(std::move(columns));
+  CHECK(matchesReference(builder));
+
+  const auto startMessage = builder.startMessageAsJson();
+  const auto *framelog = entryChild(startMessage, "framelog");
+  CHECK(framelog != nullptr);
+  if (framelog != nullptr) {
+    const auto &logs = (*framelog)["children"];
+    CHECK(logs[0]["children"][0]["dataset"]["type"] == "float");
+    CHECK(logs[0]["children"][1]["dataset"]["type"] == "int32");
+    CHECK(logs[1]["children"][1]["dataset"]["type"] == "double");
+  }
+}
+
+// number formatted by formatFloat reads back as the same float, whether it is
+// read as one or, as nlohmann::json does, as a double, and is no longer than
+// formatDouble makes it
+bool formatsAsSameFloat(const float number) {
+  char buffer[maxFormattedNumberLength + 1];
+  *formatFloat(buffer, number) = '\0';
+  char asDouble[maxFormattedNumberLength + 1];
+  *formatDouble(asDouble, number) = '\0';
+  const float readAsFloat = std::strtof(buffer, nullptr);
+  const auto readAsDouble = static_cast<float>(std::strtod(buffer, nullptr));
+  return std::memcmp(&readAsFloat, &number, sizeof(number)) == 0 &&
+         std::memcmp(&readAsDouble, &number, sizeof(number)) == 0 &&
+         std::strlen(buffer) <= std::strlen(asDouble);
+}
+
+// A strided sweep of the float bit patterns, and the values near the one
+// formatFloat special cases, through formatFloat and a SHORTEST_FLOAT32
+// writer
+void testFloatFormatting() {
+  const auto failedBefore = failedChecks;
+  std::vector<float> numbers = {
+      0.0f,
+      -0.0f,
+      0.37f,
+      std::numeric_limits<float>::min(),
+      std::numeric_limits<float>::denorm_min(),
+      std::numeric_limits<float>::max(),
+      std::numeric_limits<float>::epsilon()};
+  for (const float special : {7.0385307e-26f, -7.0385307e-26f}) {
+    numbers.push_back(special);
+    numbers.push_back(std::nextafter(special, 0.0f));
+    numbers.push_back(std::nextafter(special, 2 * special));
+  }
+  // An odd stride reaches every exponent and a spread of mantissas
+  const uint64_t stride = 4099;
+  for (uint64_t bits = 0; bits <= std::numeric_limits<uint32_t>::max();
+       bits += stride) {
+    const auto pattern = static_cast<uint32_t>(bits);
+    float number;
+    std::memcpy(&number, &pattern, sizeof(number));
+    if (std::isfinite(number)) {
+      numbers.push_back(number);
+    }
+  }
+  for (const auto number : numbers) {
+    CHECK(formatsAsSameFloat(number));
+    // Stop at the first value which fails rather than report thousands
+    if (failedChecks != failedBefore) {
+      std::printf("  with %.9g\n", static_cast<double>(number));
+      return;
+    }
+  }
+  char buffer[maxFormattedNumberLength];
+  CHECK(std::string(buffer, formatFloat(buffer, NAN)) == "null");
+  CHECK(std::string(buffer, formatFloat(buffer, -INFINITY)) == "null");
+
+  std::string output;
+  JsonWriter writer(output, JsonWriter::COMPACT, FloatFormat::SHORTEST_FLOAT32);
+  writer.startArray();
+  writer.value(7.0385307e-26f);
+  writer.array(numbers.data(), numbers.size());
+  writer.endArray();
+  const auto parsed = nlohmann::json::parse(output);
+  CHECK(parsed[0].get<double>() == static_cast<double>(7.0385307e-26f));
+  CHECK(parsed[1].size() == numbers.size());
+  size_t sameFloats = 0;
+  while (sameFloats < numbers.size() && sameFloats < parsed[1].size() &&
+         static_cast<float>(parsed[1][sameFloats].get<double>()) ==
+             numbers[sameFloats]) {
+    sameFloats++;
+  }
+  CHECK(sameFloats == numbers.size());
+}
+
+PeriodColumns makePeriodColumns(std::vector<int32_t> frames) {
+  const auto size = frames.size();
+  PeriodColumns columns;
+  columns.output.assign(size, 0);
+  columns.totalCountsInMegaElectronVolts.assign(size, 0.0f);
+  columns.protonChargeInMicroAmpHours.assign(size, 0.0f);
+  columns.goodFramesDaq.assign(size, 0);
+  columns.sequences.assign(size, 0);
+  columns.framesRequested.assign(size, 0);
+  columns.goodFrames = frames;
+  columns.number.assign(size, 0);
+  columns.highestUsed.assign(size, 0);
+  columns.labels.assign(size, "");
+  columns.protonChargeRawInMicroAmpHours.assign(size, 0.0f);
+  columns.type.assign(size, 1);
+  columns.rawFrames = std::move(frames);
+  return columns;
+}
+
+// The frame totals may pass through values an int32 cannot hold, but must
+// end up within one
+void testPeriodTotals() {
+  const auto max = std::numeric_limits<int32_t>::max();
+  Periods periods;
+  periods.add(makePeriodColumns({max, 1, -1}));
+  CHECK(periods.goodFrames() == max);
+  CHECK(periods.rawFrames() == max);
+
+  // Periods whose totals would overflow are rejected when they are added
+  Periods overflowing;
+  CHECK(throwsRuntimeError(
+      [&] { overflowing.add(makePeriodColumns({max, 1})); }));
+  CHECK(overflowing.size() == 0);
+  overflowing.add(makePeriodColumns({max}));
+  Period period;
+  period.rawFrames = 1;
+  CHECK(throwsRuntimeError([&] { overflowing.add(period); }));
+  CHECK(overflowing.size() == 1 && overflowing.rawFrames() == max);
+
+  // A builder is left as if they had never been added
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  CHECK(throwsRuntimeError(
+      [&] { builder.addPeriods(makePeriodColumns({max, 1})); }));
+  CHECK(entryChild(builder.startMessageAsJson(), "periods") == nullptr);
+  builder.addPeriods(makePeriodColumns({max}));
+  CHECK(throwsRuntimeError([&] { builder.addPeriod(period); }));
+  CHECK(matchesReference(builder));
+}
+
+void testIso8601() {
+  const int64_t second = 1000000;
+  const int64_t time = 1530870464 * second;
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T09:47:44") == time);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T09:47:44Z") == time);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T10:47:44+01:00") == time);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T04:17:44-0530") == time);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T11:47:44+02") == time);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T09:47:44+00:00") == time);
+
+  // Fractions are truncated to microseconds
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T09:47:44.1") ==
+        time + 100000);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T09:47:44,123Z") ==
+        time + 123000);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T09:47:44.123456") ==
+        time + 123456);
+  CHECK(iso8601ToUnixTimeMicroseconds("2018-07-06T09:47:44.123456789+00") ==
+        time + 123456);
+  CHECK(iso8601ToUnixTimeMilliseconds("2018-07-06T09:47:44.1239") ==
+        time / 1000 + 123);
+
+  // A leap second is the same as the first second of the next minute
+  CHECK(iso8601ToUnixTimeMicroseconds("2016-12-31T23:59:60Z") ==
+        1483228800 * second);
+
+  // Times before 1970 count back from the epoch
+  CHECK(iso8601ToUnixTimeMicroseconds("1969-12-31T23:59:59Z") == -second);
+  CHECK(iso8601ToUnixTimeMicroseconds("1969-12-31T23:59:59.5Z") ==
+        -second / 2);
+  CHECK(iso8601ToUnixTimeMilliseconds("1969-12-31T23:59:59.9995Z") == -1);
+  CHECK(iso8601ToUnixTimeMicroseconds("1900-02-28T12:00:00Z") ==
+        -2203934400 * second);
+
+  // February 29th only exists in leap years
+  CHECK(iso8601ToUnixTimeMicroseconds("2016-02-29T00:00:00Z") ==
+        1456704000 * second);
+  CHECK(iso8601ToUnixTimeMicroseconds("1600-02-29T00:00:00Z") ==
+        -11670998400 * second);
+  CHECK(throwsRuntimeError(
+      [] { iso8601ToUnixTimeMicroseconds("2017-02-29T00:00:00Z"); }));
+  CHECK(throwsRuntimeError(
+      [] { iso8601ToUnixTimeMicroseconds("1900-02-29T00:00:00Z"); }));
+
+  // Random dates against counting the days one year and month at a time
+  std::mt19937 random(11);
+  const int monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  const auto isLeap = [](int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  };
+  for (int i = 0; i < 20000; i++) {
+    const int year = 1600 + int(random() % 800);
+    const int month = 1 + int(random() % 12);
+    const int day = 1 + int(random() % 28);
+    const int hour = int(random() % 24);
+    int64_t days = day - 1;
+    for (int y = std::min(year, 1970); y < std::max(year, 1970); y++) {
+      days += (year < 1970 ? -1 : 1) * (isLeap(y) ? 366 : 365);
+    }
+    for (int m = 1; m < month; m++) {
+      days += monthDays[m - 1] + (m == 2 && isLeap(year) ? 1 : 0);
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%04d-%02d-%02dT%02d:30:15.25-01:30",
+                  year, month, day, hour);
+    const int64_t expected =
+        (days * 86400 + hour * 3600 + 30 * 60 + 15 + 5400) * second + 250000;
+    CHECK(iso8601ToUnixTimeMicroseconds(text) == expected);
+  }
+
+  for (const char *malformed :
+       {"", "2018", "2018-07-06", "2018-07-06 09:47:44", "2018-07-06T09:47",
+        "2018-07-06T09:47:44.", "2018-07-06T09:47:44.1234567890",
+        "2018-07-06T09:47:44+", "2018-07-06T09:47:44+1",
+        "2018-07-06T09:47:44+01:", "2018-07-06T09:47:44+24:00",
+        "2018-07-06T09:47:44Z ", "2018-13-06T09:47:44", "2018-07-32T09:47:44",
+        "2018-07-06T24:00:00", "2018-07-06T09:60:00", "2018-07-06T09:47:61",
+        "2018-7-06T09:47:44"}) {
+    const auto parse = [&] { iso8601ToUnixTimeMicroseconds(malformed); };
+    if (!throwsRuntimeError(parse)) {
+      std::printf("  accepted \"%s\"\n", malformed);
+      CHECK(false);
+    }
+  }
+
+  // The builder rejects a start time it cannot parse
+  CHECK(throwsRuntimeError([] {
+    NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", "");
+  }));
+}
+
+void testStartMessageDelta() {
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 4);
+  NexusWriteCommandBuilder nextRun("ZOOM", 4113, "broker", "18_2", startTime);
+  populateInstrument(nextRun, 4);
+  nextRun.addTitle("Next run");
+  const auto baseline = builder.startMessageAsJson();
+  const auto delta = nextRun.startMessageDelta(baseline);
+  CHECK(applyStartMessageDelta(baseline, delta) ==
+        nextRun.startMessageAsJson());
+}
+
+void testAmendment() {
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 1);
+  std::string message;
+  builder.writeStartMessage(message, JsonWriter::COMPACT);
+  const std::string oldTitle = "MT Beam A2=6mm SANS";
+  const std::string newTitle = "Amended title";
+
+  auto loaded = NexusWriteCommandBuilder::fromStartMessage(message);
+  loaded.addTitle(newTitle);
+  std::string amended;
+  loaded.writeStartMessage(amended, JsonWriter::COMPACT);
+  // The replaced title moves to the end of the entry, so only its size and
+  // contents are compared
+  CHECK(amended.size() + oldTitle.size() == message.size() + newTitle.size());
+  CHECK(amended.find(oldTitle) == std::string::npos);
+  CHECK(amended.find(newTitle) != std::string::npos);
+}
+
+// A loaded selog group is kept until PVs are staged in its place
+void testStagingAfterLoading() {
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 1);
+  std::string message;
+  builder.writeStartMessage(message, JsonWriter::COMPACT);
+  const auto originalMessage = builder.startMessageAsJson();
+  const auto *original = entryChild(originalMessage, "selog");
+  CHECK(original != nullptr && (*original)["children"].size() == 3);
+
+  auto loaded = NexusWriteCommandBuilder::fromStartMessage(message);
+  const auto queue = loaded.createStagingQueue();
+  std::string reloaded;
+  loaded.writeStartMessage(reloaded, JsonWriter::COMPACT);
+  CHECK(reloaded == message);
+  CHECK(matchesReference(loaded));
+
+  // PVs staged or added on a loaded builder join the loaded ones, and are
+  // checked against them
+  queue->addSELogSources({"IN:ZOOM:SE_NEW:VALUE"});
+  loaded.addSELogSources({"IN:ZOOM:SE_NEWER:NEWER_VALUE"});
+  const auto startMessage = loaded.startMessageAsJson();
+  const auto *selog = entryChild(startMessage, "selog");
+  CHECK(selog != nullptr && (*selog)["children"].size() == 5);
+  CHECK(matchesReference(loaded));
+  CHECK(throwsRuntimeError(
+      [&] { loaded.addSELogSources({"IN:ZOOM:SE_OTHER:VALUE_2"}); }));
+
+  // A selog group the builder would not have written is kept as it was, and
+  // cannot be added to
+  auto foreignMessage = message;
+  const std::string topic = "\"ZOOM_sampleEnv\"";
+  for (auto position = foreignMessage.find(topic);
+       position != std::string::npos;
+       position = foreignMessage.find(topic, position)) {
+    foreignMessage.replace(position, topic.size(), "\"OTHER_sampleEnv\"");
+  }
+  auto foreign = NexusWriteCommandBuilder::fromStartMessage(foreignMessage);
+  const auto foreignQueue = foreign.createStagingQueue();
+  CHECK(throwsRuntimeError(
+      [&] { foreign.addSELogSources({"IN:ZOOM:SE_NEW:VALUE"}); }));
+  CHECK(throwsRuntimeError(
+      [&] { foreignQueue->addSELogSources({"IN:ZOOM:SE_NEW:VALUE"}); }));
+  std::string rewritten;
+  foreign.writeStartMessage(rewritten, JsonWriter::COMPACT);
+  CHECK(rewritten == foreignMessage);
+}
+
+// The records one producer adds, to a staging queue or directly to a builder
+template <typename Target>
+void addProducerRecords(Target &target, const int producer) {
+  const auto times = makeSeries(16, 1.0f);
+  for (int i = 0; i < 50; i++) {
+    const auto suffix = std::to_string(producer) + "_" + std::to_string(i);
+    target.template addRunlogRecord<std::vector<float>>(
+        "runlog_" + suffix, makeSeries(16, 0.5f * (i + 1)), times, startTime,
+        "K");
+    target.template addFramelogRecord<std::vector<int32_t>>(
+        "framelog_" + suffix, std::vector<int32_t>(16, i), times, startTime);
+    target.template addVmsRecord<int32_t>("VMS_" + suffix, producer * i);
+    target.addSELogSources({"IN:ZOOM:SE:PV_" + suffix});
+  }
+}
+
+// Producers filling their own queues at the same time give the same message
+// every time, the same as adding their records directly in queue order
+void testConcurrentStaging() {
+  const int producers = 8;
+  NexusWriteCommandBuilder direct("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(direct, 1);
+  for (int producer = 0; producer < producers; producer++) {
+    addProducerRecords(direct, producer);
+  }
+  const auto expected = direct.startMessageAsString(JsonWriter::COMPACT);
+
+  for (int attempt = 0; attempt < 4; attempt++) {
+    NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2",
+                                     startTime);
+    populateInstrument(builder, 1);
+    std::vector<std::shared_ptr<StagingQueue>> queues;
+    for (int producer = 0; producer < producers; producer++) {
+      queues.push_back(builder.createStagingQueue());
+    }
+    std::vector<std::thread> threads;
+    for (int producer = 0; producer < producers; producer++) {
+      threads.emplace_back([&queues, producer] {
+        addProducerRecords(*queues[producer], producer);
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    CHECK(builder.startMessageAsString(JsonWriter::COMPACT) == expected);
+    CHECK(matchesReference(builder));
+
+    // A queue in use while a message is serialised, or by a second thread,
+    // is an error rather than a race
+    StagingQueue::UseScope inUse(*queues[0]);
+    CHECK(throwsRuntimeError(
+        [&] { builder.startMessageAsString(JsonWriter::COMPACT); }));
+    CHECK(throwsRuntimeError([&] { builder.startMessageAsJson(); }));
+    CHECK(throwsRuntimeError(
+        [&] { queues[0]->addVmsRecord<int32_t>("VMS_IN_USE", 1); }));
+    CHECK(throwsRuntimeError(
+        [&] { queues[0]->addSELogSources({"IN:ZOOM:SE:IN_USE"}); }));
+  }
+}
+
+void testChunking() {
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 16);
+  builder.addRunlogRecord<std::vector<float>>(
+      "long_log", makeSeries(100000, 0.37f), makeSeries(100000, 0.1f),
+      startTime);
+  std::string message;
+  builder.writeStartMessage(message, JsonWriter::COMPACT);
+  for (const bool compress : {false, true}) {
+    std::vector<std::string> chunks;
+    const auto numberOfChunks = writeStartMessageChunks(
+        builder, 7, 64 * 1024,
+        [&](const char *data, size_t size) {
+          chunks.emplace_back(data, size);
+        },
+        compress);
+    CHECK(numberOfChunks == chunks.size());
+    CHECK(chunks.size() > 1);
+    // Out of order, as they may arrive
+    ChunkReassembler reassembler;
+    std::string reassembled;
+    uint64_t messageID = 0;
+    bool complete = false;
+    for (size_t i = chunks.size(); i > 0; i--) {
+      complete = reassembler.add(chunks[i - 1].data(), chunks[i - 1].size(),
+                                 messageID, reassembled);
+    }
+    CHECK(complete);
+    CHECK(messageID == 7);
+    CHECK(reassembled == message);
+  }
+}
+
+void testMonitorRanges() {
+  NexusWriteCommandBuilder oneByOne("ZOOM", 4112, "broker", "18_2",
+                                    startTime);
+  NexusWriteCommandBuilder ranged("ZOOM", 4112, "broker", "18_2", startTime);
+  for (uint32_t monitor = 1; monitor <= 100; monitor++) {
+    oneByOne.addMonitor(monitor, 2 * monitor + 7);
+  }
+  ranged.addMonitors(1, 100, 9, 2);
+  CHECK(ranged.startMessageAsString(JsonWriter::COMPACT) ==
+        oneByOne.startMessageAsString(JsonWriter::COMPACT));
+  CHECK(ranged.startMessageAsJson() == oneByOne.startMessageAsJson());
+}
+
+void testSpectrumMap() {
+  // Tubes of 512 pixels, each tube numbered from a multiple of 1000 and
+  // mapped to spectra in reverse
+  const uint32_t tubeLength = 512;
+  const uint32_t pixels = 16 * tubeLength;
+  std::vector<int32_t> detectorNumbers;
+  std::vector<int32_t> spectrumIndices;
+  for (uint32_t pixel = 0; pixel < pixels; pixel++) {
+    const auto tube = pixel / tubeLength;
+    detectorNumbers.push_back(
+        static_cast<int32_t>(1000 * tube + pixel % tubeLength));
+    spectrumIndices.push_back(
+        static_cast<int32_t>(tubeLength * (tube + 1) - pixel % tubeLength));
+  }
+  SpectrumMap spectrumMap;
+  spectrumMap.add(detectorNumbers.data(), spectrumIndices.data(), pixels);
+  CHECK(spectrumMap.size() == pixels);
+  CHECK(spectrumMap.runs().size() == 16);
+  NexusWriteCommandBuilder bank("ZOOM", 4112, "broker", "18_2", startTime);
+  bank.addDetector(1, 10.0f, std::move(spectrumMap));
+  CHECK(matchesReference(bank));
+}
+
+void testStreams() {
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  for (uint32_t i = 0; i < 100; i++) {
+    const auto name = "SE_" + std::to_string(i) + "_temperature";
+    builder.addRunlogStream(name);
+    builder.addFramelogStream(name);
+    builder.addEventDataSource(i, "ICP");
+  }
+  CHECK(matchesReference(builder));
+}
+
+// Each value type is read back exactly, and a message cut short is rejected
+// rather than read past its end
+template <typename T> void checkF142RoundTrip(const T value) {
+  const std::string sourceName = "IN:ZOOM:SE:SAMPLE_TEMPERATURE_SENSOR_1";
+  const uint64_t timestamp = 1534244544123456789;
+  std::string message;
+  encodeF142(sourceName, value, timestamp, message);
+  const auto decoded = decodeF142(message.data(), message.size());
+  CHECK(decoded.sourceName == sourceName);
+  CHECK(decoded.value == static_cast<double>(value));
+  CHECK(decoded.timestampNanoseconds == timestamp);
+
+  // Only the name's terminator and padding may be cut off without an error
+  for (size_t size = 0; size < message.size(); size++) {
+    bool threw = false;
+    try {
+      CHECK(decodeF142(message.data(), size).sourceName == sourceName);
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+    CHECK(threw || size + 4 >= message.size());
+  }
+}
+
+void testF142() {
+  checkF142RoundTrip<int32_t>(-123456);
+  checkF142RoundTrip<int64_t>(int64_t(1) << 40);
+  checkF142RoundTrip<float>(3.5f);
+  checkF142RoundTrip<double>(0.001091);
+}
+
+void testStringPool() {
+  // Interned strings must be written exactly as dump() escapes them
+  StringPool pool;
+  const std::string strings[] = {"ZOOM_runLog", "", "tab\tquote\"backslash\\",
+                                 std::string("nul\0byte", 8),
+                                 "R\xc3\xa9glage \xe2\x82\xac"};
+  for (const auto &str : strings) {
+    const auto interned = pool.intern(str);
+    CHECK(interned.str() == str);
+    CHECK(interned.json() == nlohmann::json(str).dump());
+    CHECK(pool.intern(str) == interned);
+  }
+  CHECK(pool.size() == sizeof(strings) / sizeof(strings[0]));
+}
+
+// Mostly printable ASCII, with the bytes which are escaped, valid UTF-8
+// sequences and rarer invalid ones: a truncated sequence, a byte which never
+// appears, a surrogate and an overlong encoding
+std::string makeRandomString(std::mt19937 &random, const size_t length) {
+  const std::string specials[] = {"\"",
+                                  "\\",
+                                  "\n",
+                                  "\t",
+                                  "\x01",
+                                  "\x1f",
+                                  "\x7f",
+                                  "\xc3\xa9",
+                                  "\xe2\x82\xac",
+                                  "\xf0\x9f\x98\x80",
+                                  "\xc3",
+                                  "\xff",
+                                  "\xed\xa0\x80",
+                                  "\xe0\x80\xaf"};
+  std::string str;
+  while (str.size() < length) {
+    const auto choice = random() % 64;
+    if (choice < 10) {
+      str += specials[choice];
+    } else if (choice == 10) {
+      str += specials[10 + random() % 4];
+    } else {
+      str.push_back(static_cast<char>(0x20 + random() % 0x5F));
+    }
+  }
+  return str;
+}
+
+// What nlohmann::json::dump writes for the string, or an empty string if it
+// rejects it
+std::string escapedByDump(const std::string &str) {
+  try {
+    return nlohmann::json(str).dump();
+  } catch (const std::exception &) {
+    return {};
+  }
+}
+
+std::string escapedByJsonWriter(const std::string &str) {
+  std::string output;
+  try {
+    JsonWriter writer(output, JsonWriter::COMPACT);
+    writer.value(str);
+  } catch (const std::exception &) {
+    return {};
+  }
+  return output;
+}
+
+// Every scanner against a byte at a time, and the escaped strings against
+// nlohmann::json::dump
+void testEscaping() {
+  const auto failedBefore = failedChecks;
+  std::mt19937 random(22);
+  for (size_t i = 0; i < 20000; i++) {
+    const auto str = makeRandomString(random, random() % 100);
+    CHECK(escapedByJsonWriter(str) == escapedByDump(str));
+    for (size_t index = 0; index <= str.size(); index++) {
+      auto expected = index;
+      for (; expected < str.size(); expected++) {
+        const auto byte = static_cast<unsigned char>(str[expected]);
+        if (byte < 0x20 || byte >= 0x80 || byte == '"' || byte == '\\') {
+          break;
+        }
+      }
+      for (const auto scanner : {EscapeScanner::SCALAR, EscapeScanner::SSE2,
+                                 EscapeScanner::AVX2}) {
+        if (escapeScannerSupported(scanner)) {
+          CHECK(findSpecialByte(scanner, str.data(), index, str.size()) ==
+                expected);
+        }
+      }
+    }
+    // Stop at the first string which fails rather than report thousands
+    if (failedChecks != failedBefore) {
+      return;
+    }
+  }
+}
+
+// Only recorded when built with NEXUS_JSON_INSTRUMENTATION
+void testBuildStats() {
+  if (!buildStatsEnabled) {
+    return;
+  }
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 4);
+  std::string buffer;
+  const int serialisations = 4;
+  for (int i = 0; i < serialisations; i++) {
+    builder.writeStartMessage(buffer, JsonWriter::COMPACT);
+  }
+  uint64_t bytes = 0;
+  for (const auto &section : builder.buildStats().sections) {
+    bytes += section.serialisedBytes;
+  }
+  CHECK(bytes == serialisations * buffer.size());
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+void testJournal() {
+  char directory[] = "/tmp/nexus_journal_test_XXXXXX";
+  CHECK(mkdtemp(directory) != nullptr);
+  NexusWriteCommandBuilder builder("ZOOM", 4112, "broker", "18_2", startTime);
+  populateInstrument(builder, 1);
+  std::string startMessage;
+  builder.writeStartMessage(startMessage, JsonWriter::COMPACT);
+  const size_t runs = 64;
+  {
+    MessageJournalWriter journal(directory);
+    for (size_t i = 0; i < runs; i++) {
+      journal.append("job-" + std::to_string(i), JournalMessageKind::START,
+                     startMessage);
+    }
+  }
+  size_t numberOfSegments = 0;
+  {
+    MessageJournalReader journal(directory);
+    CHECK(journal.numberOfRecords() == runs);
+    for (size_t i = 0; i < runs; i++) {
+      StringRef message("", 0);
+      CHECK(journal.find("job-" + std::to_string(i), JournalMessageKind::START,
+                         message));
+      CHECK(message.str() == startMessage);
+    }
+    numberOfSegments = journal.numberOfSegments();
+  }
+  for (size_t i = 0; i < numberOfSegments; i++) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "/journal-%06zu.seg", i);
+    unlink((std::string(directory) + name).c_str());
+  }
+  rmdir(directory);
+}
+#endif
+
+struct Test {
+  const char *name;
+  std::function<void()> run;
+};
+}
+
+int main() {
+  const std::vector<Test> tests = {
+      {"serialisation", testSerialisation},
+      {"empty selog group", testEmptySELogGroup},
+      {"skeleton cache", testSkeletonCache},
+      {"log columns", testLogColumns},
+      {"float formatting", testFloatFormatting},
+      {"period totals", testPeriodTotals},
+      {"iso8601", testIso8601},
+      {"start message delta", testStartMessageDelta},
+      {"amendment", testAmendment},
+      {"staging after loading", testStagingAfterLoading},
+      {"concurrent staging", testConcurrentStaging},
+      {"chunking", testChunking},
+      {"monitor ranges", testMonitorRanges},
+      {"spectrum map", testSpectrumMap},
+      {"streams", testStreams},
+      {"f142", testF142},
+      {"string pool", testStringPool},
+      {"escaping", testEscaping},
+      {"build stats", testBuildStats},
+#if defined(__unix__) || defined(__APPLE__)
+      {"journal", testJournal},
+#endif
+  };
+  int failedTests = 0;
+  for (const auto &test : tests) {
+    const auto failedBefore = failedChecks;
+    try {
+      test.run();
+    } catch (const std::exception &e) {
+      std::printf("  FAILED with exception: %s\n", e.what());
+      failedChecks++;
+    }
+    const bool passed = failedChecks == failedBefore;
+    std::printf("%s %s\n", passed ? "PASSED" : "FAILED", test.name);
+    failedTests += passed ? 0 : 1;
+  }
+  std::printf("%d of %zu tests failed\n", failedTests, tests.size());
+  return failedTests == 0 ? 0 : 1;
+}